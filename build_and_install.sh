@@ -12,6 +12,13 @@ SOURCE_FILES=(
 		"./source/build_task_resource_files.cpp"
 		"./source/configuration.cpp"
 		"./source/dependencies.cpp"
+		"./source/directory_index.cpp"
+		"./source/path_table.cpp"
+		"./source/worker_pool.cpp"
+		"./source/build_log.cpp"
+		"./source/link_stamp.cpp"
+		"./source/object_cache.cpp"
+		"./source/remote_cache.cpp"
 		"./source/lz4/lz4.c"
 		"./source/main.cpp"
 		"./source/misc.cpp"
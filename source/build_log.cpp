@@ -0,0 +1,142 @@
+/*
+   Copyright (C) 2017, Richard e Collins.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <fstream>
+#include <sstream>
+
+#include "misc.h"
+#include "build_log.h"
+
+namespace appbuild{
+//////////////////////////////////////////////////////////////////////////
+// An include costs about the same to compile as this many bytes of source. A guess, it only matters for files we have no history for.
+static const int64_t INCLUDE_COST = 4096;
+
+// Files that failed last time go first, then ones that have been edited, then the rest longest first. This is bigger than any compile time in milliseconds.
+static const int64_t PRIORITY_EDITED = 1LL << 40;
+static const int64_t PRIORITY_FAILED = 1LL << 41;
+
+BuildLog::BuildLog():
+	mMillisecondsPerCost(0.001),// Till we know better, 1ms per KB.
+	mNumWithHistory(0),
+	mDirty(false)
+{
+}
+
+bool BuildLog::Load(const std::string& pLogFilename)
+{
+	std::ifstream file(pLogFilename);
+	if( !file.is_open() )
+		return false;
+
+	// Each line is 'milliseconds cost compiled failed object', the object last as it may have spaces.
+	std::lock_guard<std::mutex> lock(mLock);
+	int64_t totalMilliseconds = 0;
+	int64_t totalCost = 0;
+	std::string line;
+	while( std::getline(file,line) )
+	{
+		if( line.size() == 0 || line[0] == '#' )
+			continue;
+
+		std::istringstream fields(line);
+		Entry entry;
+		int64_t compiled;
+		int failed;
+		std::string objectFile;
+		if( fields >> entry.mMilliseconds >> entry.mCost >> compiled >> failed && std::getline(fields >> std::ws,objectFile) && objectFile.size() > 0 )
+		{
+			entry.mCompiled = (time_t)compiled;
+			entry.mFailed = failed != 0;
+			mEntries[objectFile] = entry;
+			if( entry.mCost > 0 && !entry.mFailed )
+			{
+				totalMilliseconds += entry.mMilliseconds;
+				totalCost += entry.mCost;
+			}
+		}
+	}
+
+	if( totalMilliseconds > 0 && totalCost > 0 )
+		mMillisecondsPerCost = (double)totalMilliseconds / (double)totalCost;
+
+	return true;
+}
+
+bool BuildLog::Save(const std::string& pLogFilename)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	if( !mDirty )
+		return true;
+
+	MakeDirForFile(pLogFilename);
+	std::ofstream file(pLogFilename,std::ofstream::trunc);
+	if( !file.is_open() )
+		return false;
+
+	file << "# appbuild build log: milliseconds cost compiled failed object\n";
+	for( const auto& entry : mEntries )
+	{
+		file << entry.second.mMilliseconds << ' ' << entry.second.mCost << ' ' << (int64_t)entry.second.mCompiled << ' ' << (entry.second.mFailed ? 1 : 0) << ' ' << entry.first << '\n';
+	}
+
+	file.close();
+	if( !file )
+		return false;
+
+	mDirty = false;
+	return true;
+}
+
+int64_t BuildLog::GetPriority(const std::string& pObjectFile,const std::string& pSourceFile,size_t pNumIncludes)
+{
+	struct stat Stats;
+	const bool haveStats = stat(pSourceFile.c_str(),&Stats) == 0;
+	const int64_t cost = (haveStats ? (int64_t)Stats.st_size : 0) + (int64_t)pNumIncludes * INCLUDE_COST;
+
+	std::lock_guard<std::mutex> lock(mLock);
+	mCosts[pObjectFile] = cost;
+
+	EntryMap::const_iterator found = mEntries.find(pObjectFile);
+	if( found == mEntries.end() )
+		return (int64_t)(cost * mMillisecondsPerCost);
+
+	mNumWithHistory++;
+	int64_t priority = found->second.mMilliseconds;
+	if( found->second.mFailed )
+		priority += PRIORITY_FAILED;
+	else if( haveStats && Stats.st_mtim.tv_sec >= found->second.mCompiled )
+		priority += PRIORITY_EDITED;
+
+	return priority;
+}
+
+void BuildLog::Record(const std::string& pObjectFile,int64_t pMilliseconds,bool pOk)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	Entry& entry = mEntries[pObjectFile];
+	entry.mMilliseconds = pMilliseconds;
+	entry.mCost = mCosts[pObjectFile];
+	entry.mCompiled = time(nullptr);
+	entry.mFailed = !pOk;
+	mDirty = true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+};//namespace appbuild
@@ -0,0 +1,93 @@
+/*
+   Copyright (C) 2017, Richard e Collins.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#ifndef __BUILD_LOG_H__
+#define __BUILD_LOG_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <mutex>
+#include <unordered_map>
+
+#include "string_types.h"
+
+namespace appbuild{
+//////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Remembers how long each object file took to compile and if it failed, so the next build can start the slow ones first.
+ * A slow file that starts last holds up the end of the build while every other thread sits idle, started first it overlaps with everything else.
+ * Files that failed last time, or the source file has been edited since, go before all of those. If it's going to fail again you want to know now.
+ * It's a small text file in the output folder, one line per object file.
+ * Safe to use from many threads.
+ */
+class BuildLog
+{
+public:
+	BuildLog();
+
+	/**
+	 * @brief Loads the log from the last build. If it's not there everything is estimated.
+	 */
+	bool Load(const std::string& pLogFilename);
+
+	/**
+	 * @brief Writes the log if anything was recorded.
+	 */
+	bool Save(const std::string& pLogFilename);
+
+	/**
+	 * @brief Works out how soon the file should be compiled, bigger is sooner.
+	 * With no history the time is estimated from the size of the source file and how many files it includes,
+	 * scaled by how long the files we do know about took for their size.
+	 * 
+	 * @param pObjectFile The file being built, what the log is keyed on.
+	 * @param pSourceFile The file being compiled.
+	 * @param pNumIncludes How many files it's known to include, zero if not known.
+	 */
+	int64_t GetPriority(const std::string& pObjectFile,const std::string& pSourceFile,size_t pNumIncludes);
+
+	/**
+	 * @brief Records how a compile went.
+	 * @param pMilliseconds How long it took.
+	 * @param pOk False if it failed, it will go first next time.
+	 */
+	void Record(const std::string& pObjectFile,int64_t pMilliseconds,bool pOk);
+
+	size_t GetNumWithHistory(){std::lock_guard<std::mutex> lock(mLock);return mNumWithHistory;}
+
+private:
+	struct Entry
+	{
+		int64_t mMilliseconds;	//!< How long the last compile took.
+		int64_t mCost;			//!< The estimate, from size and includes, when it was compiled. Used to learn mMillisecondsPerCost.
+		time_t mCompiled;		//!< When it was last compiled, if the source is newer than this it's been edited.
+		bool mFailed;
+	};
+	typedef std::unordered_map<std::string,Entry> EntryMap;
+
+	EntryMap mEntries;
+	std::unordered_map<std::string,int64_t> mCosts;	//!< The estimate for each file in this build, kept for Record.
+	double mMillisecondsPerCost;
+	size_t mNumWithHistory;
+	bool mDirty;
+	std::mutex mLock;
+};
+
+//////////////////////////////////////////////////////////////////////////
+};//namespace appbuild
+
+#endif //#ifndef __BUILD_LOG_H__
@@ -22,40 +22,171 @@
 #include <iostream>
 
 #include "build_task.h"
+#include "worker_pool.h"
 #include "misc.h"
 #include "logging.h"
 
 namespace appbuild{
 //////////////////////////////////////////////////////////////////////////
+void BuildEvent::Signal()
+{
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		mSignalled = true;
+	}
+	mCondition.notify_all();
+}
+
+void BuildEvent::Wait()
+{
+	std::unique_lock<std::mutex> lock(mLock);
+	mCondition.wait(lock,[this](){return mSignalled;});
+	mSignalled = false;
+}
 
+//////////////////////////////////////////////////////////////////////////
 BuildTask::BuildTask(const std::string& pTaskName,int pLoggingMode):
-	mLoggingMode(pLoggingMode),mTaskName(pTaskName),mOk(false),mCompleted(false)
+	mLoggingMode(pLoggingMode),mTaskName(pTaskName),mOk(false),mPriority(0),mCompletedEvent(nullptr),mCompleted(false),mKilled(false),mStarted(false),mFinished(false)
 {
 }
 
 BuildTask::~BuildTask()
 {
-	if( thread.joinable() )
-		thread.join();// Make sure we do not delete the object till the thread has finished.
+	WaitForCompletion();// Make sure we do not delete the object till the worker has finished with it.
 }
 
-void BuildTask::Execute()
+void BuildTask::Execute(BuildEvent* pCompletedEvent)
 {
     if( mLoggingMode >= LOG_INFO )
     {
     	std::cout << "Building: " << mTaskName << '\n';
     }
 
-	thread = std::thread(CallMain,this);
+	mStarted = true;
+	mCompletedEvent = pCompletedEvent;
+	mExecuteTime = std::chrono::steady_clock::now();
+	Start();
+}
+
+void BuildTask::Start()
+{
+	WorkerPool::Get().Submit([this](){Completed(Main());});
+}
+
+void BuildTask::WaitForCompletion()
+{
+	if( mStarted )
+	{
+		std::unique_lock<std::mutex> lock(mFinishedLock);
+		mFinishedCondition.wait(lock,[this](){return mFinished;});
+	}
+}
+
+void BuildTask::Kill()
+{
+	if( !mStarted || mCompleted || mKilled )
+		return;
+
+	mKilled = true;
+	Stop();
+}
+
+void BuildTask::Completed(bool pOk)
+{
+	mOk = pOk;
+	mCompletedTime = std::chrono::steady_clock::now();
+	mCompleted = true;
+
+	// After mCompleted is set, so whoever wakes up will see it.
+	if( mCompletedEvent )
+		mCompletedEvent->Signal();
+
+	// Notify with the lock held, once it's released the task can be deleted.
+	std::lock_guard<std::mutex> lock(mFinishedLock);
+	mFinished = true;
+	mFinishedCondition.notify_all();
+}
+
+//////////////////////////////////////////////////////////////////////////
+BuildTaskStack::BuildTaskStack(BuildEvent& rEvent):mNextOrder(0),mNumProducing(0),mCancelled(false),mEvent(rEvent)
+{
+}
+
+BuildTaskStack::~BuildTaskStack()
+{
+	Cancel();
+	JoinProducers();
+}
+
+void BuildTaskStack::push(BuildTask* pTask)
+{
+	assert(pTask);
+	std::unique_lock<std::mutex> lock(mLock);
+	if( mCancelled )
+	{
+		lock.unlock();
+		delete pTask;
+		return;
+	}
+	mTasks.push({pTask->GetPriority(),mNextOrder++,pTask});
+	lock.unlock();
+	mEvent.Signal();
+}
+
+BuildTask* BuildTaskStack::pop()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	if( mTasks.empty() )
+		return nullptr;
+
+	BuildTask* task = mTasks.top().mTask;
+	mTasks.pop();
+	return task;
+}
+
+bool BuildTaskStack::empty()const
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	return mTasks.empty();
+}
+
+size_t BuildTaskStack::size()const
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	return mTasks.size();
+}
+
+void BuildTaskStack::AddProducer(std::function<void()> pProducer)
+{
+	mNumProducing++;// Done here and not in the worker so GetIsProducing is true the moment this returns.
+	WorkerPool::Get().Submit([this,pProducer]()
+	{
+		pProducer();
+		{// Same as the tasks, once the count is changed and the lock released the stack may be gone.
+			std::lock_guard<std::mutex> lock(mLock);
+			mNumProducing--;
+			mEvent.Signal();// Waiting for more tasks may now be pointless, so let the build thread know.
+			mProducersDone.notify_all();
+		}
+	});
 }
 
-void BuildTask::CallMain(BuildTask* pTask)
+void BuildTaskStack::JoinProducers()
 {
-	assert( pTask );
-	if( pTask )
+	std::unique_lock<std::mutex> lock(mLock);
+	mProducersDone.wait(lock,[this](){return mNumProducing == 0;});
+}
+
+void BuildTaskStack::Cancel()
+{
+	{// Set with the lock held so that once this returns nothing else can be pushed.
+		std::lock_guard<std::mutex> lock(mLock);
+		mCancelled = true;
+	}
+
+	for( BuildTask* task = pop() ; task != nullptr ; task = pop() )
 	{
-		pTask->mOk = pTask->Main();
-		pTask->mCompleted = true;
+		delete task;
 	}
 }
 
@@ -21,7 +21,12 @@
 #include <atomic>
 #include <thread>
 #include <list>
-#include <stack>
+#include <queue>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 
 //////////////////////////////////////////////////////////////////////////
@@ -30,6 +35,23 @@
 namespace appbuild{
 class BuildTaskStack;
 class Configuration;
+
+/**
+ * @brief Lets the thread running the build sleep until something happens, a task finishing or a new one arriving, instead of spinning on yield.
+ * Once signalled it stays signalled till a Wait returns, so a signal that comes just before the Wait is not lost.
+ */
+class BuildEvent
+{
+public:
+	void Signal();
+	void Wait();
+
+private:
+	std::mutex mLock;
+	std::condition_variable mCondition;
+	bool mSignalled = false;
+};
+
 class BuildTask
 {
 public:
@@ -38,30 +60,154 @@ public:
 
 	virtual const std::string& GetOutputFilename()const = 0;
 
-	void Execute();
+	/**
+	 * @brief Starts the task on one of the threads of the WorkerPool.
+	 * @param pCompletedEvent If not null this is signalled when the task has finished.
+	 */
+	void Execute(BuildEvent* pCompletedEvent = nullptr);
+
+	/**
+	 * @brief Blocks till the task has finished, for when there is nothing else to do till it has.
+	 * Does nothing if the task was never started.
+	 */
+	void WaitForCompletion();
+
+	/**
+	 * @brief Asks a running task to stop now and not finish its work. It still completes, not ok, and must be waited for as normal.
+	 * Any output it had part written is deleted. Does nothing if the task is not running.
+	 */
+	void Kill();
+	bool GetWasKilled()const{return mKilled;}
+
 	const std::string& GetResults()const{return mResults;}
 	const std::string& GetTaskName()const{return mTaskName;}
 	bool GetIsCompleted()const{return mCompleted;}
 	bool GetOk(){return mOk;}
 
+	/**
+	 * @brief Tasks with a higher priority are taken from the BuildTaskStack first. Must be set before it is pushed.
+	 */
+	void SetPriority(int64_t pPriority){mPriority = pPriority;}
+	int64_t GetPriority()const{return mPriority;}
+
+	/**
+	 * @brief How long it took from Execute to Completed, only valid once GetIsCompleted is true.
+	 */
+	int64_t GetMilliseconds()const{return std::chrono::duration_cast<std::chrono::milliseconds>(mCompletedTime - mExecuteTime).count();}
+
 protected:
-	virtual bool Main() = 0;
+	/**
+	 * @brief Starts the work, the default runs Main on the WorkerPool.
+	 * A task that runs a child process can instead start it here and call Completed when it's done, so it doesn't need a thread while it waits.
+	 */
+	virtual void Start();
+
+	/**
+	 * @brief Does the work, called on a thread of the WorkerPool. Not needed by tasks that override Start.
+	 */
+	virtual bool Main(){return false;}
+
+	/**
+	 * @brief Called by Kill, stops the work if it can. The default does nothing and the task runs to the end.
+	 */
+	virtual void Stop(){}
+
+	/**
+	 * @brief Must be called once, from any thread, when the task has finished. The task may be deleted by the time it returns.
+	 */
+	void Completed(bool pOk);
 
 	const int mLoggingMode;
 	std::string mResults;
 
 private:
-	static void CallMain(BuildTask* pTask);
 
 	const std::string mTaskName;// The name of the task. At a later data I may make new task types instead of all being a compile task. Some work on the design needed.
 	bool mOk;
+	int64_t mPriority;
+	std::chrono::steady_clock::time_point mExecuteTime;
+	std::chrono::steady_clock::time_point mCompletedTime;
 
+	BuildEvent* mCompletedEvent;
 	std::atomic<bool> mCompleted;
-	std::thread thread;
+	std::atomic<bool> mKilled;
+
+	// Once the worker has set mFinished it no longer touches the task, so it is then safe to delete it.
+	std::mutex mFinishedLock;
+	std::condition_variable mFinishedCondition;
+	bool mStarted;
+	bool mFinished;
+};
+
+/**
+ * @brief The tasks that are waiting to be run, pop gives the one with the highest priority. If they are the same the last pushed.
+ * Tasks can be pushed by other threads while the build is running. The dependency checks do this so that
+ * the first compile can start as soon as the first out of date file is found and not when all the checks are done.
+ * The threads doing the pushing are started with AddProducer and are owned by the stack so we know when no more tasks will arrive.
+ */
+class BuildTaskStack
+{
+public:
+	/**
+	 * @param rEvent Signalled when a task is pushed or a producer finishes. The stacks of all the projects being built share one,
+	 * so the thread running the build only has to wait on that. Must outlive the stack.
+	 */
+	BuildTaskStack(BuildEvent& rEvent);
+	~BuildTaskStack();
+
+	void push(BuildTask* pTask);
+	BuildTask* pop();// Returns nullptr if there is nothing waiting right now, there may be later if GetIsProducing is true.
+	bool empty()const;
+	size_t size()const;
+
+	/**
+	 * @brief Runs something on the WorkerPool that will push tasks onto this stack.
+	 */
+	void AddProducer(std::function<void()> pProducer);
+
+	/**
+	 * @brief Waits for all the producer threads to finish.
+	 */
+	void JoinProducers();
+
+	/**
+	 * @brief Deletes the tasks that are waiting and any that are pushed after this call.
+	 * Producers should check GetIsCancelled and stop early.
+	 */
+	void Cancel();
+
+	bool GetIsProducing()const{return mNumProducing > 0;}
+	bool GetIsCancelled()const{return mCancelled;}
+
+	/**
+	 * @brief True when there is nothing waiting and nothing more will be pushed.
+	 */
+	bool GetIsFinished()const{return !GetIsProducing() && empty();}// Order matters, producers push before they finish.
+
+	/**
+	 * @brief The event passed to the constructor. Pass it to BuildTask::Execute so that tasks finishing signal it too.
+	 */
+	BuildEvent& GetEvent(){return mEvent;}
+
+private:
+	mutable std::mutex mLock;
+	struct QueuedTask
+	{
+		int64_t mPriority;
+		uint64_t mOrder;
+		BuildTask* mTask;
+		bool operator < (const QueuedTask& pOther)const{return mPriority < pOther.mPriority || (mPriority == pOther.mPriority && mOrder < pOther.mOrder);}
+	};
+
+	std::condition_variable mProducersDone;
+	std::priority_queue<QueuedTask> mTasks;
+	uint64_t mNextOrder;
+	std::atomic<int> mNumProducing;
+	std::atomic<bool> mCancelled;
+	BuildEvent& mEvent;
 };
 
 // As a class and not a type def so that in some headers that only need a reference to these I can do a forward reference instead of including this header.
-class BuildTaskStack : public std::stack<BuildTask*>{};
 class RunningBuildTasks : public std::list<BuildTask*>{};
 
 //////////////////////////////////////////////////////////////////////////
@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <time.h>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -25,21 +26,25 @@
 #include "misc.h"
 #include "logging.h"
 #include "shell.h"
+#include "dependencies.h"
+#include "worker_pool.h"
+#include "object_cache.h"
 
 namespace appbuild{
 //////////////////////////////////////////////////////////////////////////
 
-BuildTaskCompile::BuildTaskCompile(const std::string& pTaskName, const std::string& pOutputFilename, const std::string& pCommand, const StringVec& pArgs,int pLoggingMode):
+BuildTaskCompile::BuildTaskCompile(const std::string& pTaskName, const std::string& pOutputFilename, const std::string& pCommand, const StringVec& pArgs,int pLoggingMode,const std::string& pDepfile,Dependencies* pDependencies):
 	BuildTask(pTaskName,pLoggingMode),
-	mCommand(pCommand), mArgs(pArgs), mOutputFilename(pOutputFilename)
+	mCommand(pCommand), mArgs(pArgs), mOutputFilename(pOutputFilename), mDepfile(pDepfile), mDependencies(pDependencies), mChildID(0), mFromCache(false)
 {
+	assert( mDepfile.size() == 0 || mDependencies != nullptr );
 }
 
 BuildTaskCompile::~BuildTaskCompile()
 {
 }
 
-bool BuildTaskCompile::Main()
+void BuildTaskCompile::Start()
 {
 	if(mLoggingMode >= appbuild::LOG_VERBOSE)
 	{
@@ -50,7 +55,98 @@ bool BuildTaskCompile::Main()
 		std::cout << std::endl;// We do want flush here...
 	}
 
-	return ExecuteShellCommand(mCommand, mArgs, mResults);
+	// Coarse as that is the clock the file system uses for modification times, so any file written after this will not be older than it.
+	clock_gettime(CLOCK_REALTIME_COARSE,&mStartTime);
+
+	// Only with a depfile, that is what tells us the files that went into the object.
+	if( mDepfile.size() > 0 && ObjectCache::Get().GetIsEnabled() )
+	{
+		WorkerPool::Get().Submit([this]()
+		{
+			if( GetWasKilled() )
+			{
+				Completed(Finish(false));
+			}
+			else if( ObjectCache::Get().Fetch(mCommand,mArgs,mOutputFilename,mDepfile,mResults) )
+			{
+				if( mLoggingMode >= appbuild::LOG_VERBOSE )
+				{
+					std::cout << "Object cache hit for " << GetTaskName() << '\n';
+				}
+				mFromCache = true;
+				Completed(Finish(true));
+			}
+			else
+			{// A kill that comes after this does not stop the compile, it is left to finish and its object deleted.
+				StartCompiler();
+			}
+		});
+	}
+	else
+	{
+		StartCompiler();
+	}
+}
+
+void BuildTaskCompile::StartCompiler()
+{
+	// The compiler is run by the reactor so no thread is tied up waiting for it, there can be many more compiles running than threads.
+	const bool started = ChildProcessReactor::Get().Start(mCommand,mArgs,std::map<std::string,std::string>(),[this](bool pWorked,std::string& rOutput)
+	{
+		// If it was killed what it wrote is just noise, the error that caused it is from another file.
+		if( !GetWasKilled() )
+			mResults.swap(rOutput);
+
+		if( mDepfile.size() > 0 || GetWasKilled() )
+		{// Reading the depfile, or deleting what was part written, is file IO, so it's not done on the reactor thread.
+			WorkerPool::Get().Submit([this,pWorked](){Completed(Finish(pWorked));});
+		}
+		else
+		{
+			Completed(pWorked);
+		}
+	},&mChildID);
+
+	if( !started )
+	{
+		mResults = "Failed to run " + mCommand + "\n";
+		Completed(Finish(false));
+	}
+}
+
+void BuildTaskCompile::Stop()
+{
+	ChildProcessReactor::Get().Kill(mChildID);
+}
+
+bool BuildTaskCompile::Finish(bool pCompiled)
+{
+	if( GetWasKilled() )
+	{// It may have finished before the kill got to it but we can't know it wrote all of the object file, so it goes.
+		std::remove(mOutputFilename.c_str());
+		pCompiled = false;
+	}
+
+	if( mDepfile.size() > 0 )
+	{
+		// The depfile is only needed until ReadDepfile has kept what it says, it's removed below whether the compile worked or not.
+		if( pCompiled && !mFromCache && ObjectCache::Get().GetIsEnabled() )
+		{
+			StringVec inputFiles;
+			if( Dependencies::ParseDepfile(mDepfile,inputFiles) )
+			{
+				ObjectCache::Get().Store(mCommand,mArgs,mOutputFilename,inputFiles,mResults,mStartTime);
+			}
+		}
+
+		// The compiler may have written some of it before failing, so only read it if the compile worked.
+		if( pCompiled && mDependencies->ReadDepfile(mDepfile,mOutputFilename,mStartTime) == false && mLoggingMode >= appbuild::LOG_VERBOSE )
+		{
+			std::cout << "Could not read the depfile " + mDepfile + ", the includes of " + GetTaskName() + " will be scanned next build\n";
+		}
+		std::remove(mDepfile.c_str());
+	}
+	return pCompiled;
 }
 
 
@@ -22,6 +22,8 @@
 #include <thread>
 #include <list>
 #include <stack>
+#include <time.h>
+#include <stdint.h>
 
 #include "string_types.h"
 #include "build_task.h"
@@ -31,20 +33,48 @@
 //////////////////////////////////////////////////////////////////////////
 namespace appbuild{
 
+class Dependencies;
 class BuildTaskCompile : public BuildTask
 {
 public:
-	BuildTaskCompile(const std::string& pTaskName,const std::string& pOutputFilename, const std::string& pCommand, const StringVec& pArgs,int pLoggingMode);
+	/**
+	 * @param pDepfile If not empty the depfile the compiler has been asked to write, it is read into pDependencies when the compile works.
+	 * @param pDependencies Where the depfile is recorded, can be null if there is no depfile.
+	 */
+	BuildTaskCompile(const std::string& pTaskName,const std::string& pOutputFilename, const std::string& pCommand, const StringVec& pArgs,int pLoggingMode,const std::string& pDepfile = "",Dependencies* pDependencies = nullptr);
 	virtual ~BuildTaskCompile();
 
 	virtual const std::string& GetOutputFilename()const{return mOutputFilename;}
 
 private:
-	virtual bool Main();
+	/**
+	 * @brief If the object cache is on the object is looked for in that first, on the WorkerPool as it's file IO. If it's not there the compiler is run.
+	 */
+	virtual void Start();
+
+	/**
+	 * @brief Runs the compiler on the ChildProcessReactor.
+	 */
+	void StartCompiler();
+
+	/**
+	 * @brief Kills the compiler and everything it started.
+	 */
+	virtual void Stop();
+
+	/**
+	 * @brief Called once the compiler has finished, records the depfile and adds the object to the object cache.
+	 */
+	bool Finish(bool pCompiled);
 
 	const std::string mCommand; // What needs to be done.
 	const StringVec mArgs;
 	const std::string mOutputFilename;
+	const std::string mDepfile;
+	Dependencies* mDependencies;
+	timespec mStartTime;
+	std::atomic<uint64_t> mChildID;	//!< The compiler in the ChildProcessReactor. Atomic as when the object cache is on it's started from a worker thread.
+	bool mFromCache;	//!< The object came from the ObjectCache, the compiler was not run.
 };
 
 //////////////////////////////////////////////////////////////////////////
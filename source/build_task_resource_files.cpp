@@ -29,6 +29,7 @@
 #include "mem_buffer.h"
 #include "source_files.h"
 #include "logging.h"
+#include "directory_index.h"
 
 namespace appbuild{
 //////////////////////////////////////////////////////////////////////////
@@ -338,6 +339,9 @@ bool BuildTaskResourceFiles::Main()
 			// Cleanup ram.
 			delete []CompressData;
 			delete []beforeCodeBlock;
+
+			// So the include search sees it, the folder may have been read before it was written.
+			DirectoryIndex::Get().AddFile(ResourceOutputFilename);
 		}
 		else
 		{
@@ -384,6 +388,7 @@ void BuildTaskResourceFiles::WriteSupportingCodeFile(const ResourceFilesTOC& pFi
 				lz4.write(dest,SizeToWrite);
 				delete []dest;
 			}
+			DirectoryIndex::Get().AddFile(fname);
 		}			
 	}
 }
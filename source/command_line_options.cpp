@@ -20,6 +20,7 @@
 #include <string>
 #include <vector>
 #include <cstring>
+#include <cstdlib>
 
 #include "command_line_options.h"
 #include "project.h"
@@ -41,7 +42,14 @@ namespace appbuild{
 		DEF_ARG(ARG_ACTIVE_CONFIG,required_argument,			'c',"active-config","Builds the given configuration, if found.")													\
 		DEF_ARG(ARG_UPDATE_PROJECT,required_argument,			'u',"update-project","Reads in the project file passed in then writes out an updated version with all the default paramiters\nfilled in that were not in the source.\nProject is not built if this option is specified.")	\
 		DEF_ARG(ARG_TRUNCATE_OUTPUT,required_argument,			't',"truncate-output","Truncates the output to the first N lines, if you're getting too many errors this can help.")	\
-		DEF_ARG(ARG_TIME_BUILD,no_argument,						'T',"time-build","Shows the total time of the build from start to finish.")												\
+		DEF_ARG(ARG_TIME_BUILD,no_argument,						'T',"time-build","Shows the total time of the build from start to finish and how much cpu time the main thread used.")												\
+		DEF_ARG(ARG_CONTENT_HASH,no_argument,					'H',"content-hash","A file that is newer than the object built from it only causes a rebuild if its contents have changed.\nStops a git checkout or touch that leaves the bytes the same rebuilding everything. Needs \"compiler_depfiles\": true in the configuration.")	\
+		DEF_ARG(ARG_FAIL_FAST,no_argument,						'F',"fail-fast","When a file fails to compile the other compiles that are running are killed straight away and their part written object files deleted.\nWithout this they are left to finish, so all of their errors are seen.")	\
+		DEF_ARG(ARG_OBJECT_CACHE,optional_argument,				'C',"object-cache","Keeps the object files built in a cache shared by all projects and builds, an object built before from the same source, headers and arguments\nis copied from the cache instead of being compiled. Arg is the cache folder, -C/path or --object-cache=/path, the default is $XDG_CACHE_HOME/appbuild or ~/.cache/appbuild.\nNeeds compiler_depfiles, and \"build_stamp\": \"header\" as the build time defines are different for every build.")	\
+		DEF_ARG(ARG_OBJECT_CACHE_SIZE,required_argument,		'M',"object-cache-size","The size in MB the object cache is kept under, the objects used longest ago are deleted first. The default is 5120. Turns the object cache on.")	\
+		DEF_ARG(ARG_REMOTE_CACHE,required_argument,				'R',"remote-cache","A cache shared with other machines behind the object cache, which this turns on. Arg is http://host[:port][/path] or a folder, a network share say.\nObjects and library archives not in the object cache are looked for there and what is built is sent there while the build carries on.")	\
+		DEF_ARG(ARG_CACHE_BASE_DIR,required_argument,			'B',"cache-base-dir","Paths under this folder are made relative to it for the object and remote cache, so checkouts in different folders,\nor build machines that each use their own workspace folder, share objects. Without it only builds from the same absolute path do.\nThe debug info still has the path the object was built in, add -fdebug-prefix-map to the compiler args for that.")	\
+		DEF_ARG(ARG_CACHE_SERVER,required_argument,				'L',"cache-server","Runs a simple remote cache server, arg is the port to listen on. The blobs are kept in the remote folder of the object cache folder, see --object-cache.\nFor trying the remote cache out or a trusted network, there are no passwords. Runs till it is killed, nothing is built.")	\
 		DEF_ARG(ARG_SHEBANG,no_argument,						'#',"she-bang","Makes the c/c++ file with appbuild defined as a shebang run as if it was an executable. JIT Compiled.") \
 		DEF_ARG(ARG_NEW_PROJECT,required_argument,				'P',"new-project","Where arg is the new project name, makes a folder in the current working directory of the passed name with a simple hello world cpp file\nand a default project file with release and debug configurations.\nIf the folder already exists searches folder for source files and adds them to a new project file.\nIf a project file already exists then it will fail.") \
 		DEF_ARG(ARG_INTERACTIVE,no_argument,					'i',"interactive","If the project has multiple configurations then a menu will allow you to select which to build.\nThe default configuration, if marked, will be selected by default.")	\
@@ -62,14 +70,19 @@ CommandLineOptions::CommandLineOptions(int argc, char *argv[]):
 	mRunAfterBuild(false),
 	mReBuild(false),
 	mTimeBuild(false),
+	mContentHash(false),
+	mFailFast(false),
+	mObjectCache(false),
 	mInteractiveMode(false),
 	mDisplayProjectSchema(false),
     mLoggingMode(appbuild::LOG_INFO),
 	mNumThreads(std::thread::hardware_concurrency()),
-	mTruncateOutput(0)
+	mTruncateOutput(0),
+	mObjectCacheSize(5120),
+	mCacheServerPort(0)
 {
 	std::string short_options;
-#define DEF_ARG(ARG_NAME,TAKES_ARGUMENT,ARG_SHORT_NAME,ARG_LONG_NAME,ARG_DESC)	short_options += ARG_SHORT_NAME;if( TAKES_ARGUMENT == required_argument ){short_options+=":";}
+#define DEF_ARG(ARG_NAME,TAKES_ARGUMENT,ARG_SHORT_NAME,ARG_LONG_NAME,ARG_DESC)	short_options += ARG_SHORT_NAME;if( TAKES_ARGUMENT == required_argument ){short_options+=":";}else if( TAKES_ARGUMENT == optional_argument ){short_options+="::";}
 	ARGUMENTS
 #undef DEF_ARG
 
@@ -125,6 +138,72 @@ CommandLineOptions::CommandLineOptions(int argc, char *argv[]):
 			mTimeBuild = true;
 			break;
 
+		case ARG_CONTENT_HASH:
+			mContentHash = true;
+			break;
+
+		case ARG_FAIL_FAST:
+			mFailFast = true;
+			break;
+
+		case ARG_OBJECT_CACHE:
+			mObjectCache = true;
+			if( optarg )
+			{
+				mObjectCacheFolder = optarg;
+			}
+			break;
+
+		case ARG_REMOTE_CACHE:
+			if( optarg && strlen(optarg) > 0 )
+			{
+				mObjectCache = true;
+				mRemoteCache = optarg;
+			}
+			else
+			{
+				mShowHelp = true;
+				std::cout << "Option -R (remote-cache) was not passed correct value. -R http://buildcache:8080/ or --remote-cache=/mnt/buildcache\n";
+			}
+			break;
+
+		case ARG_CACHE_BASE_DIR:
+			if( optarg && strlen(optarg) > 0 )
+			{
+				mCacheBaseDir = optarg;
+			}
+			else
+			{
+				mShowHelp = true;
+				std::cout << "Option -B (cache-base-dir) was not passed correct value. -B ~/work or --cache-base-dir=/ci/workspace\n";
+			}
+			break;
+
+		case ARG_CACHE_SERVER:
+			if( optarg && std::atoi(optarg) > 0 && std::atoi(optarg) < 65536 )
+			{
+				mCacheServerPort = std::atoi(optarg);
+			}
+			else
+			{
+				mShowHelp = true;
+				std::cout << "Option -L (cache-server) was not passed correct value. -L 8080 or --cache-server=8080\n";
+			}
+			break;
+
+		case ARG_OBJECT_CACHE_SIZE:
+			if( optarg && std::atoi(optarg) > 0 )
+			{
+				mObjectCache = true;
+				mObjectCacheSize = std::atoi(optarg);
+			}
+			else
+			{
+				mShowHelp = true;
+				std::cout << "Option -M (object-cache-size) was not passed correct value. -M 1024 or --object-cache-size=1024\n";
+			}
+			break;
+
 		case ARG_INTERACTIVE:
 			mInteractiveMode = true;
 			break;
@@ -229,6 +308,18 @@ CommandLineOptions::CommandLineOptions(int argc, char *argv[]):
 	}
 }
 
+std::string CommandLineOptions::GetObjectCacheFolder()const
+{
+	if( mObjectCacheFolder.size() > 0 )
+		return mObjectCacheFolder.back() == '/' ? mObjectCacheFolder : mObjectCacheFolder + "/";
+
+	const char* cacheHome = getenv("XDG_CACHE_HOME");
+	if( cacheHome && strlen(cacheHome) > 0 )
+		return std::string(cacheHome) + "/appbuild/";
+
+	const char* home = getenv("HOME");
+	return std::string(home ? home : "/tmp") + "/.cache/appbuild/";
+}
 
 void CommandLineOptions::PrintHelp()const
 {
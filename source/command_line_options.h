@@ -17,6 +17,7 @@
 #ifndef __COMMAND_LINE_OPTIONS_H__
 #define __COMMAND_LINE_OPTIONS_H__
 
+#include <stdint.h>
 #include <vector>
 #include <string>
 
@@ -35,6 +36,10 @@ public:
 	bool GetRunAfterBuild()const{return mRunAfterBuild;}
 	bool GetReBuild()const{return mReBuild;}
 	bool GetTimeBuild()const{return mTimeBuild;}
+	bool GetContentHash()const{return mContentHash;}
+	bool GetFailFast()const{return mFailFast;}
+	bool GetObjectCache()const{return mObjectCache;}
+	bool GetRunCacheServer()const{return mCacheServerPort > 0;}
 	bool GetUpdatedProject()const{return GetUpdatedOutputFileName().size() > 0;}
 	bool GetCreateNewProject()const{return mNewProjectName.size() > 0;}
 	bool GetInteractiveMode()const{return mInteractiveMode;}
@@ -44,6 +49,27 @@ public:
 	int GetLoggingMode()const{return mLoggingMode;}
 	int GetNumThreads()const{return mNumThreads;}
 	int GetTruncateOutput()const{return mTruncateOutput;}
+
+	/**
+	 * @brief The size in bytes the object cache is kept under.
+	 */
+	uint64_t GetObjectCacheSize()const{return (uint64_t)mObjectCacheSize * 1024 * 1024;}
+
+	/**
+	 * @brief Where the object cache is kept, the one given or $XDG_CACHE_HOME/appbuild or ~/.cache/appbuild if not.
+	 */
+	std::string GetObjectCacheFolder()const;
+
+	/**
+	 * @brief The location of the remote cache, empty if there is not one. See CacheBackend::Create.
+	 */
+	const std::string& GetRemoteCache()const{return mRemoteCache;}
+
+	/**
+	 * @brief The folder paths are made relative to in the object cache, empty if not set. See ObjectCache::SetBaseFolder.
+	 */
+	const std::string& GetCacheBaseDir()const{return mCacheBaseDir;}
+	int GetCacheServerPort()const{return mCacheServerPort;}
 	std::vector<std::string> GetProjectFiles()const{return mProjectFiles;}
 
 	/**
@@ -84,15 +110,23 @@ private:
 	bool mRunAfterBuild;
 	bool mReBuild;
 	bool mTimeBuild;
+	bool mContentHash;
+	bool mFailFast;
+	bool mObjectCache;
 	bool mInteractiveMode;
 	bool mDisplayProjectSchema;
 	int mLoggingMode;
     int mNumThreads;
 	int mTruncateOutput;
+	int mObjectCacheSize;	//!< In MB.
+	int mCacheServerPort;
 	std::vector<std::string> mProjectFiles;
 	std::string mActiveConfig;
 	std::string mUpdatedOutputFileName;
 	std::string mNewProjectName;
+	std::string mObjectCacheFolder;
+	std::string mRemoteCache;
+	std::string mCacheBaseDir;
 	std::string mSchemaSaveFilename;	//!< The name of the file with write the project schema too, can be null, if so schema is written to standard out.
 };
 
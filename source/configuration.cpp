@@ -17,16 +17,24 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <algorithm>
 
 #include "json.h"
 #include "configuration.h"
 #include "build_task_compile.h"
 #include "dependencies.h"
+#include "build_log.h"
 #include "source_files.h"
 #include "logging.h"
 #include "shell.h"
 #include "project.h"
+#include "directory_index.h"
+#include "object_cache.h"
 
 namespace appbuild{
 //////////////////////////////////////////////////////////////////////////
@@ -40,6 +48,8 @@ Configuration::Configuration(const std::string& pConfigName,const Project* pPare
 		mWarningsAsErrors(false),
 		mEnableAllWarnings(false),
 		mFatalErrors(false),
+		mCompilerDepfiles(false),
+		mBuildStampHeader(false),
 		mIncludeSearchPaths(pParentProject->GetProjectDir()),
 		mLibrarySearchPaths(pParentProject->GetProjectDir()),
 		mLibraryFiles(pParentProject->GetProjectDir()),
@@ -237,6 +247,16 @@ Configuration::Configuration(const std::string& pConfigName,const Project* pPare
 	mWarningsAsErrors = pConfig.GetBoolean("warnings_as_errors",mWarningsAsErrors,mLoggingMode >= LOG_VERBOSE);
 	mEnableAllWarnings = pConfig.GetBoolean("enable_all_warnings",mEnableAllWarnings,mLoggingMode >= LOG_VERBOSE);
 	mFatalErrors = pConfig.GetBoolean("fatal_errors",mFatalErrors,mLoggingMode >= LOG_VERBOSE);
+	mCompilerDepfiles = pConfig.GetBoolean("compiler_depfiles",mCompilerDepfiles,mLoggingMode >= LOG_VERBOSE);
+
+	const std::string BuildStamp = pConfig.GetString("build_stamp","defines",mLoggingMode >= LOG_VERBOSE);
+	if( CompareNoCase("header",BuildStamp.c_str()) )
+		mBuildStampHeader = true;
+	else if( !CompareNoCase("defines",BuildStamp.c_str()) )
+	{
+		std::cerr << "The \'build_stamp\' object \"" << BuildStamp << "\" in the configuration:" << mConfigName << " is not a valid type, it's defines or header.\n";
+		return; // We're done, no need to continue.
+	}
 
 	// See if there are any projects we are not dependent on.
 	if( pConfig.HasValue("dependencies") && AddDependantProjects(pConfig["dependencies"]) == false )
@@ -285,6 +305,8 @@ tinyjson::JsonValue Configuration::Write()const
 	jsonConfig["warnings_as_errors"] = mWarningsAsErrors;
 	jsonConfig["enable_all_warnings"] = mEnableAllWarnings;
 	jsonConfig["fatal_errors"] = mFatalErrors;
+	jsonConfig["compiler_depfiles"] = mCompilerDepfiles;
+	jsonConfig["build_stamp"] = std::string(mBuildStampHeader ? "header" : "defines");
 	
 	
 
@@ -340,22 +362,175 @@ const StringVec Configuration::GetLibraryFiles()const
 	}
 	return allLibraryFiles;
 }
-bool Configuration::GetBuildTasks(const SourceFiles& pProjectSourceFiles,const SourceFiles& pGeneratedResourceFiles,bool pRebuildAll,const ArgList& pAdditionalArgs,StringVec& pProjectIncludes,BuildTaskStack& rBuildTasks,Dependencies& rDependencies,StringVec& rOutputFiles)const
+bool Configuration::GetBuildTasks(const SourceFiles& pProjectSourceFiles,const SourceFiles& pGeneratedResourceFiles,bool pRebuildAll,size_t pNumThreads,const ArgList& pAdditionalArgs,const std::string& pAppVersion,StringVec& pProjectIncludes,const StringVec& pSystemIncludes,BuildTaskStack& rBuildTasks,Dependencies& rDependencies,BuildLog& rBuildLog,StringVec& rOutputFiles)const
 {
+	// Everything the producer threads need. This is held by a shared pointer as they are still running after we return.
+	struct CompileSettings
+	{
+		CompileSettings(const ArgList& pArgs):mArgs(pArgs),mNextJob(0){}
+
+		CompileJobVec mJobs;
+		StringVec mIncludeSearchPaths;
+		ArgList mArgs;
+		std::atomic<size_t> mNextJob;
+	};
+	auto Settings = std::make_shared<CompileSettings>(pAdditionalArgs);
+
 	StringSet InputFilesSeen;	// Used to make sure a source file is not included twice. At the moment I show an error.
 
 	// add the generated resource files.
-	if( !AddCompileTasks(pGeneratedResourceFiles,pRebuildAll,pAdditionalArgs,pProjectIncludes,rBuildTasks,rDependencies,rOutputFiles,InputFilesSeen) )
+	if( !AddCompileJobs(pGeneratedResourceFiles,Settings->mJobs,rOutputFiles,InputFilesSeen) )
 		return false;
 
 	// Add the project files.
-	if( !AddCompileTasks(pProjectSourceFiles,pRebuildAll,pAdditionalArgs,pProjectIncludes,rBuildTasks,rDependencies,rOutputFiles,InputFilesSeen) )
+	if( !AddCompileJobs(pProjectSourceFiles,Settings->mJobs,rOutputFiles,InputFilesSeen) )
 		return false;
 
 	// Add the configuration files.
-	if( !AddCompileTasks(mSourceFiles,pRebuildAll,pAdditionalArgs,pProjectIncludes,rBuildTasks,rDependencies,rOutputFiles,InputFilesSeen) )
+	if( !AddCompileJobs(mSourceFiles,Settings->mJobs,rOutputFiles,InputFilesSeen) )
 		return false;
 
+	// A little earlyout for small projects.
+	if( Settings->mJobs.size() == 0 )
+		return true;
+
+	// The object cache is told what an object was built from by its depfile, and the build time defines are different every second so no key would be seen twice.
+	if( ObjectCache::Get().GetIsEnabled() && mLoggingMode >= LOG_INFO )
+	{
+		if( !mCompilerDepfiles )
+			std::cout << "Warning: the object cache is not used by the configuration " << mConfigName << ", it needs \"compiler_depfiles\": true\n";
+		else if( !mBuildStampHeader )
+			std::cout << "Warning: the object cache will not get hits for the configuration " << mConfigName << " as the build time is in every compile, use \"build_stamp\": \"header\"\n";
+	}
+
+	// We need to taek the include paths that the user added and append some of ours based on some other options the user has requested.
+	StringVec& includeSearchPaths = Settings->mIncludeSearchPaths;
+	includeSearchPaths = mIncludeSearchPaths;
+
+	// The ones from pkg-config are always system paths, they are only changed by updating the package.
+	StringVec systemIncludePaths = pSystemIncludes;
+	if( mGTKVersion.size() > 0 )
+	{
+		StringVec pkgConfigPaths;
+		AddIncludesFromPKGConfig(pkgConfigPaths,mGTKVersion);
+		includeSearchPaths.insert(includeSearchPaths.end(),pkgConfigPaths.begin(),pkgConfigPaths.end());
+		systemIncludePaths.insert(systemIncludePaths.end(),pkgConfigPaths.begin(),pkgConfigPaths.end());
+	}
+	rDependencies.SetSystemIncludes(systemIncludePaths,GetSystemStamp(systemIncludePaths));
+	rDependencies.SetDefines(mDefines);
+
+	// Add search files from gobal project file settings.
+	includeSearchPaths.insert(includeSearchPaths.end(), pProjectIncludes.begin(), pProjectIncludes.end());	
+
+	if( includeSearchPaths.size() == 0 )
+    {
+   		std::cerr << "Internal error: The \'include\' object in the \'settings\' " << mConfigName << " is missing! What happened to our defaults?\n";
+        return false; // We're done, no need to continue.
+    }	
+
+	// The args that are the same for every file, worked out once here and not for every file. They start as pAdditionalArgs.
+	ArgList& args = Settings->mArgs;
+
+	// This string has to have a value, else param will be -O that sets the default level.
+	// -O2 not -o2, a lower case o names the output file.
+	if( mOptimisation.size() > 0 )
+	{
+		args.AddArg("-O" + mOptimisation);
+	}
+
+	if( mDebugLevel.size() > 0 )
+	{// Again, only build if string is not empty.
+		args.AddArg("-g" + mDebugLevel);
+	}
+
+	// Some defines I add.
+	if( !AddBuildStamp(pAppVersion,args,includeSearchPaths) )
+		return false;
+	args.AddArg("-DBUILT_BY_APPBUILD");
+
+	args.AddDefines(mDefines);
+
+	args.AddIncludeSearchPath(includeSearchPaths);
+
+	if( pRebuildAll )
+	{
+		for( const auto& job : Settings->mJobs )
+		{
+			std::string depfile;
+			const ArgList compileArgs = GetCompileArgs(job,args,depfile);
+			rBuildTasks.push(MakeCompileTask(job,compileArgs,depfile,GetCommandHash(compileArgs),rDependencies,rBuildLog));
+		}
+		return true;
+	}
+
+	// Now find out which ones need building. This is a lot of stat and read calls, so if we have more than one thread they all take a share.
+	// That way the file IO overlaps instead of being done one file at a time.
+	// Each file is pushed onto the build stack the moment we know it's out of date so the compiler can get going while we look at the rest.
+	const size_t NumCheckThreads = std::max((size_t)1,std::min(pNumThreads,Settings->mJobs.size()));
+	for( size_t n = 0 ; n < NumCheckThreads ; n++ )
+	{
+		rBuildTasks.AddProducer([this,Settings,&rBuildTasks,&rDependencies,&rBuildLog]()
+		{
+			for( size_t n = Settings->mNextJob++ ; n < Settings->mJobs.size() && !rBuildTasks.GetIsCancelled() ; n = Settings->mNextJob++ )
+			{
+				const CompileJob& job = Settings->mJobs[n];
+				std::string depfile;
+				const ArgList compileArgs = GetCompileArgs(job,Settings->mArgs,depfile);
+				const uint64_t commandHash = GetCommandHash(compileArgs);
+				if( rDependencies.RequiresRebuild(job.mInputFilename,job.mOutputFilename,Settings->mIncludeSearchPaths,commandHash) )
+				{
+					rBuildTasks.push(MakeCompileTask(job,compileArgs,depfile,commandHash,rDependencies,rBuildLog));
+				}
+			}
+		});
+	}
+
+	return true;
+}
+
+bool Configuration::AddBuildStamp(const std::string& pAppVersion,ArgList& rArgs,StringVec& rIncludeSearchPaths)const
+{
+	const std::string DateTime = GetBuildTimeString("%d-%m-%Y %X");
+	const std::string Date = GetBuildTimeString("%d-%m-%Y");
+	const std::string Time = GetBuildTimeString("%X");
+
+	if( !mBuildStampHeader )
+	{
+		rArgs.AddArg("-DAPP_VERSION=\"" + pAppVersion + "\"");
+		rArgs.AddArg("-DAPP_BUILD_DATE_TIME=\"" + DateTime + "\"");
+		rArgs.AddArg("-DAPP_BUILD_DATE=\"" + Date + "\"");
+		rArgs.AddArg("-DAPP_BUILD_TIME=\"" + Time + "\"");
+		return true;
+	}
+
+	std::ostringstream header;
+	header << "// Written by appbuild for the configuration " << mConfigName << ", any changes will be lost.\n";
+	header << "#ifndef APPBUILD_STAMP_H\n#define APPBUILD_STAMP_H\n";
+	header << "#define APP_VERSION \"" << pAppVersion << "\"\n";
+	header << "#define APP_BUILD_DATE_TIME \"" << DateTime << "\"\n";
+	header << "#define APP_BUILD_DATE \"" << Date << "\"\n";
+	header << "#define APP_BUILD_TIME \"" << Time << "\"\n";
+	header << "#endif\n";
+
+	// Only written if it's different, with SOURCE_DATE_EPOCH set that is only when the version changes, so the files that include it are not rebuilt for nothing.
+	const std::string HeaderFile = mOutputPath + "appbuild_stamp.h";
+	MakeDir(mOutputPath);
+	std::ifstream current(HeaderFile);
+	const std::string currentHeader((std::istreambuf_iterator<char>(current)),std::istreambuf_iterator<char>());
+	if( currentHeader != header.str() )
+	{
+		std::ofstream file(HeaderFile,std::ofstream::trunc);
+		file << header.str();
+		file.close();
+		if( !file )
+		{
+			std::cerr << "Failed to write the build stamp header " << HeaderFile << '\n';
+			return false;
+		}
+		DirectoryIndex::Get().AddFile(HeaderFile);
+	}
+
+	rIncludeSearchPaths.push_back(mOutputPath);
 	return true;
 }
 
@@ -386,7 +561,7 @@ bool Configuration::RunOutputFile(const std::string& pSharedObjectPaths)const
 	return false;
 }
 
-bool Configuration::AddCompileTasks(const SourceFiles& pSourceFiles,bool pRebuildAll,const ArgList& pAdditionalArgs,StringVec& pProjectIncludes,BuildTaskStack& rBuildTasks,Dependencies& rDependencies,StringVec& rOutputFiles,StringSet& rInputFilesSeen)const
+bool Configuration::AddCompileJobs(const SourceFiles& pSourceFiles,CompileJobVec& rCompileJobs,StringVec& rOutputFiles,StringSet& rInputFilesSeen)const
 {
 	// A little earlyout for small projects as this function can be called multiple times!
 	if( pSourceFiles.IsEmpty() )
@@ -398,28 +573,8 @@ bool Configuration::AddCompileTasks(const SourceFiles& pSourceFiles,bool pRebuil
 	// The output file name is generated at this point and so the dependency checking and linking will work. I could name the obj file anything if I wanted.
 	StringIntMap FileUseCount;
 
-	// Some defines I add.
-	const std::string DEF_APP_BUILD_DATE_TIME = "-DAPP_BUILD_DATE_TIME=\"" + GetTimeString() + "\"";
-	const std::string DEF_APP_BUILD_DATE = "-DAPP_BUILD_DATE=\"" + GetTimeString("%d-%m-%Y") + "\"";
-	const std::string DEF_APP_BUILD_TIME = "-DAPP_BUILD_TIME=\"" + GetTimeString("%X") + "\"";
-	const std::string DEF_BUILT_BY_APPBUILD = "-DBUILT_BY_APPBUILD";
-
-	// We need to taek the include paths that the user added and append some of ours based on some other options the user has requested.
-	StringVec includeSearchPaths = mIncludeSearchPaths;
-	if( mGTKVersion.size() > 0 )
-	{
-		AddIncludesFromPKGConfig(includeSearchPaths,mGTKVersion);
-	}
-
-	// Add search files from gobal project file settings.
-	includeSearchPaths.insert(includeSearchPaths.end(), pProjectIncludes.begin(), pProjectIncludes.end());	
-
-	if( includeSearchPaths.size() == 0 )
-    {
-   		std::cerr << "Internal error: The \'include\' object in the \'settings\' " << mConfigName << " is missing! What happened to our defaults?\n";
-        return false; // We're done, no need to continue.
-    }	
-
+	// Work out the input and output file names for every source file.
+	// This has to be done in order as that is how the output file names are made unique.
 	for( const auto& filename : pSourceFiles )
 	{
 		// Later on in the code we deal with duplicate file names with a nice little sneaky trick.
@@ -464,70 +619,94 @@ bool Configuration::AddCompileTasks(const SourceFiles& pSourceFiles,bool pRebuil
 			OutputFilename += ".obj";
 
 			rOutputFiles.push_back(OutputFilename);// Need to record all the output files even if not built as we need that for the linker.
+			rCompileJobs.push_back({GetFileName(filename),InputFilename,OutputFilename});
+		}
+		else
+		{
+			std::cerr << "Input filename not found " << InputFilename << '\n';
+		}
+	}
+	return true;
+}
 
-			if( pRebuildAll || rDependencies.RequiresRebuild(InputFilename,OutputFilename,includeSearchPaths) )
-			{
-				if(mLoggingMode >= LOG_VERBOSE)
-				{
-					std::cout << "Creating " << OutputFilename << " from file " << InputFilename << "\n";
-				}
-
+ArgList Configuration::GetCompileArgs(const CompileJob& pJob,const ArgList& pCommonArgs,std::string& rDepfile)const
+{
+	bool isCfile = GetExtension(pJob.mInputFilename) == "c";
 
-				bool isCfile = GetExtension(InputFilename) == "c";
+	ArgList args(pCommonArgs);
+	if( !isCfile )
+		args.AddArg("-std=" + mCppStandard);
 
-				// Going to build the file, so delete the obj that is there.
-				// If we do not do this then it can effect the dependency system.
-				std::remove(OutputFilename.c_str());
+	if( mWarningsAsErrors )
+		args.AddArg("-Werror");
 
-				ArgList args(pAdditionalArgs);
+	if( mEnableAllWarnings )
+		args.AddArg("-Wall");
 
-				// This string has to have a value, else param will be -o that sets output. Would case big issues is this string was empty
-				if( mOptimisation.size() > 0 )
-				{
-					args.AddArg("-o" + mOptimisation);
-				}
+	if( mFatalErrors )
+		args.AddArg("-Wfatal-errors");
 
-				if( mDebugLevel.size() > 0 )
-				{// Again, only build if string is not empty.
-					args.AddArg("-g" + mDebugLevel);
-				}
+	args.AddArg(mExtraCompilerArgs);
 
-				args.AddArg(DEF_APP_BUILD_DATE_TIME);
-				args.AddArg(DEF_APP_BUILD_DATE);
-				args.AddArg(DEF_APP_BUILD_TIME);
-				args.AddArg(DEF_BUILT_BY_APPBUILD);
-				
-				args.AddDefines(mDefines);
-				
-				args.AddIncludeSearchPath(includeSearchPaths);
-				if( !isCfile )
-					args.AddArg("-std=" + mCppStandard);
+	// Ask the compiler to tell us the files it read. The system headers are listed too, the dependency checks leave those to the system stamp
+	// but the object cache has to know them, a package update that changes a header must not get an object built against the old one.
+	rDepfile.clear();
+	if( mCompilerDepfiles )
+	{
+		rDepfile = pJob.mOutputFilename.substr(0,pJob.mOutputFilename.size() - GetExtension(pJob.mOutputFilename).size()) + "d";
+		args.AddArg("-MD");
+		args.AddArg("-MF");
+		args.AddArg(rDepfile);
+	}
 
-				if( mWarningsAsErrors )
-					args.AddArg("-Werror");
+	args.AddArg("-o");
+	args.AddArg(pJob.mOutputFilename);
+	args.AddArg("-c");
+	args.AddArg(pJob.mInputFilename);
+	return args;
+}
 
-				if( mEnableAllWarnings )
-					args.AddArg("-Wall");
+uint64_t Configuration::GetCommandHash(const ArgList& pArgs)const
+{
+	// Only the three AddBuildStamp makes, a user define that starts the same, APP_BUILD_CHANNEL say, is part of the command.
+	static const char* BuildTimeDefines[] = {"-DAPP_BUILD_DATE_TIME=","-DAPP_BUILD_DATE=","-DAPP_BUILD_TIME="};
+	auto IsBuildTimeDefine = [](const std::string& pArg)
+	{
+		for( const char* define : BuildTimeDefines )
+		{
+			if( pArg.compare(0,strlen(define),define) == 0 )
+				return true;
+		}
+		return false;
+	};
 
-				if( mFatalErrors )
-					args.AddArg("-Wfatal-errors");
+	uint64_t hash = HashString(mComplier + "\n");
+	for( const std::string& arg : (const StringVec&)pArgs )
+	{
+		// The defines of the configuration are checked by the dependencies on their own, so a change only rebuilds the files that use them.
+		if( arg.compare(0,2,"-D") == 0 && (IsBuildTimeDefine(arg) || std::find(mDefines.begin(),mDefines.end(),arg.substr(2)) != mDefines.end()) )
+			continue;
+		hash = HashString(arg + "\n",hash);
+	}
+	return hash;
+}
 
-				args.AddArg(mExtraCompilerArgs);
+BuildTask* Configuration::MakeCompileTask(const CompileJob& pJob,const ArgList& pArgs,const std::string& pDepfile,uint64_t pCommandHash,Dependencies& rDependencies,BuildLog& rBuildLog)const
+{
+	// This can be called from the threads checking the dependencies, so it only reads the configuration.
+	if(mLoggingMode >= LOG_VERBOSE)
+	{
+		std::cout << "Creating " + pJob.mOutputFilename + " from file " + pJob.mInputFilename + "\n";// One string so the lines from different threads do not get mixed up.
+	}
 
-				args.AddArg("-o");
-				args.AddArg(OutputFilename);
-				args.AddArg("-c");
-				args.AddArg(InputFilename);
+	// Going to build the file, so delete the obj that is there.
+	// If we do not do this then it can effect the dependency system.
+	std::remove(pJob.mOutputFilename.c_str());
+	rDependencies.SetObjectCommand(pJob.mOutputFilename,pCommandHash);
 
-				rBuildTasks.push(new BuildTaskCompile(GetFileName(filename), OutputFilename, mComplier,args,mLoggingMode));
-			}
-		}
-		else
-		{
-			std::cerr << "Input filename not found " << InputFilename << '\n';
-		}
-	}
-	return true;
+	BuildTask* task = new BuildTaskCompile(pJob.mTaskName, pJob.mOutputFilename, mComplier,pArgs,mLoggingMode,pDepfile,&rDependencies);
+	task->SetPriority(rBuildLog.GetPriority(pJob.mOutputFilename,pJob.mInputFilename,rDependencies.GetNumIncludes(pJob.mInputFilename,pJob.mOutputFilename)));
+	return task;
 }
 
 bool Configuration::AddDefines(const tinyjson::JsonValue& pDefines)
@@ -615,10 +794,14 @@ bool Configuration::AddIncludesFromPKGConfig(StringVec& pIncludeSearchPaths,cons
 		{
 			if( inc.size() > 2 && CompareNoCase(inc.c_str(),"-I",2) )
 			{
-				const std::string theFolder = TrimWhiteSpace(inc.substr(2));
+				std::string theFolder = TrimWhiteSpace(inc.substr(2));
 
 				if( DirectoryExists(theFolder) )
 				{
+					// The include search joins the path and the include, so it needs to end with a '/' like all the others.
+					if( theFolder.back() != '/' )
+						theFolder += '/';
+
 					pIncludeSearchPaths.push_back(theFolder);
 					FoundIncludes = true;
 					if(mLoggingMode >= LOG_VERBOSE)
@@ -646,6 +829,38 @@ bool Configuration::AddIncludesFromPKGConfig(StringVec& pIncludeSearchPaths,cons
 	return false;
 }
 
+uint64_t Configuration::GetSystemStamp(const StringVec& pSystemIncludePaths)const
+{
+	if( pSystemIncludePaths.size() == 0 )
+		return 0;
+
+	// Two process launches a build, a lot cheaper than looking at every header they own.
+	std::string versions;
+	ExecuteShellCommand(mComplier,{"--version"},versions);
+	uint64_t stamp = HashString(mComplier + "\n" + versions);
+
+	if( mGTKVersion.size() > 0 )
+	{
+		versions.clear();
+		ExecuteShellCommand("pkg-config",{"--modversion",mGTKVersion},versions);
+		stamp = HashString(mGTKVersion + "\n" + versions,stamp);
+	}
+
+	// A package being installed or removed changes the modification time of the folders its headers go in.
+	for( const std::string& path : pSystemIncludePaths )
+	{
+		struct stat Stats;
+		stamp = HashString(path,stamp);
+		if( stat(path.c_str(),&Stats) == 0 )
+		{
+			stamp = HashData(&Stats.st_mtim,sizeof(Stats.st_mtim),stamp);
+		}
+	}
+
+	// Zero means not known.
+	return stamp != 0 ? stamp : 1;
+}
+
 bool Configuration::AddLibrariesFromPKGConfig(StringVec& pLibraryFiles,const std::string& pVersion)const
 {
 	if(mLoggingMode >= LOG_VERBOSE)
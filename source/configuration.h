@@ -20,6 +20,7 @@
 #include <map>
 #include <string>
 #include <memory>
+#include <vector>
 
 #include "string_types.h"
 #include "json.h"
@@ -42,6 +43,8 @@ enum eTargetType
 };
 
 class Dependencies;
+class BuildLog;
+class BuildTask;
 class BuildTaskStack;
 class JsonWriter;
 class Project;
@@ -69,7 +72,15 @@ public:
 	const StringVec& GetLibrarySearchPaths()const{return mLibrarySearchPaths;}
 	const StringMap& GetDependantProjects()const{return mDependantProjects;}
 
-	bool GetBuildTasks(const SourceFiles& pProjectSourceFiles,const SourceFiles& pGeneratedResourceFiles,bool pRebuildAll,const ArgList& pAdditionalArgs,StringVec& pProjectIncludes,BuildTaskStack& rBuildTasks,Dependencies& rDependencies,StringVec& rOutputFiles)const;
+	/**
+	 * @brief Works out the output files and starts the tasks that will build the ones that are out of date.
+	 * When pRebuildAll is false the dependency checks are done by producer threads on rBuildTasks and are still
+	 * running when this returns, so compiling can start before they are done. rOutputFiles is complete when this returns.
+	 * The headers in pSystemIncludes, and the ones pkg-config adds, are not checked. Instead a stamp of the compiler and package versions is.
+	 * rBuildLog gives each task its priority, so the ones that took longest last time are started first.
+	 * pAppVersion is the version of the project, it goes in the build stamp as APP_VERSION.
+	 */
+	bool GetBuildTasks(const SourceFiles& pProjectSourceFiles,const SourceFiles& pGeneratedResourceFiles,bool pRebuildAll,size_t pNumThreads,const ArgList& pAdditionalArgs,const std::string& pAppVersion,StringVec& pProjectIncludes,const StringVec& pSystemIncludes,BuildTaskStack& rBuildTasks,Dependencies& rDependencies,BuildLog& rBuildLog,StringVec& rOutputFiles)const;
 
 	void AddDefine(const std::string& pDefine);
 	void AddLibrary(const std::string& pLib);
@@ -86,19 +97,59 @@ public:
 
 private:
 	/**
-	 * @brief Adds an BuildTaskCompile object for every source file that needs to be built.
+	 * @brief A source file that may need to be built. Is turned into a BuildTaskCompile once we know it does.
+	 */
+	struct CompileJob
+	{
+		std::string mTaskName;
+		std::string mInputFilename;
+		std::string mOutputFilename;
+	};
+	typedef std::vector<CompileJob> CompileJobVec;
+
+	/**
+	 * @brief Adds a CompileJob for every source file, works out the output file names.
 	 * 
 	 * @param pSourceFiles The source files that 'may' need to be built.
-	 * @param pRebuildAll If true forces a rebuild of all source files.
-	 * @param pAdditionalArgs Some extra build arguments that the calling function may need to add. Other args are added in this function.
-	 * @param rBuildTasks The location that the new BuildTaskCompile is added too.
-	 * @param rDependencies A dependency cache, when pRebuildAll is false this is used to test if a file needs building.
+	 * @param rCompileJobs Where the new jobs are added.
 	 * @param rOutputFiles The list of files that will be written.
 	 * @param rInputFilesSeen A list to ensure the same file is not compiled more than once.
 	 * @return true 
 	 * @return false 
 	 */
-	bool AddCompileTasks(const SourceFiles& pSourceFiles,bool pRebuildAll,const ArgList& pAdditionalArgs,StringVec& pProjectIncludes,BuildTaskStack& rBuildTasks,Dependencies& rDependencies,StringVec& rOutputFiles,StringSet& rInputFilesSeen)const;
+	bool AddCompileJobs(const SourceFiles& pSourceFiles,CompileJobVec& rCompileJobs,StringVec& rOutputFiles,StringSet& rInputFilesSeen)const;
+
+	/**
+	 * @brief Works out the full set of args the compiler is run with for a job.
+	 * @param pJob The source file to build.
+	 * @param pCommonArgs The args that are the same for all source files, the defines, include paths and so on.
+	 * @param rDepfile Set to the depfile the compiler is asked to write, empty if depfiles are off.
+	 */
+	ArgList GetCompileArgs(const CompileJob& pJob,const ArgList& pCommonArgs,std::string& rDepfile)const;
+
+	/**
+	 * @brief Hashes the compiler and its args, what the dependency checks compare to see if an object was built with a different command.
+	 * The build date and time defines are left out, they are different every build and have never caused a rebuild.
+	 * So are the defines of the configuration, see Dependencies::SetDefines.
+	 */
+	uint64_t GetCommandHash(const ArgList& pArgs)const;
+
+	/**
+	 * @brief Makes the compile task for a job.
+	 * @param pJob The source file to build.
+	 * @param pArgs The args from GetCompileArgs.
+	 * @param pDepfile The depfile from GetCompileArgs.
+	 * @param pCommandHash The hash of the args, recorded in rDependencies as what the object was built with.
+	 * @param rDependencies If compiler depfiles are on the task records what the compiler read in here.
+	 * @param rBuildLog Where the priority of the task comes from.
+	 */
+	BuildTask* MakeCompileTask(const CompileJob& pJob,const ArgList& pArgs,const std::string& pDepfile,uint64_t pCommandHash,Dependencies& rDependencies,BuildLog& rBuildLog)const;
+
+	/**
+	 * @brief Adds APP_VERSION and the build date and time, as defines or as the header, see mBuildStampHeader.
+	 * @param rIncludeSearchPaths The output folder is added to these when the stamp is a header, so it's found and checked like any other header.
+	 */
+	bool AddBuildStamp(const std::string& pAppVersion,ArgList& rArgs,StringVec& rIncludeSearchPaths)const;
 
 	bool AddDefines(const tinyjson::JsonValue& pDefines);
 
@@ -110,6 +161,11 @@ private:
 
 	const std::string TargetTypeToString(eTargetType pTarget)const;
 
+	/**
+	 * @brief Makes a hash of the things that change the system headers, the compiler version, pkg-config package versions and the system include folders.
+	 */
+	uint64_t GetSystemStamp(const StringVec& pSystemIncludePaths)const;
+
 
 	const std::string mConfigName;
 	const std::string mProjectDir;	//!< The path to where the project file was loaded. All relative paths start in this folder.
@@ -131,6 +187,9 @@ private:
 	bool mWarningsAsErrors;			//!< If true then any warnings will become errors using the compiler option -Werror
 	bool mEnableAllWarnings;		//!< If true then the option -Wall is used.
 	bool mFatalErrors;				//!< If true, -Wfatal-errors, is added to the build args.
+	bool mCompilerDepfiles;			//!< If true the compiler writes a depfile, -MD -MF, that is then used to know what an object was built from. It lists the system headers too, they are only read when the defines change. Scanning for includes is then only done for objects without one.
+	bool mBuildStampHeader;			//!< If true, "build_stamp": "header", the version and build time are written to appbuild_stamp.h in the output folder and not added as defines to every compile.
+									//!< The command line is then the same every build, so objects can come from the object cache, and only the files that include it are rebuilt when it changes.
 	SearchPaths mIncludeSearchPaths;
 	SearchPaths mLibrarySearchPaths;
 	SearchPaths mLibraryFiles;
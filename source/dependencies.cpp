@@ -15,28 +15,765 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
    
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <assert.h>
+#include <algorithm>
+#include <unordered_set>
 #include "misc.h"
+#include "directory_index.h"
 
 #include "dependencies.h"
 
 namespace appbuild{
 //////////////////////////////////////////////////////////////////////////
-Dependencies::Dependencies()
+// The dependency cache file is a simple binary dump of the include graph. The header has the include paths hash and the system stamp. All values are in the native byte order, it is not intended to be moved between machines.
+// Header, then the path table, a file's index in it is its id, then the table of include names. Then a record for each scanned file with its time stamp, the id of each include found and the id of each name it includes.
+// After that a record for each object file built with a compiler depfile, the object's time stamp and for each file the compiler read the id, time stamp and content hash.
+// Then the ids of the system headers the compiler read, they are not checked, they are only read for identifiers when the defines change.
+// Then the id of each object file with the hash of the command and of the defines it was built with, and the defines for each of those hashes.
+// Last the identifiers of each file that has been read for them, only done when the defines change, with its time stamp.
+static const char DEPENDENCY_CACHE_MAGIC[4] = {'A','B','D','C'};
+static const uint32_t DEPENDENCY_CACHE_VERSION = 9;
+
+namespace{
+// Reads values out of the memory mapped cache file making sure we never read past the end, if the file is truncated or corrupt we just fail.
+struct CacheReader
+{
+	const uint8_t* mPos;
+	const uint8_t* mEnd;
+
+	template <typename VALUE_TYPE>bool Read(VALUE_TYPE& rValue)
+	{
+		if( (size_t)(mEnd - mPos) < sizeof(VALUE_TYPE) )
+			return false;
+		memcpy(&rValue,mPos,sizeof(VALUE_TYPE));
+		mPos += sizeof(VALUE_TYPE);
+		return true;
+	}
+
+	bool Read(std::string& rString,uint32_t pLength)
+	{
+		if( (size_t)(mEnd - mPos) < pLength )
+			return false;
+		rString.assign((const char*)mPos,pLength);
+		mPos += pLength;
+		return true;
+	}
+};
+
+template <typename VALUE_TYPE>void CacheWrite(std::ofstream& pFile,const VALUE_TYPE& pValue)
+{
+	pFile.write((const char*)&pValue,sizeof(VALUE_TYPE));
+}
+
+// The contents of a file. Most headers are small and for those mapping the file costs more than the read, so they are read into a buffer kept per thread.
+// Bigger files are memory mapped so there is no copy. Only one can be open at a time on a thread as they share the buffer.
+struct FileContents
+{
+	static const size_t READ_LIMIT = 64 * 1024;
+	const char* mData = nullptr;
+	size_t mSize = 0;
+	bool mMapped = false;
+
+	bool Open(const std::string& pFilename)
+	{
+		static thread_local char buffer[READ_LIMIT];
+
+		const int file = open(pFilename.c_str(),O_RDONLY);
+		if( file < 0 )
+			return false;
+
+		struct stat Stats;
+		bool ok = fstat(file,&Stats) == 0;
+		if( ok && Stats.st_size > 0 && (size_t)Stats.st_size <= READ_LIMIT )
+		{
+			const ssize_t bytesRead = read(file,buffer,Stats.st_size);
+			ok = bytesRead >= 0;
+			mData = buffer;
+			mSize = ok ? bytesRead : 0;
+		}
+		else if( ok && Stats.st_size > 0 )
+		{
+			void* mapped = mmap(nullptr,Stats.st_size,PROT_READ,MAP_PRIVATE,file,0);
+			ok = mapped != MAP_FAILED;
+			if( ok )
+			{
+				mData = (const char*)mapped;
+				mSize = Stats.st_size;
+				mMapped = true;
+			}
+		}
+		close(file);
+		return ok;
+	}
+
+	~FileContents()
+	{
+		if( mMapped )
+			munmap((void*)mData,mSize);
+	}
+};
+
+inline bool IsLineSpace(char pChar)
+{
+	return pChar == ' ' || pChar == '\t';
+}
+
+/**
+ * @brief True if the line ending at pNewLine ends with a backslash, so the next line is part of it.
+ */
+inline bool IsContinuedLine(const char* pData,const char* pNewLine)
+{
+	if( pNewLine > pData && pNewLine[-1] == '\r' )
+		pNewLine--;
+	return pNewLine > pData && pNewLine[-1] == '\\';
+}
+
+/**
+ * @brief Moves past spaces, tabs and backslash new lines, a directive can be split over lines with them.
+ */
+inline const char* SkipLineSpace(const char* pPos,const char* pEnd)
+{
+	for(;;)
+	{
+		if( pPos < pEnd && IsLineSpace(*pPos) )
+			pPos++;
+		else if( pEnd - pPos >= 2 && pPos[0] == '\\' && pPos[1] == '\n' )
+			pPos += 2;
+		else if( pEnd - pPos >= 3 && pPos[0] == '\\' && pPos[1] == '\r' && pPos[2] == '\n' )
+			pPos += 3;
+		else
+			return pPos;
+	}
+}
+
+/**
+ * @brief Finds every '#include' in the text and calls pFound with the name between the quotes or angle brackets.
+ * Only looks at lines where the # is the first thing on the line, so '// #include' is skipped, and allows '# include'.
+ * Backslash new lines are followed the way the preprocessor does, so a '#include \' with the name on the next line is found and a '#include' on a line continued from a comment is not.
+ * It jumps from # to # with memchr, which the C library does with vector instructions on every CPU we build for, so most of the file is never looked at a byte at a time.
+ * No allocations, pFound gets a pointer into pData and a length.
+ */
+template <typename FOUND_CALLBACK>void FindIncludeDirectives(const char* pData,size_t pSize,FOUND_CALLBACK pFound)
+{
+	const char* const end = pData + pSize;
+	const char* pos = pData;
+	while( pos < end && (pos = (const char*)memchr(pos,'#',end - pos)) != nullptr )
+	{
+		// Make sure there is only white space between the # and the start of the line.
+		const char* lineStart = pos;
+		while( lineStart > pData && IsLineSpace(lineStart[-1]) )
+			lineStart--;
+
+		pos++;// Past the #, so we always move on.
+		if( lineStart > pData && lineStart[-1] != '\n' && lineStart[-1] != '\r' )
+			continue;
+		if( lineStart > pData && lineStart[-1] == '\n' && IsContinuedLine(pData,lineStart - 1) )
+			continue;
+
+		pos = SkipLineSpace(pos,end);
+
+		if( (size_t)(end - pos) < 7 || memcmp(pos,"include",7) != 0 )
+			continue;
+		pos += 7;
+
+		// Now scan from here to find a " or a <. Anything else between, like the _next of #include_next, is skipped as the line may be malformed.
+		char terminator = 0;
+		for( ; pos < end && terminator == 0 ; pos++ )
+		{
+			if( *pos == '\n' && IsContinuedLine(pData,pos) == false )
+				break;
+			else if( *pos == '\"' )
+				terminator = '\"';
+			else if( *pos == '<' )
+				terminator = '>';
+		}
+
+		// If we have a terminator then scan to the end of the line for the other end and treat what's between as the filename.
+		if( terminator != 0 )
+		{
+			const char* start = pos;
+			for( ; pos < end && *pos != terminator && *pos != '\n' ; pos++ );
+
+			// Did we find the end?
+			if( pos < end && *pos == terminator && pos > start )
+				pFound(start,pos - start);
+		}
+	}
+}
+
+inline bool IsIdentifierChar(char pChar)
 {
+	return (pChar >= 'a' && pChar <= 'z') || (pChar >= 'A' && pChar <= 'Z') || (pChar >= '0' && pChar <= '9') || pChar == '_';
+}
+
+inline uint32_t HashIdentifier(const char* pName,size_t pLength)
+{
+	return (uint32_t)HashData(pName,pLength);
+}
+
+// Stands in for ## in a file's identifiers, it can make a name that is not in the file. Can't be an identifier so won't be the hash of a macro, unless they collide, then a file is rebuilt for nothing.
+const uint32_t TOKEN_PASTE = HashIdentifier("##",2);
+
+/**
+ * @brief Calls pFound with every identifier in the text. Comments and strings are not skipped, a name in one just means an object may be rebuilt when it did not need to be.
+ * A run of letters, digits and _ that starts with a digit is a number, 1ULL or 0x1F, not an identifier, so it is skipped. Calls pFound with "##" for a token paste.
+ */
+template <typename FOUND_CALLBACK>void FindIdentifiers(const char* pData,size_t pSize,FOUND_CALLBACK pFound)
+{
+	const char* const end = pData + pSize;
+	const char* pos = pData;
+	while( pos < end )
+	{
+		if( IsIdentifierChar(*pos) )
+		{
+			const char* start = pos;
+			while( pos < end && IsIdentifierChar(*pos) )
+				pos++;
+
+			if( *start < '0' || *start > '9' )
+				pFound(start,pos - start);
+		}
+		else if( *pos == '#' && pos + 1 < end && pos[1] == '#' )
+		{
+			pFound(pos,2);
+			pos += 2;
+		}
+		else
+		{
+			pos++;
+		}
+	}
+}
+
+/**
+ * @brief Gets the name of the macro from a define, NAME, NAME=value or NAME(args)=value.
+ * @return false The name is not an identifier.
+ */
+bool GetMacroName(const std::string& pDefine,std::string& rName,std::string& rValue)
+{
+	size_t end = 0;
+	while( end < pDefine.size() && IsIdentifierChar(pDefine[end]) )
+		end++;
+
+	rName = pDefine.substr(0,end);
+	const size_t equals = pDefine.find('=',end);
+	rValue = equals != std::string::npos ? pDefine.substr(equals + 1) : "";
+	return end > 0 && (rName[0] < '0' || rName[0] > '9') && (end == pDefine.size() || pDefine[end] == '=' || pDefine[end] == '(');
+}
+};
+
+Dependencies::Dependencies(bool pUseContentHash):
+	mDefinesHash(HashString("")),
+	mUseContentHash(pUseContentHash),
+	mCachedIncludePathsHash(0),
+	mIncludePathsHash(0),
+	mSystemStamp(0),
+	mCachedSystemStamp(0),
+	mSavedSystemStamp(0),
+	mCacheDirty(false),
+	mNumCacheHits(0),
+	mNumDepfileHits(0),
+	mNumUnchangedContents(0),
+	mNumDefinesNotUsed(0)
+{
+}
+
+bool Dependencies::LoadCache(const std::string& pCacheFilename)
+{
+	const int file = open(pCacheFilename.c_str(),O_RDONLY);
+	if( file < 0 )
+		return false;
+
+	FileStats Stats;
+	if( fstat(file,&Stats) != 0 || Stats.st_size < (off_t)(sizeof(DEPENDENCY_CACHE_MAGIC) + sizeof(uint32_t)) )
+	{
+		close(file);
+		return false;
+	}
+
+	void* mapped = mmap(nullptr,Stats.st_size,PROT_READ,MAP_PRIVATE,file,0);
+	close(file);// The mapping stays valid after the file is closed.
+	if( mapped == MAP_FAILED )
+		return false;
+
+	CacheReader reader = {(const uint8_t*)mapped,(const uint8_t*)mapped + Stats.st_size};
+	uint64_t includePathsHash = 0,systemStamp = 0;
+	bool ok = memcmp(mapped,DEPENDENCY_CACHE_MAGIC,sizeof(DEPENDENCY_CACHE_MAGIC)) == 0;
+	reader.mPos += sizeof(DEPENDENCY_CACHE_MAGIC);
+
+	uint32_t version = 0;
+	ok = ok && reader.Read(version) && version == DEPENDENCY_CACHE_VERSION;
+	ok = ok && reader.Read(includePathsHash);
+	ok = ok && reader.Read(systemStamp);
+
+	// The paths, everything else refers to these by index. They are added to our table as they're read, the ids may not match the file's if something was interned before the load.
+	FileIDVec ids;
+	uint32_t numStrings = 0;
+	ok = ok && reader.Read(numStrings);
+	for( uint32_t n = 0 ; ok && n < numStrings ; n++ )
+	{
+		uint32_t length = 0;
+		std::string str;
+		ok = reader.Read(length) && reader.Read(str,length);
+		if( ok )
+			ids.push_back(InternPath(str));
+	}
+
+	FileIDVec nameIDs;
+	uint32_t numNames = 0;
+	ok = ok && reader.Read(numNames);
+	for( uint32_t n = 0 ; ok && n < numNames ; n++ )
+	{
+		uint32_t length = 0;
+		std::string str;
+		ok = reader.Read(length) && reader.Read(str,length);
+		if( ok )
+			nameIDs.push_back(mNames.Intern(str));
+	}
+
+	// Read into temporaries first, if the file turns out to be bad part way nothing is used.
+	struct LoadedFile
+	{
+		uint32_t mFile;
+		timespec mFileTime;
+		uint32_t mFirstInclude;
+		uint32_t mNumIncludes;
+		uint32_t mFirstIncludeName;
+		uint32_t mNumIncludeNames;
+	};
+	std::vector<LoadedFile> loadedFiles;
+	FileIDVec loadedIncludes;
+	FileIDVec loadedIncludeNames;
+	uint32_t numFiles = 0;
+	ok = ok && reader.Read(numFiles);
+	for( uint32_t n = 0 ; ok && n < numFiles ; n++ )
+	{
+		uint32_t fileIndex = 0,numIncludes = 0;
+		int64_t seconds = 0,nanoseconds = 0;
+		ok = reader.Read(fileIndex) && fileIndex < ids.size() && reader.Read(seconds) && reader.Read(nanoseconds) && reader.Read(numIncludes);
+
+		LoadedFile entry = {ok ? ids[fileIndex] : 0,{(time_t)seconds,(long)nanoseconds},(uint32_t)loadedIncludes.size(),numIncludes,0,0};
+		for( uint32_t i = 0 ; ok && i < numIncludes ; i++ )
+		{
+			uint32_t includeIndex = 0;
+			ok = reader.Read(includeIndex) && includeIndex < ids.size();
+			if( ok )
+				loadedIncludes.push_back(ids[includeIndex]);
+		}
+
+		entry.mFirstIncludeName = (uint32_t)loadedIncludeNames.size();
+		ok = ok && reader.Read(entry.mNumIncludeNames);
+		for( uint32_t i = 0 ; ok && i < entry.mNumIncludeNames ; i++ )
+		{
+			uint32_t nameIndex = 0;
+			ok = reader.Read(nameIndex) && nameIndex < nameIDs.size();
+			if( ok )
+				loadedIncludeNames.push_back(nameIDs[nameIndex]);
+		}
+
+		if( ok )
+			loadedFiles.push_back(entry);
+	}
+
+	ObjectDependencyMap loadedObjects;
+	uint32_t numObjects = 0;
+	ok = ok && reader.Read(numObjects);
+	for( uint32_t n = 0 ; ok && n < numObjects ; n++ )
+	{
+		uint32_t objectIndex = 0,numFiles = 0;
+		int64_t seconds = 0,nanoseconds = 0;
+		ok = reader.Read(objectIndex) && objectIndex < ids.size() && reader.Read(seconds) && reader.Read(nanoseconds) && reader.Read(numFiles);
+
+		ObjectDependencies entry;
+		entry.mObjectTime.tv_sec = seconds;
+		entry.mObjectTime.tv_nsec = nanoseconds;
+		for( uint32_t i = 0 ; ok && i < numFiles ; i++ )
+		{
+			uint32_t fileIndex = 0;
+			InputFile input;
+			ok = reader.Read(fileIndex) && fileIndex < ids.size() && reader.Read(seconds) && reader.Read(nanoseconds) && reader.Read(input.mHash);
+			if( ok )
+			{
+				input.mFile = ids[fileIndex];
+				input.mFileTime.tv_sec = seconds;
+				input.mFileTime.tv_nsec = nanoseconds;
+				entry.mFiles.push_back(input);
+			}
+		}
+
+		uint32_t numSystemFiles = 0;
+		ok = ok && reader.Read(numSystemFiles);
+		for( uint32_t i = 0 ; ok && i < numSystemFiles ; i++ )
+		{
+			uint32_t fileIndex = 0;
+			ok = reader.Read(fileIndex) && fileIndex < ids.size();
+			if( ok )
+				entry.mSystemFiles.push_back(ids[fileIndex]);
+		}
+
+		if( ok )
+			loadedObjects[ids[objectIndex]] = entry;
+	}
+
+	ObjectCommandMap loadedCommands;
+	uint32_t numCommands = 0;
+	ok = ok && reader.Read(numCommands);
+	for( uint32_t n = 0 ; ok && n < numCommands ; n++ )
+	{
+		uint32_t objectIndex = 0;
+		ObjectCommand command = {0,0};
+		ok = reader.Read(objectIndex) && objectIndex < ids.size() && reader.Read(command.mCommand) && reader.Read(command.mDefines);
+		if( ok )
+			loadedCommands[ids[objectIndex]] = command;
+	}
+
+	DefineSetMap loadedDefineSets;
+	uint32_t numDefineSets = 0;
+	ok = ok && reader.Read(numDefineSets);
+	for( uint32_t n = 0 ; ok && n < numDefineSets ; n++ )
+	{
+		uint64_t definesHash = 0;
+		uint32_t numDefines = 0;
+		ok = reader.Read(definesHash) && reader.Read(numDefines);
+
+		StringVec& defines = loadedDefineSets[definesHash];
+		for( uint32_t i = 0 ; ok && i < numDefines ; i++ )
+		{
+			uint32_t length = 0;
+			std::string define;
+			ok = reader.Read(length) && reader.Read(define,length);
+			if( ok )
+				defines.push_back(define);
+		}
+	}
+
+	struct LoadedIdentifiers
+	{
+		uint32_t mFile;
+		timespec mFileTime;
+		uint32_t mFirstIdentifier;
+		uint32_t mNumIdentifiers;
+	};
+	std::vector<LoadedIdentifiers> loadedIdentifierFiles;
+	IdentifierVec loadedIdentifiers;
+	uint32_t numIdentifierFiles = 0;
+	ok = ok && reader.Read(numIdentifierFiles);
+	for( uint32_t n = 0 ; ok && n < numIdentifierFiles ; n++ )
+	{
+		uint32_t fileIndex = 0,numIdentifiers = 0;
+		int64_t seconds = 0,nanoseconds = 0;
+		ok = reader.Read(fileIndex) && fileIndex < ids.size() && reader.Read(seconds) && reader.Read(nanoseconds) && reader.Read(numIdentifiers);
+
+		LoadedIdentifiers entry = {ok ? ids[fileIndex] : 0,{(time_t)seconds,(long)nanoseconds},(uint32_t)loadedIdentifiers.size(),numIdentifiers};
+		for( uint32_t i = 0 ; ok && i < numIdentifiers ; i++ )
+		{
+			uint32_t identifier = 0;
+			ok = reader.Read(identifier);
+			if( ok )
+				loadedIdentifiers.push_back(identifier);
+		}
+
+		if( ok )
+			loadedIdentifierFiles.push_back(entry);
+	}
+
+	munmap(mapped,Stats.st_size);
+
+	if( ok )
+	{
+		// The includes go on the end of the graph as one block, each file just points into it.
+		const uint32_t base = (uint32_t)mIncludes.size();
+		const uint32_t namesBase = (uint32_t)mIncludeNames.size();
+		mIncludes.insert(mIncludes.end(),loadedIncludes.begin(),loadedIncludes.end());
+		mIncludeNames.insert(mIncludeNames.end(),loadedIncludeNames.begin(),loadedIncludeNames.end());
+		for( const LoadedFile& entry : loadedFiles )
+		{
+			FileNode& node = mFiles[entry.mFile];
+			node.mFirstInclude = base + entry.mFirstInclude;
+			node.mNumIncludes = entry.mNumIncludes;
+			node.mFirstIncludeName = namesBase + entry.mFirstIncludeName;
+			node.mNumIncludeNames = entry.mNumIncludeNames;
+			node.mIncludesTime = entry.mFileTime;
+			node.mFlags |= INCLUDES_CACHED;
+		}
+
+		const uint32_t identifiersBase = (uint32_t)mIdentifiers.size();
+		mIdentifiers.insert(mIdentifiers.end(),loadedIdentifiers.begin(),loadedIdentifiers.end());
+		for( const LoadedIdentifiers& entry : loadedIdentifierFiles )
+		{
+			FileNode& node = mFiles[entry.mFile];
+			node.mFirstIdentifier = identifiersBase + entry.mFirstIdentifier;
+			node.mNumIdentifiers = entry.mNumIdentifiers;
+			node.mIdentifiersTime = entry.mFileTime;
+			node.mFlags |= IDENTIFIERS_CACHED;
+		}
+
+		mObjectDependencies = loadedObjects;
+		mObjectCommands = loadedCommands;
+		mDefineSets.insert(loadedDefineSets.begin(),loadedDefineSets.end());
+		mCachedIncludePathsHash = includePathsHash;
+		mCachedSystemStamp = mSavedSystemStamp = systemStamp;
+	}
+	return ok;
+}
+
+bool Dependencies::SaveCache(const std::string& pCacheFilename)
+{
+	if( mCacheDirty == false && mSavedSystemStamp == mCachedSystemStamp && FileExists(pCacheFilename) )
+		return true;
+
+	// Write to a temp file then rename, so if we're killed half way we don't leave a broken cache behind.
+	MakeDirForFile(pCacheFilename);
+	const std::string tempFilename = pCacheFilename + ".tmp";
+	std::ofstream file(tempFilename,std::ofstream::binary|std::ofstream::trunc);
+	if( !file.is_open() )
+		return false;
+
+	file.write(DEPENDENCY_CACHE_MAGIC,sizeof(DEPENDENCY_CACHE_MAGIC));
+	CacheWrite(file,DEPENDENCY_CACHE_VERSION);
+	CacheWrite(file,mIncludePathsHash);
+	CacheWrite(file,mCachedSystemStamp);
+
+	// The path table is written as is, so the ids are the string indices.
+	CacheWrite(file,mPaths.GetCount());
+	for( uint32_t id = 0 ; id < mPaths.GetCount() ; id++ )
+	{
+		CacheWrite(file,mPaths.GetLength(id));
+		file.write(mPaths.GetPath(id),mPaths.GetLength(id));
+	}
+
+	CacheWrite(file,mNames.GetCount());
+	for( uint32_t id = 0 ; id < mNames.GetCount() ; id++ )
+	{
+		CacheWrite(file,mNames.GetLength(id));
+		file.write(mNames.GetPath(id),mNames.GetLength(id));
+	}
+
+	// Everything we know, what was scanned this time and what was loaded but not needed this build.
+	uint32_t numFiles = 0;
+	for( const FileNode& node : mFiles )
+	{
+		if( node.mFlags & (INCLUDES_KNOWN|INCLUDES_CACHED) )
+			numFiles++;
+	}
+
+	CacheWrite(file,numFiles);
+	for( uint32_t id = 0 ; id < (uint32_t)mFiles.size() ; id++ )
+	{
+		const FileNode& node = mFiles[id];
+		if( node.mFlags & (INCLUDES_KNOWN|INCLUDES_CACHED) )
+		{
+			CacheWrite(file,id);
+			CacheWrite(file,(int64_t)node.mIncludesTime.tv_sec);
+			CacheWrite(file,(int64_t)node.mIncludesTime.tv_nsec);
+			CacheWrite(file,node.mNumIncludes);
+			file.write((const char*)(mIncludes.data() + node.mFirstInclude),node.mNumIncludes * sizeof(uint32_t));
+			CacheWrite(file,node.mNumIncludeNames);
+			file.write((const char*)(mIncludeNames.data() + node.mFirstIncludeName),node.mNumIncludeNames * sizeof(uint32_t));
+		}
+	}
+
+	CacheWrite(file,(uint32_t)mObjectDependencies.size());
+	for( const auto& object : mObjectDependencies )
+	{
+		CacheWrite(file,object.first);
+		CacheWrite(file,(int64_t)object.second.mObjectTime.tv_sec);
+		CacheWrite(file,(int64_t)object.second.mObjectTime.tv_nsec);
+		CacheWrite(file,(uint32_t)object.second.mFiles.size());
+		for( const auto& dependency : object.second.mFiles )
+		{
+			CacheWrite(file,dependency.mFile);
+			CacheWrite(file,(int64_t)dependency.mFileTime.tv_sec);
+			CacheWrite(file,(int64_t)dependency.mFileTime.tv_nsec);
+			CacheWrite(file,dependency.mHash);
+		}
+		CacheWrite(file,(uint32_t)object.second.mSystemFiles.size());
+		file.write((const char*)object.second.mSystemFiles.data(),object.second.mSystemFiles.size() * sizeof(uint32_t));
+	}
+
+	CacheWrite(file,(uint32_t)mObjectCommands.size());
+	std::unordered_set<uint64_t> usedDefineSets;
+	for( const auto& object : mObjectCommands )
+	{
+		CacheWrite(file,object.first);
+		CacheWrite(file,object.second.mCommand);
+		CacheWrite(file,object.second.mDefines);
+		usedDefineSets.insert(object.second.mDefines);
+	}
+
+	// Only the defines some object was built with, the others are not needed any more.
+	uint32_t numDefineSets = 0;
+	for( const auto& defineSet : mDefineSets )
+	{
+		if( usedDefineSets.count(defineSet.first) )
+			numDefineSets++;
+	}
+
+	CacheWrite(file,numDefineSets);
+	for( const auto& defineSet : mDefineSets )
+	{
+		if( usedDefineSets.count(defineSet.first) )
+		{
+			CacheWrite(file,defineSet.first);
+			CacheWrite(file,(uint32_t)defineSet.second.size());
+			for( const std::string& define : defineSet.second )
+			{
+				CacheWrite(file,(uint32_t)define.size());
+				file.write(define.data(),define.size());
+			}
+		}
+	}
+
+	uint32_t numIdentifierFiles = 0;
+	for( const FileNode& node : mFiles )
+	{
+		if( node.mFlags & (IDENTIFIERS_KNOWN|IDENTIFIERS_CACHED) )
+			numIdentifierFiles++;
+	}
+
+	CacheWrite(file,numIdentifierFiles);
+	for( uint32_t id = 0 ; id < (uint32_t)mFiles.size() ; id++ )
+	{
+		const FileNode& node = mFiles[id];
+		if( node.mFlags & (IDENTIFIERS_KNOWN|IDENTIFIERS_CACHED) )
+		{
+			CacheWrite(file,id);
+			CacheWrite(file,(int64_t)node.mIdentifiersTime.tv_sec);
+			CacheWrite(file,(int64_t)node.mIdentifiersTime.tv_nsec);
+			CacheWrite(file,node.mNumIdentifiers);
+			file.write((const char*)(mIdentifiers.data() + node.mFirstIdentifier),node.mNumIdentifiers * sizeof(uint32_t));
+		}
+	}
+
+	file.close();
+	if( !file || rename(tempFilename.c_str(),pCacheFilename.c_str()) != 0 )
+	{
+		std::remove(tempFilename.c_str());
+		return false;
+	}
+
+	mCacheDirty = false;
+	mSavedSystemStamp = mCachedSystemStamp;
+	return true;
+}
+
+void Dependencies::SetSystemIncludes(const StringVec& pSystemIncludePaths,uint64_t pSystemStamp)
+{
+	mSystemIncludePaths = pSystemIncludePaths;
+	mSystemStamp = pSystemStamp;
+}
+
+bool Dependencies::IsSystemFile(const std::string& pFilename)const
+{
+	for( const std::string& path : mSystemIncludePaths )
+	{
+		if( pFilename.compare(0,path.size(),path) == 0 )
+			return true;
+	}
+	return false;
+}
+
+uint32_t Dependencies::InternPath(const std::string& pPath)
+{
+	const uint32_t id = mPaths.Intern(pPath);
+	if( id == mFiles.size() )
+	{
+		FileNode node = {0,0,0,0,0,{0,0},{0,0},{{0,0},false},0,0,{0,0}};
+		mFiles.push_back(node);
+	}
+	return id;
+}
+
+void Dependencies::SetIncludes(uint32_t pFile,const FileIDVec& pIncludes)
+{
+	FileNode& node = mFiles[pFile];
+	node.mFirstInclude = (uint32_t)mIncludes.size();
+	node.mNumIncludes = (uint32_t)pIncludes.size();
+	node.mFlags |= INCLUDES_KNOWN;
+	mIncludes.insert(mIncludes.end(),pIncludes.begin(),pIncludes.end());
+}
+
+void Dependencies::SetIncludeNames(uint32_t pFile,const StringVec& pNames)
+{
+	FileNode& node = mFiles[pFile];
+	node.mFirstIncludeName = (uint32_t)mIncludeNames.size();
+	node.mNumIncludeNames = (uint32_t)pNames.size();
+	for( const std::string& name : pNames )
+		mIncludeNames.push_back(mNames.Intern(name));
 }
 
 void Dependencies::AddGenericFileDependency(const std::string& pPathedFileName)
 {
+	uint32_t id;
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		id = InternPath(pPathedFileName);
+	}
 	timespec FileTime;
-	GetFileTime(pPathedFileName,FileTime);
+	GetFileTime(id,FileTime);
 	mGenericFileDependencies[pPathedFileName] = FileTime;
 }
 
-bool Dependencies::RequiresRebuild(const std::string& pSourceFile,const std::string& pObjectFile,const StringVec& pIncludePaths)
+void Dependencies::SetObjectCommand(const std::string& pObjectFile,uint64_t pCommandHash)
 {
+	std::lock_guard<std::mutex> lock(mLock);
+	ObjectCommand& command = mObjectCommands[InternPath(pObjectFile)];
+	if( command.mCommand != pCommandHash || command.mDefines != mDefinesHash )
+	{
+		command.mCommand = pCommandHash;
+		command.mDefines = mDefinesHash;
+		mCacheDirty = true;
+	}
+}
+
+void Dependencies::SetDefines(const StringVec& pDefines)
+{
+	mDefines = pDefines;
+	mDefinesHash = HashString("");
+	for( const std::string& define : pDefines )
+		mDefinesHash = HashString(define + "\n",mDefinesHash);
+	mDefineSets[mDefinesHash] = pDefines;
+}
+
+bool Dependencies::RequiresRebuild(const std::string& pSourceFile,const std::string& pObjectFile,const StringVec& pIncludePaths,uint64_t pCommandHash)
+{
+	// If the include paths have changed since the cache was written then the headers it found may now resolve to different files. So we can't trust it.
+	uint64_t includePathsHash = HashString("");
+	for( const auto& path : pIncludePaths )
+		includePathsHash = HashString(path + "\n",includePathsHash);
+
+	uint32_t sourceID,objectID;
+	uint64_t builtDefines;
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		if( includePathsHash != mIncludePathsHash )
+		{
+			mIncludePathsHash = includePathsHash;
+			if( mCachedIncludePathsHash != includePathsHash )
+			{
+				for( FileNode& node : mFiles )
+					node.mFlags &= ~INCLUDES_CACHED;
+				mCacheDirty = true;
+			}
+		}
+		sourceID = InternPath(pSourceFile);
+		objectID = InternPath(pObjectFile);
+
+		// Built with different flags or compiler, or we don't know what it was built with, an old cache or none at all.
+		// A one off rebuild is better than an object that does not match its configuration. Different defines are checked once we know what it was built from.
+		ObjectCommandMap::const_iterator found = mObjectCommands.find(objectID);
+		if( found == mObjectCommands.end() || found->second.mCommand != pCommandHash )
+			return true;
+		builtDefines = found->second.mDefines;
+	}
+
 	// Add the path of the source file we're checking to the include paths. Has to be done in a way so that we don't pollute the passed in paths. Hence the copy and the passing in of the params as const. Stops bugs!!!!
 	StringVec IncludePaths = pIncludePaths;
 	const std::string srcPath = GetPath(pSourceFile);
@@ -45,20 +782,14 @@ bool Dependencies::RequiresRebuild(const std::string& pSourceFile,const std::str
 
 
 	// Everything works from the object file's modification date. If any of the dependencies are younger than the object file then the source file needs building.
+	// The newest time of each file's include closure does not depend on the object file, so it is worked out once and then each object is a single compare.
 	timespec ObjFileTime;
 
-	// We have to reset this for each source file as it is information respect to the source files object file date.
-	// This map is also what helps to stop us getting into recursive loop. When it is not in this map we parse it too see what headers it has.
-	// After that it is added with the state of being older or newer. This also prevents it being parsed a second time.
-	// File headers found in a file are cached for each file and don't need to be and are not cleared. So the header is only parsed once.
-	mFileDependencyState.clear();
-	mFileCheckedState.clear();// This one is used to stop recursion.
-
 	// Get the object files info, if this fails then the file is not there, if it is not a regular file then that is wrong and so will rebuild it too.
-	if( GetFileTime(pObjectFile,ObjFileTime) )
+	if( GetFileTime(objectID,ObjFileTime) )
 	{
-		// Before scanning the file, check against the generic file times, if any was set. NOT the same as project file missing.
-		// If a file has changed in anyway we MUST rebuild everything as it's hard to know what the full impact could be. Example, the project file.
+		// Before scanning the file, check against the generic file times, if any was set.
+		// If a file has changed in anyway we MUST rebuild everything as it's hard to know what the full impact could be. Example, an embedded resource file.
 		for( auto dependency : mGenericFileDependencies )
 		{
 			if( FileYoungerThanObjectFile(dependency.second,ObjFileTime) )
@@ -67,75 +798,440 @@ bool Dependencies::RequiresRebuild(const std::string& pSourceFile,const std::str
 			}
 		}
 
-		return CheckSourceDependencies(pSourceFile,ObjFileTime,IncludePaths);
+		// The toolchain or a package has been updated since the objects were built, the system headers could be different.
+		// If we don't know what they were built against, no cache, then we just have to trust them.
+		if( mCachedSystemStamp != 0 && mCachedSystemStamp != mSystemStamp )
+			return true;
+
+		// If the compiler told us what it read when it last built the object then that is the truth, no need to scan anything.
+		// It knows about #if blocks, comments and the real include search order, the scanner below does not.
+		InputFileVec ObjectFiles;
+		if( GetObjectDependencies(objectID,ObjFileTime,ObjectFiles) )
+		{
+			FileIDVec files;
+			for( const InputFile& dependency : ObjectFiles )
+			{
+				if( InputFileChanged(objectID,dependency,ObjFileTime) )
+					return true;
+				files.push_back(dependency.mFile);
+			}
+			return DefinesChangeObject(objectID,builtDefines,files);
+		}
+
+		// Start with the source file, if that has changed there is no need to look at what it includes.
+		if( FileYoungerThanObjectFile(sourceID,ObjFileTime) )
+			return true;
+
+		// Reading the files is the slow part, lots of file IO, so that is done first without holding the walk lock.
+		// This lets many source files be scanned at the same time, the walk that follows then just works from memory.
+		ScanIncludeClosure(sourceID,IncludePaths);
+
+		NewestTime newest;
+		{
+			std::lock_guard<std::mutex> lock(mWalkLock);
+			newest = GetNewestTime(sourceID,IncludePaths);
+		}
+		if( newest.mMissing || FileYoungerThanObjectFile(newest.mTime,ObjFileTime) )
+			return true;
+
+		// Without the depfile we don't know the system headers it read, so we can't tell if they use a macro that changed.
+		return builtDefines != mDefinesHash;
 	}
 
 	// Obj not there, so build it.
 	return true;
 }
 
-bool Dependencies::CheckSourceDependencies(const std::string& pSourceFile,const timespec& pObjFileTime,const StringVec& pIncludePaths)
+bool Dependencies::ReadDepfile(const std::string& pDepfile,const std::string& pObjectFile,const timespec& pCompileStartTime)
+{
+	StringVec files;
+	const bool ok = ParseDepfile(pDepfile,files);
+
+	// The object has just been written so its time is not in mFiles, and if it was it would be the old one.
+	FileStats Stats;
+	if( !ok || stat(pObjectFile.c_str(),&Stats) != 0 )
+		return false;
+
+	// The system headers are checked by the system stamp, so they are kept to one side. They are only needed to see if they use a define that changed.
+	const StringVec::iterator systemFiles = std::stable_partition(files.begin(),files.end(),[this](const std::string& pFilename){return IsSystemFile(pFilename) == false;});
+
+	ObjectDependencies entry;
+	entry.mObjectTime = Stats.st_mtim;
+	uint32_t objectID;
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		objectID = InternPath(pObjectFile);
+		for( StringVec::iterator filename = files.begin() ; filename != systemFiles ; ++filename )
+		{
+			InputFile input = {InternPath(*filename),{0,0},0};
+			entry.mFiles.push_back(input);
+		}
+		for( StringVec::iterator filename = systemFiles ; filename != files.end() ; ++filename )
+			entry.mSystemFiles.push_back(InternPath(*filename));
+	}
+	files.erase(systemFiles,files.end());
+
+	// Only hash files that have not been touched since the compile started, else we may record contents the compiler never saw.
+	if( mUseContentHash )
+	{
+		for( size_t n = 0 ; n < files.size() ; n++ )
+		{
+			InputFile& input = entry.mFiles[n];
+			if( stat(files[n].c_str(),&Stats) == 0 && FileYoungerThanObjectFile(pCompileStartTime,Stats.st_mtim) )
+			{
+				if( GetFileHash(input.mFile,Stats.st_mtim,input.mHash) )
+					input.mFileTime = Stats.st_mtim;
+				else
+					input.mHash = 0;
+			}
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mLock);
+	mObjectDependencies[objectID] = entry;
+	mCacheDirty = true;
+	return true;
+}
+
+size_t Dependencies::GetNumIncludes(const std::string& pSourceFile,const std::string& pObjectFile)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	const uint32_t objectID = mPaths.Find(pObjectFile);
+	if( objectID != PathTable::INVALID_ID )
+	{
+		ObjectDependencyMap::const_iterator found = mObjectDependencies.find(objectID);
+		if( found != mObjectDependencies.end() )
+			return found->second.mFiles.size();
+	}
+
+	const uint32_t sourceID = mPaths.Find(pSourceFile);
+	if( sourceID != PathTable::INVALID_ID && (mFiles[sourceID].mFlags & (INCLUDES_KNOWN|INCLUDES_CACHED)) )
+		return mFiles[sourceID].mNumIncludes;
+
+	return 0;
+}
+
+bool Dependencies::GetObjectDependencies(uint32_t pObjectFile,const timespec& pObjFileTime,InputFileVec& rFiles)
 {
-	// Check that we have not already checked this file.
-	auto found = mFileDependencyState.find(pSourceFile);
-	if( found != mFileDependencyState.end() )
-	{// File already been processed so stop and return the outcome.
-		return found->second;
+	std::lock_guard<std::mutex> lock(mLock);
+	ObjectDependencyMap::iterator found = mObjectDependencies.find(pObjectFile);
+	if( found == mObjectDependencies.end() )
+		return false;
+
+	// If the object has changed since then it was built without a depfile, or by something else. So we don't know what it was built from.
+	if( found->second.mObjectTime.tv_sec != pObjFileTime.tv_sec || found->second.mObjectTime.tv_nsec != pObjFileTime.tv_nsec )
+	{
+		mObjectDependencies.erase(found);
+		mCacheDirty = true;
+		return false;
 	}
 
-	// Start the source file for a start then move onto scanning the file.
-	if( FileYoungerThanObjectFile(pSourceFile,pObjFileTime) )
+	rFiles = found->second.mFiles;
+	mNumDepfileHits++;
+	return true;
+}
+
+bool Dependencies::InputFileChanged(uint32_t pObjectFile,const InputFile& pInput,const timespec& pObjFileTime)
+{
+	// If it's not there then that is an error, rebuild so the user finds out now.
+	timespec FileTime;
+	if( GetFileTime(pInput.mFile,FileTime) == false )
+		return true;
+
+	// Stat says it's not been touched, no need to look inside.
+	if( FileYoungerThanObjectFile(FileTime,pObjFileTime) == false )
+		return false;
+
+	if( mUseContentHash == false || pInput.mHash == 0 )
 		return true;
 
-	// Get all the includes from the file.
-	StringSet Includes;
-	if( GetIncludesFromFile(pSourceFile,pIncludePaths,Includes) )
+	// Hashed it last build, after finding it was the same, and not touched since.
+	if( FileTime.tv_sec == pInput.mFileTime.tv_sec && FileTime.tv_nsec == pInput.mFileTime.tv_nsec )
+		return false;
+
+	uint64_t hash;
+	if( GetFileHash(pInput.mFile,FileTime,hash) == false || hash != pInput.mHash )
+		return true;
+
+	// Same contents, just touched. A git checkout will do this. Record the new time so it's not hashed again next build.
+	std::lock_guard<std::mutex> lock(mLock);
+	mNumUnchangedContents++;
+	ObjectDependencyMap::iterator found = mObjectDependencies.find(pObjectFile);
+	if( found != mObjectDependencies.end() )
 	{
-		// Now check their dependencies.....
-		for( std::string filename : Includes )
+		for( InputFile& input : found->second.mFiles )
 		{
-			if( mFileCheckedState[filename] == false )
+			if( input.mFile == pInput.mFile )
 			{
-				mFileCheckedState[filename] = true;
-				bool result = CheckSourceDependencies(filename,pObjFileTime,pIncludePaths);
-				mFileDependencyState[filename] = result;
-				if( result )
-					return true;
+				input.mFileTime = FileTime;
+				mCacheDirty = true;
+				break;
 			}
 		}
 	}
-
-	// Get here then all is up to date.
 	return false;
 }
 
-bool Dependencies::GetFileTime(const std::string& pFilename,timespec& rFileTime)
+bool Dependencies::GetFileHash(uint32_t pFile,const timespec& pFileTime,uint64_t& rHash)
+{
+	const char* filename;
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		FileHashMap::const_iterator found = mFileHashes.find(pFile);
+		if( found != mFileHashes.end() && found->second.mFileTime.tv_sec == pFileTime.tv_sec && found->second.mFileTime.tv_nsec == pFileTime.tv_nsec )
+		{
+			rHash = found->second.mHash;
+			return true;
+		}
+		filename = mPaths.GetPath(pFile);
+	}
+
+	// Read without the lock held, worst case two threads hash the same file.
+	if( HashFile(filename,rHash) == false )
+		return false;
+
+	// Zero means not known, so make sure we never record it as a real hash.
+	if( rHash == 0 )
+		rHash = 1;
+
+	std::lock_guard<std::mutex> lock(mLock);
+	mFileHashes[pFile] = {pFileTime,rHash};
+	return true;
+}
+
+bool Dependencies::ParseDepfile(const std::string& pDepfile,StringVec& rFiles)
+{
+	std::ifstream file(pDepfile);
+	if( !file.is_open() )
+		return false;
+
+	const std::string content((std::istreambuf_iterator<char>(file)),std::istreambuf_iterator<char>());
+
+	// Make syntax, 'target: file file \' with the list continued on the next line.
+	// A space in a file name is written as '\ ' and a $ as '$$'. Everything before the first ':' is the target, which we don't need.
+	bool seenTarget = false;
+	std::string token;
+	auto EndToken = [&seenTarget,&token,&rFiles]()
+	{
+		if( token.size() > 0 )
+		{
+			if( seenTarget )
+				rFiles.push_back(token);
+			else if( token.back() == ':' )
+				seenTarget = true;
+			token.clear();
+		}
+	};
+
+	for( size_t n = 0 ; n < content.size() ; n++ )
+	{
+		const char c = content[n];
+		if( c == '\\' && n + 1 < content.size() )
+		{
+			const char next = content[n+1];
+			if( next == '\n' || next == '\r' )
+			{// Line continuation, just white space.
+				EndToken();
+				n++;
+				continue;
+			}
+			else if( next == ' ' || next == '#' )
+			{
+				token += next;
+				n++;
+				continue;
+			}
+			token += c;
+		}
+		else if( c == '$' && n + 1 < content.size() && content[n+1] == '$' )
+		{
+			token += '$';
+			n++;
+		}
+		else if( c == ' ' || c == '\t' || c == '\n' || c == '\r' )
+		{
+			EndToken();
+		}
+		else
+		{
+			token += c;
+		}
+	}
+	EndToken();
+
+	// The compiler always lists the source file, so if there is nothing the file was not what we expected.
+	return seenTarget && rFiles.size() > 0;
+}
+
+void Dependencies::ScanIncludeClosure(uint32_t pSourceFile,const StringVec& pIncludePaths)
+{
+	std::unordered_set<uint32_t> seen;
+	FileIDVec toScan;
+	FileIDVec Includes;
+	toScan.push_back(pSourceFile);
+	while( toScan.size() > 0 )
+	{
+		const uint32_t file = toScan.back();
+		toScan.pop_back();
+
+		// If the graph has been walked from this file then everything it includes is already known.
+		{
+			std::lock_guard<std::mutex> lock(mLock);
+			if( mFiles[file].mFlags & NEWEST_KNOWN )
+				continue;
+		}
+
+		timespec FileTime;
+		GetFileTime(file,FileTime);
+
+		if( GetIncludesFromFile(file,pIncludePaths,Includes) )
+		{
+			for( uint32_t include : Includes )
+			{
+				if( seen.insert(include).second )
+					toScan.push_back(include);
+			}
+		}
+	}
+}
+
+Dependencies::NewestTime Dependencies::GetNewestTime(uint32_t pFile,const StringVec& pIncludePaths)
+{
+	NewestTime newest;
+	if( GetKnownNewest(pFile,newest) )
+		return newest;
+
+	GraphWalk walk;
+	WalkIncludeGraph(pFile,pIncludePaths,walk);
+	assert( walk.mStack.size() == 0 );
+	GetKnownNewest(pFile,newest);
+	return newest;
+}
+
+bool Dependencies::GetKnownNewest(uint32_t pFile,NewestTime& rNewest)
+{
+	// Only the thread holding mWalkLock writes the newest times, but other threads may be growing mFiles so the lock is still needed.
+	std::lock_guard<std::mutex> lock(mLock);
+	const FileNode& node = mFiles[pFile];
+	if( (node.mFlags & NEWEST_KNOWN) == 0 )
+		return false;
+	rNewest = node.mNewest;
+	return true;
+}
+
+void Dependencies::WalkIncludeGraph(uint32_t pFile,const StringVec& pIncludePaths,GraphWalk& rWalk)
+{
+	// References to entries in an unordered_map stay valid as it grows, so this is safe to hold across the recursion.
+	GraphWalk::Visit& visit = rWalk.mVisited[pFile];
+	visit.mIndex = visit.mLowLink = rWalk.mNextIndex++;
+	visit.mOnStack = true;
+	visit.mNewest.mTime = {0,0};
+	visit.mNewest.mMissing = (GetFileTime(pFile,visit.mNewest.mTime) == false);
+	rWalk.mStack.push_back(pFile);
+
+	// Unlike the object file, if a file is not here then that is an error and I need to invoke a rebuild of the source file.
+	// If I do not do this then you could delete a used header and not know that the file does not build till you modify it.
+	FileIDVec Includes;
+	if( GetIncludesFromFile(pFile,pIncludePaths,Includes) == false )
+	{
+		visit.mNewest.mMissing = true;
+	}
+
+	for( uint32_t include : Includes )
+	{
+		// Already worked out, from this walk or an earlier one.
+		NewestTime done;
+		if( GetKnownNewest(include,done) )
+		{
+			MergeNewest(visit.mNewest,done);
+			continue;
+		}
+
+		auto seen = rWalk.mVisited.find(include);
+		if( seen == rWalk.mVisited.end() )
+		{
+			WalkIncludeGraph(include,pIncludePaths,rWalk);
+			visit.mLowLink = std::min(visit.mLowLink,rWalk.mVisited[include].mLowLink);
+
+			// If it's not done then it's part of a loop with us, its times are merged when the loop is popped.
+			if( GetKnownNewest(include,done) )
+				MergeNewest(visit.mNewest,done);
+		}
+		else if( seen->second.mOnStack )
+		{// Got back to a file that is still being walked, it includes us. They will share the same result when the loop is complete.
+			visit.mLowLink = std::min(visit.mLowLink,seen->second.mIndex);
+		}
+	}
+
+	// If this is the root of a loop, or just a file on its own, all the files in it get the newest time found between them.
+	if( visit.mLowLink == visit.mIndex )
+	{
+		NewestTime loopNewest = visit.mNewest;
+		size_t start = rWalk.mStack.size();
+		do
+		{
+			start--;
+			GraphWalk::Visit& member = rWalk.mVisited[rWalk.mStack[start]];
+			member.mOnStack = false;
+			MergeNewest(loopNewest,member.mNewest);
+		}while( rWalk.mStack[start] != pFile );
+
+		std::lock_guard<std::mutex> lock(mLock);
+		for( size_t n = start ; n < rWalk.mStack.size() ; n++ )
+		{
+			FileNode& node = mFiles[rWalk.mStack[n]];
+			node.mNewest = loopNewest;
+			node.mFlags |= NEWEST_KNOWN;
+		}
+		rWalk.mStack.resize(start);
+	}
+}
+
+void Dependencies::MergeNewest(NewestTime& rNewest,const NewestTime& pOther)const
+{
+	rNewest.mMissing = rNewest.mMissing || pOther.mMissing;
+	if( FileYoungerThanObjectFile(pOther.mTime,rNewest.mTime) )
+	{
+		rNewest.mTime = pOther.mTime;
+	}
+}
+
+bool Dependencies::GetFileTime(uint32_t pFile,timespec& rFileTime)
 {// I cache file times and the headers found in a file. Gives a very nice speed up.
-	FileTimeMap::iterator found = mFileTimes.find(pFilename);
-	if( found != mFileTimes.end() )
+	const char* filename;
 	{
-		rFileTime = found->second;
-		return true;
+		std::lock_guard<std::mutex> lock(mLock);
+		const FileNode& node = mFiles[pFile];
+		if( node.mFlags & FILE_TIME_KNOWN )
+		{
+			rFileTime = node.mFileTime;
+			return true;
+		}
+		filename = mPaths.GetPath(pFile);// The characters never move, so this is safe to use after the lock is released.
 	}
 
+	// The stat is done without the lock so other threads are not held up, worst case two threads stat the same file.
 	FileStats Stats;
-	if( stat(pFilename.c_str(), &Stats) == 0 && S_ISREG(Stats.st_mode) )
+	if( stat(filename, &Stats) == 0 && S_ISREG(Stats.st_mode) )
 	{
 		rFileTime = Stats.st_mtim;
-		mFileTimes[pFilename] = Stats.st_mtim;
+		std::lock_guard<std::mutex> lock(mLock);
+		FileNode& node = mFiles[pFile];
+		node.mFileTime = Stats.st_mtim;
+		node.mFlags |= FILE_TIME_KNOWN;
 		return true;
 	}
 	// File not found.
 	return false;
 }
 
-bool Dependencies::FileYoungerThanObjectFile(const std::string& pFilename,const timespec& pObjFileTime)
+bool Dependencies::FileYoungerThanObjectFile(uint32_t pFile,const timespec& pObjFileTime)
 {
 	timespec OtherTime;
 	// Get the dependency file's info, if this fails then the file is not there.
 	// Unlike the object file, if not here then that is an error and I need to invoke a rebuild of the source file.
 	// If I do not do this then you could delete a used header and not know that the file does not build till you modify it.
-	if( GetFileTime(pFilename,OtherTime) )
+	if( GetFileTime(pFile,OtherTime) )
 	{
 		return FileYoungerThanObjectFile(OtherTime,pObjFileTime);
 	}
@@ -151,90 +1247,439 @@ bool Dependencies::FileYoungerThanObjectFile(const timespec& pOtherTime,const ti
 		return pOtherTime.tv_sec > pObjFileTime.tv_sec;
 }
 
-bool Dependencies::GetIncludesFromFile(const std::string& pFilename,const StringVec& pIncludePaths,StringSet& rIncludes)
+bool Dependencies::GetIncludesFromFile(uint32_t pFile,const StringVec& pIncludePaths,FileIDVec& rIncludes)
 {
-	assert( pFilename.size() > 0 );
 	assert( pIncludePaths.size() > 0 );
-	assert( rIncludes.size() < 1000  );
 
-	// First see if we have not already parsed this header, if so send back the stuff we found.
-	// Caches the found headers in a file between each dependency check is a very nice speed up.
-	DependencyMap::const_iterator already_done = mDependencies.find(pFilename);
-	if( already_done != mDependencies.end() )
+	// The lock is only held while looking at the graph, never while reading a file, so other threads can scan at the same time.
+	// If two threads want the same file at the same time it may get scanned twice, that is harmless, they will find the same includes.
+	std::string filename;
+	timespec cachedTime = {0,0};
+	bool haveCached = false;
 	{
-		rIncludes = already_done->second;
-		return true;
-	}
+		std::lock_guard<std::mutex> lock(mLock);
+		FileNode& node = mFiles[pFile];
 
-//	std::cout << "GetIncludesFromFile(" << pFilename << ")\n";
+		// First see if we have not already parsed this header, if so send back the stuff we found.
+		// Caches the found headers in a file between each dependency check is a very nice speed up.
+		if( node.mFlags & INCLUDES_KNOWN )
+		{
+			rIncludes.assign(mIncludes.begin() + node.mFirstInclude,mIncludes.begin() + node.mFirstInclude + node.mNumIncludes);
+			return true;
+		}
 
+		// Next see if the last build scanned it, if it has not changed since we'll use that.
+		// The includes stay where they are in the graph, it's only the flag that says they are now trusted.
+		if( node.mFlags & INCLUDES_CACHED )
+		{
+			cachedTime = node.mIncludesTime;
+			haveCached = true;
+			node.mFlags &= ~INCLUDES_CACHED;
+		}
 
-	assert(mDependencies.size() < 1000 );
+		filename.assign(mPaths.GetPath(pFile),mPaths.GetLength(pFile));
+	}
 
-	std::ifstream file(pFilename);
-	if( file.is_open() )
+	timespec FileTime = {0,0};
+	const bool haveTime = GetFileTime(pFile,FileTime);
+	StringVec names;
+	StringSet found;
+	if( haveCached && haveTime && FileTime.tv_sec == cachedTime.tv_sec && FileTime.tv_nsec == cachedTime.tv_nsec )
 	{
-		while( file.eof() == false )
 		{
-			std::string aLine;
-			std::getline(file,aLine);
-			if( aLine.size() >= 12 )// Has to be >= than 12 for #include <a> the shortest incarnation.
+			std::lock_guard<std::mutex> lock(mLock);
+			const FileNode& node = mFiles[pFile];
+			for( uint32_t n = 0 ; n < node.mNumIncludeNames ; n++ )
 			{
-				std::size_t found = aLine.find("#include");
-				if( found != std::string::npos )
-				{
-					found += 8;// Skip #include
-					// Now scan from here to find a " or a <.
-					// I can not use another find as the line maybe malformed.
-					while( found < aLine.size() )
-					{
-						char terminator = 0;
-						if( aLine[found] == '\"' )
-							terminator = '\"';
-						else if( aLine[found] == '<' )
-							terminator = '>';
-
-						found++;// Next char.
-
-						// If we have a terminator then scan to the end and treat that as the filename.
-						if( terminator != 0 )
-						{
-							std::size_t start = found;
-							for(; found < aLine.size() && aLine[found] != terminator ; found++);
-
-							// Did we find the end?
-							if( aLine[found] == terminator )
-							{
-								std::string includefile = aLine.substr(start,found-start);
-
-
-								// Now see if we can find it.
-								for(const std::string& path : pIncludePaths )
-								{
-									std::string PathedInclude = path + includefile;
-									if( FileExists(PathedInclude) )
-									{
-										rIncludes.insert(PathedInclude);
-										break;
-									}
-								}
-							}
-							// And done. Next line please.
-							found = aLine.size();
-						}
-					}
-				}
+				const uint32_t name = mIncludeNames[node.mFirstIncludeName + n];
+				names.push_back(std::string(mNames.GetPath(name),mNames.GetLength(name)));
 			}
 		}
-		// done :)
+
+		// The file is the same but what it includes may not be, a header that was missing may be there now or one earlier on the include paths may hide the one found last time.
+		ResolveIncludeNames(names,pIncludePaths,found);
+
+		std::lock_guard<std::mutex> lock(mLock);
+		rIncludes.clear();
+		for( const std::string& include : found )
+			rIncludes.push_back(InternPath(include));
+
+		FileNode& node = mFiles[pFile];
+		if( rIncludes.size() != node.mNumIncludes || std::equal(rIncludes.begin(),rIncludes.end(),mIncludes.begin() + node.mFirstInclude) == false )
+		{
+			SetIncludes(pFile,rIncludes);
+			mCacheDirty = true;
+		}
+		node.mFlags |= INCLUDES_KNOWN;
+		mNumCacheHits++;
+		return true;
+	}
+	// Not cached or changed, so will be scanned again.
+
+	if( ScanFileForIncludeNames(filename,names) )
+	{
+		ResolveIncludeNames(names,pIncludePaths,found);
+
 		// Record the files found for this file.
-		mDependencies[pFilename] = rIncludes;
+		std::lock_guard<std::mutex> lock(mLock);
+		rIncludes.clear();
+		for( const std::string& include : found )
+			rIncludes.push_back(InternPath(include));
+
+		SetIncludes(pFile,rIncludes);
+		SetIncludeNames(pFile,names);
+		mFiles[pFile].mIncludesTime = FileTime;
+		mCacheDirty = true;
 		return true;
 	}
 
 	// Dependency not found, cause a rebuild of source file.
+	rIncludes.clear();
 	return false;
 }
 
+bool Dependencies::ScanFileForIncludeNames(const std::string& pFilename,StringVec& rNames)
+{
+	FileContents file;
+	if( file.Open(pFilename) == false )
+		return false;
+
+	rNames.clear();
+	FindIncludeDirectives(file.mData,file.mSize,[&rNames](const char* pInclude,size_t pLength)
+	{
+		rNames.push_back(std::string(pInclude,pLength));
+	});
+	// done :)
+	return true;
+}
+
+void Dependencies::ResolveIncludeNames(const StringVec& pNames,const StringVec& pIncludePaths,StringSet& rIncludes)const
+{
+	std::string PathedInclude;
+	for( const std::string& name : pNames )
+	{
+		// Now see if we can find it. Most of these fail, so the folder listings are used instead of a stat for each one.
+		for(const std::string& path : pIncludePaths )
+		{
+			PathedInclude.assign(path);
+			PathedInclude.append(name);
+			if( DirectoryIndex::Get().FindFile(PathedInclude) )
+			{
+				// System headers are covered by the system stamp, so they are not added. Stops us going through hundreds of them.
+				if( IsSystemFile(PathedInclude) == false )
+					rIncludes.insert(PathedInclude);
+				break;
+			}
+		}
+	}
+}
+
+bool Dependencies::DefinesChangeObject(uint32_t pObjectFile,uint64_t pBuiltDefines,const FileIDVec& pFiles)
+{
+	if( pBuiltDefines == mDefinesHash )
+		return false;
+
+	IdentifierVec macros;
+	if( GetChangedMacros(pBuiltDefines,macros) == false )
+		return true;
+
+	// The system headers can look at the project's defines too, GLM_FORCE_RADIANS or GTK_DISABLE_DEPRECATED, so they are read as well.
+	FileIDVec files = pFiles;
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		ObjectDependencyMap::const_iterator found = mObjectDependencies.find(pObjectFile);
+		if( found == mObjectDependencies.end() )
+			return true;
+		files.insert(files.end(),found->second.mSystemFiles.begin(),found->second.mSystemFiles.end());
+	}
+
+	IdentifierVec identifiers;
+	for( uint32_t file : files )
+	{
+		if( GetIdentifiersFromFile(file,identifiers) == false || std::binary_search(identifiers.begin(),identifiers.end(),TOKEN_PASTE) )
+			return true;
+
+		for( uint32_t macro : macros )
+		{
+			if( std::binary_search(identifiers.begin(),identifiers.end(),macro) )
+				return true;
+		}
+	}
+
+	// None of the macros that changed are used, so it would come out the same. Next time it's checked against these defines.
+	std::lock_guard<std::mutex> lock(mLock);
+	mObjectCommands[pObjectFile].mDefines = mDefinesHash;
+	mCacheDirty = true;
+	mNumDefinesNotUsed++;
+	return false;
+}
+
+bool Dependencies::GetChangedMacros(uint64_t pBuiltDefines,IdentifierVec& rMacros)
+{
+	StringVec builtDefines;
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		DefineSetMap::const_iterator found = mDefineSets.find(pBuiltDefines);
+		if( found == mDefineSets.end() )
+			return false;
+		builtDefines = found->second;
+	}
+
+	// A define that is in one and not the other has been added, removed or given a different value.
+	const StringSet before(builtDefines.begin(),builtDefines.end());
+	const StringSet after(mDefines.begin(),mDefines.end());
+	StringSet changed;
+	std::string name,value;
+	for( const std::string& define : builtDefines )
+	{
+		if( after.count(define) == 0 )
+		{
+			if( GetMacroName(define,name,value) == false )
+				return false;
+			changed.insert(name);
+		}
+	}
+	for( const std::string& define : mDefines )
+	{
+		if( before.count(define) == 0 )
+		{
+			if( GetMacroName(define,name,value) == false )
+				return false;
+			changed.insert(name);
+		}
+	}
+
+	// A define with a changed macro in its value changes too, BAR=FOO when FOO changes. Go round till nothing more is added.
+	StringVec allDefines = builtDefines;
+	allDefines.insert(allDefines.end(),mDefines.begin(),mDefines.end());
+	bool added = true;
+	while( added )
+	{
+		added = false;
+		for( const std::string& define : allDefines )
+		{
+			if( GetMacroName(define,name,value) == false )
+				return false;
+
+			bool usesChanged = false;
+			FindIdentifiers(value.data(),value.size(),[&changed,&usesChanged](const char* pName,size_t pLength)
+			{
+				usesChanged = usesChanged || changed.count(std::string(pName,pLength)) > 0;
+			});
+
+			if( usesChanged && changed.insert(name).second )
+				added = true;
+		}
+	}
+
+	rMacros.clear();
+	for( const std::string& macro : changed )
+	{
+		// Names starting with _ are for the compiler and C library, _FORTIFY_SOURCE can change what is built without a header naming it. NDEBUG is treated the same to be safe.
+		if( macro[0] == '_' || macro == "NDEBUG" )
+			return false;
+		rMacros.push_back(HashIdentifier(macro.data(),macro.size()));
+	}
+	return true;
+}
+
+bool Dependencies::GetIdentifiersFromFile(uint32_t pFile,IdentifierVec& rIdentifiers)
+{
+	// Done the same way as GetIncludesFromFile, the lock is never held while reading the file.
+	std::string filename;
+	timespec cachedTime = {0,0};
+	bool haveCached = false;
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		FileNode& node = mFiles[pFile];
+		if( node.mFlags & IDENTIFIERS_KNOWN )
+		{
+			rIdentifiers.assign(mIdentifiers.begin() + node.mFirstIdentifier,mIdentifiers.begin() + node.mFirstIdentifier + node.mNumIdentifiers);
+			return true;
+		}
+
+		if( node.mFlags & IDENTIFIERS_CACHED )
+		{
+			cachedTime = node.mIdentifiersTime;
+			haveCached = true;
+			node.mFlags &= ~IDENTIFIERS_CACHED;
+		}
+
+		filename.assign(mPaths.GetPath(pFile),mPaths.GetLength(pFile));
+	}
+
+	timespec FileTime = {0,0};
+	if( GetFileTime(pFile,FileTime) == false )
+		return false;
+
+	if( haveCached && FileTime.tv_sec == cachedTime.tv_sec && FileTime.tv_nsec == cachedTime.tv_nsec )
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		FileNode& node = mFiles[pFile];
+		node.mFlags |= IDENTIFIERS_KNOWN;
+		rIdentifiers.assign(mIdentifiers.begin() + node.mFirstIdentifier,mIdentifiers.begin() + node.mFirstIdentifier + node.mNumIdentifiers);
+		return true;
+	}
+
+	FileContents file;
+	if( file.Open(filename) == false )
+		return false;
+
+	rIdentifiers.clear();
+	FindIdentifiers(file.mData,file.mSize,[&rIdentifiers](const char* pName,size_t pLength)
+	{
+		rIdentifiers.push_back(HashIdentifier(pName,pLength));
+	});
+	std::sort(rIdentifiers.begin(),rIdentifiers.end());
+	rIdentifiers.erase(std::unique(rIdentifiers.begin(),rIdentifiers.end()),rIdentifiers.end());
+
+	std::lock_guard<std::mutex> lock(mLock);
+	FileNode& node = mFiles[pFile];
+	node.mFirstIdentifier = (uint32_t)mIdentifiers.size();
+	node.mNumIdentifiers = (uint32_t)rIdentifiers.size();
+	node.mIdentifiersTime = FileTime;
+	node.mFlags |= IDENTIFIERS_KNOWN;
+	mIdentifiers.insert(mIdentifiers.end(),rIdentifiers.begin(),rIdentifiers.end());
+	mCacheDirty = true;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+#ifdef DEBUG_BUILD
+// Only built into the debug build, it's the only one that runs them and in the others the helpers only used by the asserts would be unused.
+namespace{
+StringVec FindIncludes(const std::string& pText)
+{
+	StringVec found;
+	FindIncludeDirectives(pText.data(),pText.size(),[&found](const char* pInclude,size_t pLength)
+	{
+		found.push_back(std::string(pInclude,pLength));
+	});
+	return found;
+}
+
+// Writes the text to a file in /tmp that no other test or appbuild will use, the caller removes it.
+std::string WriteTestFile(const std::string& pName,const std::string& pText)
+{
+	const std::string filename = GetTemporaryFilename("/tmp/appbuild_" + pName);
+	std::ofstream(filename) << pText;
+	return filename;
+}
+};
+
+bool DoDependenciesUnitTests()
+{
+	assert( FindIncludes("#include \"a.h\"\n#include <b.h>\n") == StringVec({"a.h","b.h"}) );
+	assert( FindIncludes("#  include \"a.h\"") == StringVec({"a.h"}) );
+	assert( FindIncludes("  #\tinclude <a.h>\r\n") == StringVec({"a.h"}) );
+	assert( FindIncludes("#include_next <a.h>\n") == StringVec({"a.h"}) );
+	assert( FindIncludes("int a = 1; # include <a.h>\n#include <b.h>") == StringVec({"b.h"}) );
+
+	// Comments.
+	assert( FindIncludes("// #include \"a.h\"\n").size() == 0 );
+	assert( FindIncludes("/* #include \"a.h\" */\n").size() == 0 );
+	assert( FindIncludes("#define A 1 // #include \"a.h\"\n").size() == 0 );
+
+	// Continuation lines.
+	assert( FindIncludes("#include \\\n \"a.h\"\n") == StringVec({"a.h"}) );
+	assert( FindIncludes("#include \\\r\n <a.h>\r\n") == StringVec({"a.h"}) );
+	assert( FindIncludes("# \\\ninclude \"a.h\"\n") == StringVec({"a.h"}) );
+	assert( FindIncludes("// A comment \\\n#include \"a.h\"\n").size() == 0 );
+	assert( FindIncludes("#include\n\"a.h\"\n").size() == 0 );
+
+	// Not finished.
+	assert( FindIncludes("#include \"a.h").size() == 0 );
+	assert( FindIncludes("#include \"\"").size() == 0 );
+	assert( FindIncludes("#include").size() == 0 );
+	assert( FindIncludes("#").size() == 0 );
+
+	// Depfiles as the compiler writes them, a space in a name is '\ ' and a $ is '$$'.
+	auto ParseDepfile = [](const std::string& pText,StringVec& rFiles)
+	{
+		const std::string depfile = WriteTestFile("unit_test.d",pText);
+		rFiles.clear();
+		const bool ok = Dependencies::ParseDepfile(depfile,rFiles);
+		remove(depfile.c_str());
+		return ok;
+	};
+
+	StringVec files;
+	assert( ParseDepfile("out/a.o: a.cpp a.h\n",files) && files == StringVec({"a.cpp","a.h"}) );
+	assert( ParseDepfile("out/a.o: a.cpp \\\n  b.h \\\r\n  /usr/include/stdio.h\n",files) && files == StringVec({"a.cpp","b.h","/usr/include/stdio.h"}) );
+	assert( ParseDepfile("out/my\\ file.o: my\\ file.cpp cost$$.h \\#hash.h\n",files) && files == StringVec({"my file.cpp","cost$.h","#hash.h"}) );
+	assert( ParseDepfile("a.o: C:\\src\\a.cpp\n",files) && files == StringVec({"C:\\src\\a.cpp"}) );
+	assert( ParseDepfile("a.o:\n",files) == false );
+	assert( ParseDepfile("",files) == false );
+	assert( Dependencies::ParseDepfile("/tmp/appbuild_no_such_file.d",files) == false );
+
+	// The macros that changed between the defines an object was built with and the current ones.
+	auto ChangedMacros = [](const StringVec& pBuilt,const StringVec& pNow,Dependencies::IdentifierVec& rMacros)
+	{
+		Dependencies deps(false);
+		deps.SetDefines(pBuilt);
+		const uint64_t built = deps.mDefinesHash;
+		deps.SetDefines(pNow);
+		const bool known = deps.GetChangedMacros(built,rMacros);
+		std::sort(rMacros.begin(),rMacros.end());
+		return known;
+	};
+	auto Macros = [](const StringVec& pNames)
+	{
+		Dependencies::IdentifierVec macros;
+		for( const std::string& name : pNames )
+			macros.push_back(HashIdentifier(name.data(),name.size()));
+		std::sort(macros.begin(),macros.end());
+		return macros;
+	};
+
+	Dependencies::IdentifierVec macros;
+	assert( ChangedMacros({"A=1","B"},{"A=1","B"},macros) && macros.size() == 0 );
+	assert( ChangedMacros({"A=1","B"},{"A=2","B"},macros) && macros == Macros({"A"}) );
+	assert( ChangedMacros({"A=1"},{"A=1","B"},macros) && macros == Macros({"B"}) );
+	assert( ChangedMacros({"A=1","B"},{"A=1"},macros) && macros == Macros({"B"}) );
+	assert( ChangedMacros({"A=1"},{"A"},macros) && macros == Macros({"A"}) );
+	assert( ChangedMacros({"F(x)=x"},{"F(x)=x+1"},macros) && macros == Macros({"F"}) );
+	assert( ChangedMacros({"A=1","B=A+1","C=B","D=2"},{"A=2","B=A+1","C=B","D=2"},macros) && macros == Macros({"A","B","C"}) );
+
+	// Names that can't be looked for, or that the compiler and C library look at without a header naming them, mean a rebuild.
+	assert( ChangedMacros({"A=1"},{"A=1","1A"},macros) == false );
+	assert( ChangedMacros({"A=1"},{"A=1","A-B=1"},macros) == false );
+	assert( ChangedMacros({"A=1","NDEBUG"},{"A=1"},macros) == false );
+	assert( ChangedMacros({"_FORTIFY_SOURCE=1"},{"_FORTIFY_SOURCE=2"},macros) == false );
+	{
+		Dependencies deps(false);
+		assert( deps.GetChangedMacros(HashString("Never set"),macros) == false );
+	}
+
+	// Only an object built from a file that has a changed macro in it, or a ## that could make one, needs building again.
+	auto DefinesChangeFile = [](const std::string& pText)
+	{
+		const std::string source = WriteTestFile("unit_test.cpp",pText);
+		Dependencies deps(false);
+		deps.SetDefines({"A=1","B=2"});
+		const uint64_t built = deps.mDefinesHash;
+		deps.SetDefines({"A=2","B=2"});
+
+		uint32_t object;
+		Dependencies::FileIDVec files;
+		{
+			std::lock_guard<std::mutex> lock(deps.mLock);
+			object = deps.InternPath(source + ".o");
+			files.push_back(deps.InternPath(source));
+			deps.mObjectDependencies[object].mObjectTime = {0,0};
+		}
+		const bool changed = deps.DefinesChangeObject(object,built,files);
+		remove(source.c_str());
+		return changed;
+	};
+	assert( DefinesChangeFile("int a = A;\n") == true );
+	assert( DefinesChangeFile("int b = B; // AB\n") == false );
+	assert( DefinesChangeFile("#define NAME(x) x##1\nint b = NAME(B);\n") == true );
+
+	std::cout << "Unit tests for dependencies source file passed.\n";
+	return true;
+}
+#endif
+
 //////////////////////////////////////////////////////////////////////////
 };//namespace appbuild
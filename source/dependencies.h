@@ -21,8 +21,11 @@
 #include <stdint.h>
 #include <functional>
 #include <unordered_map>
+#include <mutex>
+#include <vector>
 
 #include "string_types.h"
+#include "path_table.h"
 
 namespace appbuild{
 //////////////////////////////////////////////////////////////////////////
@@ -30,40 +33,347 @@ namespace appbuild{
 class Dependencies
 {
 public:
-	Dependencies();
+	/**
+	 * @param pUseContentHash If true an input file that is newer than the object only causes a rebuild if its contents are different to when the object was built.
+	 * Only works for objects that were built with a compiler depfile, as that is when the hashes are recorded.
+	 */
+	Dependencies(bool pUseContentHash);
+
+	// Returns true if the object file date is older than the source file or any of it's dependencies, or it was built with a different command.
+	// Safe to call from many threads at once, the file IO for different source files will overlap.
+	// pCommandHash is a hash of the compiler and all of its arguments but the defines, see SetObjectCommand and SetDefines.
+	bool RequiresRebuild(const std::string& pSourceFile,const std::string& pObjectFile,const StringVec& pIncludePaths,uint64_t pCommandHash);
+
+	/**
+	 * @brief Records the command the object is being built with, so the next build only rebuilds it if the command it would use is different.
+	 * Call when the compile task is made, the old object has been deleted by then so if the compile does not finish it's rebuilt anyway.
+	 * The defines set by SetDefines are recorded with it.
+	 * Safe to call from many threads.
+	 * 
+	 * @param pObjectFile The object file.
+	 * @param pCommandHash The hash of the compiler and its arguments.
+	 */
+	void SetObjectCommand(const std::string& pObjectFile,uint64_t pCommandHash);
 
-	// Returns true if the object file date is older than the source file or any of it's dependencies.
-	bool RequiresRebuild(const std::string& pSourceFile,const std::string& pObjectFile,const StringVec& pIncludePaths);
+	/**
+	 * @brief Sets the defines of the configuration, the -D args. They are not part of the command hash, they are checked on their own.
+	 * When they are different to the ones an object was built with, the object is only rebuilt if a file it was built from has one of the
+	 * macros that changed in it. A define whose value uses a changed macro counts as changed too.
+	 * The files are the ones in the compiler's depfile, the system headers included.
+	 * If we can't be sure the object is rebuilt. That is when a file it was built from uses ## so a name can be made that is not in the file,
+	 * when the name of a changed macro starts with an _ or is NDEBUG, as the compiler itself may act on those, or when there is no depfile
+	 * for the object so we don't know what it was built from.
+	 * Not thread safe, call before any dependency checks are started.
+	 * 
+	 * @param pDefines Each is NAME, NAME=value or NAME(args)=value.
+	 */
+	void SetDefines(const StringVec& pDefines);
 
 	/**
 	 * @brief Adds a generic file to the list of file dates to be tested against.
-	 * This is used for the project file, if there is one, and maybe some embedded resource files.
+	 * For files that change what is built without the compiler reading them, maybe some embedded resource files. Not the project file, the command each object is built with is checked instead.
 	 * 
 	 * @param pPathedFileName Full path to the file, the file is NOT parsed in anyway. If it's date is younger than the object file being tested a rebuild will be triggered.
 	 */
 	void AddGenericFileDependency(const std::string& pPathedFileName);
 
+	/**
+	 * @brief Sets the include paths that hold system headers, headers found in these are not checked or scanned.
+	 * They only change when the toolchain or a package is updated, so instead of looking at hundreds of headers a stamp of those versions is checked.
+	 * Not thread safe, call before any dependency checks are started.
+	 * 
+	 * @param pSystemIncludePaths The paths, each ending in a '/'.
+	 * @param pSystemStamp A hash of the toolchain and package versions. If it is different to the one in the cache every object is rebuilt.
+	 */
+	void SetSystemIncludes(const StringVec& pSystemIncludePaths,uint64_t pSystemStamp);
+
+	/**
+	 * @brief Call once every object has been built against the current system stamp, only then is it written to the cache.
+	 * If the build fails part way the old stamp is kept so the objects that were not rebuilt still will be next time.
+	 */
+	void AcceptSystemStamp(){mCachedSystemStamp = mSystemStamp;}
+
+	/**
+	 * @brief Loads the include graph saved by a previous build so that files that have not changed do not need to be scanned again.
+	 * The file is memory mapped and the entries are only used if the file's modification time still matches the one recorded.
+	 * 
+	 * @param pCacheFilename The pathed file name of the cache, normally in the output folder of the configuration being built.
+	 * @return true The cache was loaded.
+	 * @return false The cache was not there or was not valid, not an error, everything will just be scanned.
+	 * Not thread safe, call before any dependency checks are started.
+	 */
+	bool LoadCache(const std::string& pCacheFilename);
+
+	/**
+	 * @brief Writes the include graph out so the next build can skip scanning files that have not changed.
+	 * Does nothing if nothing new was scanned since the cache was loaded.
+	 * 
+	 * @param pCacheFilename The pathed file name of the cache.
+	 * @return true The cache is up to date on disk.
+	 * @return false Failed to write the file.
+	 * Not thread safe, call once all the dependency checks have finished.
+	 */
+	bool SaveCache(const std::string& pCacheFilename);
+
+	/**
+	 * @brief Reads the depfile the compiler wrote (-MD -MF) for an object file that has just been built.
+	 * These are the files the compiler really opened, so on the next build they are used for the object instead of scanning for includes.
+	 * What it says is kept in the dependency cache, the caller can delete the depfile once this returns.
+	 * Safe to call from many threads, compile tasks call this as they finish.
+	 * 
+	 * @param pDepfile The depfile the compiler wrote.
+	 * @param pObjectFile The object file that was built, its modification time is recorded so we know the entry is for this build of it.
+	 * @param pCompileStartTime When the compile started. When hashing contents a file modified after this may not be what the compiler read, so it's not hashed.
+	 * @return true The depfile was read.
+	 * @return false It was not there or could not be understood, the object will be checked by scanning for includes next time.
+	 */
+	bool ReadDepfile(const std::string& pDepfile,const std::string& pObjectFile,const timespec& pCompileStartTime);
+
+	/**
+	 * @brief Pulls the prerequisites out of a make style depfile, deals with line continuations and escaped spaces.
+	 */
+	static bool ParseDepfile(const std::string& pDepfile,StringVec& rFiles);
+
+	/**
+	 * @brief Reads the names in the #include lines of the file, as written between the quotes or angle brackets.
+	 * Only lines that start with the # count, '# include' is allowed and backslash new lines are followed.
+	 */
+	static bool ScanFileForIncludeNames(const std::string& pFilename,StringVec& rNames);
+
+	/**
+	 * @brief How many files the source file is known to include, for estimating how long it will take to compile.
+	 * What the compiler read last time if we have its depfile, else the includes found by scanning the source file. Zero if neither is known.
+	 */
+	size_t GetNumIncludes(const std::string& pSourceFile,const std::string& pObjectFile);
+
+	/**
+	 * @brief The number of files that had their includes read from the cache instead of being scanned.
+	 */
+	size_t GetNumCacheHits()const{return mNumCacheHits;}
+
+	/**
+	 * @brief The number of object files that were checked using what the compiler told us last time, no scanning needed.
+	 */
+	size_t GetNumDepfileHits()const{return mNumDepfileHits;}
+
+	/**
+	 * @brief The number of files that were newer than their object but had the same contents, so did not cause a rebuild.
+	 */
+	size_t GetNumUnchangedContents()const{return mNumUnchangedContents;}
+
+	/**
+	 * @brief The number of object files built with different defines that were not rebuilt, as none of the macros that changed are in the files they were built from.
+	 */
+	size_t GetNumDefinesNotUsed()const{return mNumDefinesNotUsed;}
+
+	/**
+	 * @brief The number of different files the dependency checks know about and the memory used to hold their names.
+	 */
+	size_t GetNumFiles()const{return mPaths.GetCount();}
+	size_t GetPathMemory()const{return mPaths.GetArenaSize();}
+
 private:
-	bool CheckSourceDependencies(const std::string& pSourceFile,const timespec& pObjFileTime,const StringVec& pIncludePaths);
-	bool GetFileTime(const std::string& pFilename,timespec& rFileTime);
-	bool FileYoungerThanObjectFile(const std::string& pFilename,const timespec& pObjFileTime);
+	friend bool DoDependenciesUnitTests();
+
+	struct NewestTime
+	{
+		timespec mTime;		//!< The modification time of the youngest file in the include closure of the file.
+		bool mMissing;		//!< True if a file in the closure could not be found or read, this always causes a rebuild.
+	};
+
+	typedef std::vector<uint32_t> FileIDVec;
+	typedef std::vector<uint32_t> IdentifierVec;	//!< The hashes of identifiers, a collision just means an object is rebuilt that did not need to be.
+
+	/**
+	 * @brief State used while walking the include graph to find the strongly connected components, Tarjan's algorithm.
+	 * Headers can include each other, so all the files in a loop share the same newest time.
+	 */
+	struct GraphWalk
+	{
+		struct Visit
+		{
+			int mIndex;
+			int mLowLink;
+			bool mOnStack;
+			NewestTime mNewest;	//!< Newest of this file and the files it includes that were completed, merged for the whole loop when it's popped.
+		};
+		std::unordered_map<uint32_t,Visit> mVisited;
+		FileIDVec mStack;
+		int mNextIndex = 0;
+	};
+
+	/**
+	 * @brief Gets the newest modification time of the file and everything it includes, directly or indirectly.
+	 * The result is remembered for every file visited so a header included by many source files is only ever walked once per build.
+	 */
+	NewestTime GetNewestTime(uint32_t pFile,const StringVec& pIncludePaths);
+
+	/**
+	 * @brief Reads the includes of the file and everything they include, that has not already been read, so the graph walk can be done without any file IO.
+	 */
+	void ScanIncludeClosure(uint32_t pSourceFile,const StringVec& pIncludePaths);
+	void WalkIncludeGraph(uint32_t pFile,const StringVec& pIncludePaths,GraphWalk& rWalk);
+	bool GetKnownNewest(uint32_t pFile,NewestTime& rNewest);
+	void MergeNewest(NewestTime& rNewest,const NewestTime& pOther)const;
+	bool GetFileTime(uint32_t pFile,timespec& rFileTime);
+	bool FileYoungerThanObjectFile(uint32_t pFile,const timespec& pObjFileTime);
 	bool FileYoungerThanObjectFile(const timespec& pOtherTime,const timespec& pObjFileTime)const;
-	bool GetIncludesFromFile(const std::string& pFilename,const StringVec& pIncludePaths,StringSet& rIncludes);
+	bool GetIncludesFromFile(uint32_t pFile,const StringVec& pIncludePaths,FileIDVec& rIncludes);
+
+	/**
+	 * @brief Finds each name on the include paths, the first path that has it wins. A name that is not found is left out, as is a system header.
+	 */
+	void ResolveIncludeNames(const StringVec& pNames,const StringVec& pIncludePaths,StringSet& rIncludes)const;
+
+	/**
+	 * @brief When the object was built with different defines, checks if any of the macros that changed are in the files it was built from, the system headers in its depfile included.
+	 * @return true The object must be rebuilt, a macro that changed is used or we can't tell. If false the object is recorded as built with the current defines.
+	 */
+	bool DefinesChangeObject(uint32_t pObjectFile,uint64_t pBuiltDefines,const FileIDVec& pFiles);
+
+	/**
+	 * @brief Gets the hashes of the names of the macros that are different between the defines the object was built with and the current ones.
+	 * @return false We don't know the old defines, or one of the names can't be checked for, see SetDefines.
+	 */
+	bool GetChangedMacros(uint64_t pBuiltDefines,IdentifierVec& rMacros);
+
+	/**
+	 * @brief Gets the hashes of every identifier in the file, sorted, read from the file the first time it's needed and kept in the cache.
+	 * A ## in the file is recorded as TOKEN_PASTE.
+	 */
+	bool GetIdentifiersFromFile(uint32_t pFile,IdentifierVec& rIdentifiers);
+
+	/**
+	 * @brief Gets the id of the path, adding it to mPaths and mFiles if it's new. Caller must hold mLock.
+	 */
+	uint32_t InternPath(const std::string& pPath);
+
+	/**
+	 * @brief Sets the includes of a file, they are added to the end of mIncludes. Caller must hold mLock.
+	 */
+	void SetIncludes(uint32_t pFile,const FileIDVec& pIncludes);
+	void SetIncludeNames(uint32_t pFile,const StringVec& pNames);
+
+	struct InputFile
+	{
+		uint32_t mFile;
+		timespec mFileTime;		//!< The modification time of the file when it was hashed.
+		uint64_t mHash;			//!< The hash of the contents when the object was built, zero if not known.
+	};
+	typedef std::vector<InputFile> InputFileVec;
+
+	/**
+	 * @brief Gets the files the compiler said the object was built from, only if the object has not changed since.
+	 */
+	bool GetObjectDependencies(uint32_t pObjectFile,const timespec& pObjFileTime,InputFileVec& rFiles);
+
+	/**
+	 * @brief Checks a file the object was built from, if it is younger than the object and we are using content hashes then the contents are checked too.
+	 */
+	bool InputFileChanged(uint32_t pObjectFile,const InputFile& pInput,const timespec& pObjFileTime);
+
+	/**
+	 * @brief Hashes the file, each file is only hashed once per build.
+	 * @param pFileTime The modification time the file has now, if the file has changed since it was last hashed it is hashed again.
+	 */
+	bool GetFileHash(uint32_t pFile,const timespec& pFileTime,uint64_t& rHash);
+
+	/**
+	 * @brief True if the file is in one of the system include paths.
+	 */
+	bool IsSystemFile(const std::string& pFilename)const;
 
 	typedef struct stat FileStats;
 	typedef std::unordered_map<std::string,timespec> FileTimeMap;
-	typedef std::unordered_map<std::string,StringSet> DependencyMap;
-	typedef std::unordered_map<std::string,bool> FileState;	// True if it is out of date and thus the source file needs building, false it is not. If not found we have not checked it yet.
 
+	enum FileFlags
+	{
+		FILE_TIME_KNOWN = 1,	//!< mFileTime has been read this build.
+		INCLUDES_KNOWN = 2,		//!< The includes have been scanned, or taken from the cache, this build.
+		INCLUDES_CACHED = 4,	//!< The includes are from the cache file and not yet checked against the file, mIncludesTime is when they were scanned.
+		NEWEST_KNOWN = 8,		//!< mNewest has been worked out by a graph walk.
+		IDENTIFIERS_KNOWN = 16,	//!< The identifiers have been read, or taken from the cache, this build.
+		IDENTIFIERS_CACHED = 32	//!< The identifiers are from the cache file and not yet checked against the file, mIdentifiersTime is when they were read.
+	};
+
+	/**
+	 * @brief Everything we know about a file, indexed by the file's id in mPaths.
+	 * A file's includes are a run of ids in mIncludes, so the whole graph is two flat arrays and nothing is copied as a set of strings.
+	 * The names it includes, as written between the quotes, are kept too so they can be found again on the include paths without reading the file.
+	 */
+	struct FileNode
+	{
+		uint32_t mFirstInclude;
+		uint32_t mNumIncludes;
+		uint32_t mFirstIncludeName;	//!< A run in mIncludeNames, like the includes.
+		uint32_t mNumIncludeNames;
+		uint32_t mFlags;
+		timespec mFileTime;
+		timespec mIncludesTime;	//!< The modification time of the file when its includes were found, written to the cache.
+		NewestTime mNewest;
+		uint32_t mFirstIdentifier;	//!< A run in mIdentifiers, like the includes. Only read when the defines change.
+		uint32_t mNumIdentifiers;
+		timespec mIdentifiersTime;
+	};
+
+	struct ObjectDependencies
+	{
+		timespec mObjectTime;	//!< The modification time of the object when the depfile was read. If it differs the object was built some other way and this is ignored.
+		InputFileVec mFiles;	//!< Every file the compiler read to make the object, the source file included.
+		FileIDVec mSystemFiles;	//!< The system headers it read, not checked for changes, see SetDefines.
+	};
 
-	DependencyMap mDependencies;
-	FileTimeMap mFileTimes;
-	FileState mFileDependencyState;
-	FileState mFileCheckedState;
+	struct FileHash
+	{
+		timespec mFileTime;
+		uint64_t mHash;
+	};
+	typedef std::unordered_map<uint32_t,FileHash> FileHashMap;
+	typedef std::unordered_map<uint32_t,ObjectDependencies> ObjectDependencyMap;
+	struct ObjectCommand
+	{
+		uint64_t mCommand;		//!< The hash of the compiler and its arguments, but the defines.
+		uint64_t mDefines;		//!< The hash of the defines, the key in mDefineSets.
+	};
+	typedef std::unordered_map<uint32_t,ObjectCommand> ObjectCommandMap;
+	typedef std::unordered_map<uint64_t,StringVec> DefineSetMap;
+
+
+	PathTable mPaths;				//!< Every file name we have seen, everything else refers to files by their id in here.
+	std::vector<FileNode> mFiles;	//!< Indexed by id, grows as mPaths does.
+	FileIDVec mIncludes;			//!< The include graph, see FileNode. Only ever added to, a file scanned again just gets a new run.
+	PathTable mNames;				//!< The names in the #include lines of the files, not paths to files so they don't get a FileNode.
+	FileIDVec mIncludeNames;		//!< The ids in mNames of what each file includes, see FileNode. Only ever added to.
+	IdentifierVec mIdentifiers;		//!< The identifiers in each file, see FileNode. Only ever added to.
 
 	FileTimeMap mGenericFileDependencies;	//!< A list of files who's dates are checked against the object file, and if younger will ask for a rebuild of the source file. This is a separate list so we can explcity check these files.
+
+	ObjectDependencyMap mObjectDependencies;	//!< From the compiler's depfiles, keyed by object file. Loaded from and saved to the cache file.
+	ObjectCommandMap mObjectCommands;			//!< The hash of the command each object was built with, keyed by object file. Loaded from and saved to the cache file.
+	DefineSetMap mDefineSets;					//!< The defines objects were built with, keyed by their hash. So when they change we can see what changed.
+	StringVec mDefines;							//!< The defines of this build, see SetDefines.
+	uint64_t mDefinesHash;
+	FileHashMap mFileHashes;					//!< The files hashed this build.
+	const bool mUseContentHash;
+	uint64_t mCachedIncludePathsHash;			//!< The include paths used to resolve the headers in the cache, if they change the cache is thrown away.
+	uint64_t mIncludePathsHash;					//!< The include paths used this build.
+	StringVec mSystemIncludePaths;				//!< Headers in these are not checked, see SetSystemIncludes.
+	uint64_t mSystemStamp;						//!< The toolchain and package versions of this build.
+	uint64_t mCachedSystemStamp;				//!< What the objects were built against, zero if not known. Written to the cache.
+	uint64_t mSavedSystemStamp;					//!< What is in the cache file on disk, so we know if it needs writing.
+	bool mCacheDirty;							//!< Set when a file is scanned so we know the cache needs writing.
+	size_t mNumCacheHits;
+	size_t mNumDepfileHits;
+	size_t mNumUnchangedContents;
+	size_t mNumDefinesNotUsed;
+
+	std::mutex mLock;		//!< Guards all of the above, it is never held while doing file IO.
+	std::mutex mWalkLock;	//!< Only one thread at a time walks the include graph, held for the walk, the walk only writes the newest times.
 };
 
+//////////////////////////////////////////////////////////////////////////
+bool DoDependenciesUnitTests();
+
 //////////////////////////////////////////////////////////////////////////
 };//namespace appbuild
 
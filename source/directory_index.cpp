@@ -0,0 +1,176 @@
+/*
+   Copyright (C) 2017, Richard e Collins.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <dirent.h>
+#include <assert.h>
+
+#include "directory_index.h"
+#include "misc.h"
+
+namespace appbuild{
+//////////////////////////////////////////////////////////////////////////
+DirectoryIndex& DirectoryIndex::Get()
+{
+	static DirectoryIndex sDirectoryIndex;
+	return sDirectoryIndex;
+}
+
+DirectoryIndex::DirectoryIndex():
+	mNumLookups(0),
+	mNumStatsAvoided(0),
+	mNumDirectoriesRead(0)
+{
+}
+
+bool DirectoryIndex::FindFile(const std::string& pPathedFilename)
+{
+	switch( Lookup(pPathedFilename) )
+	{
+	case ENTRY_FILE:
+		mNumStatsAvoided++;
+		return true;
+
+	case ENTRY_NOT_FOUND:
+	case ENTRY_DIRECTORY:
+		mNumStatsAvoided++;
+		return false;
+
+	case ENTRY_UNKNOWN:
+		break;
+	}
+	return appbuild::FileExists(pPathedFilename);
+}
+
+bool DirectoryIndex::FileExists(const std::string& pPathedFilename)
+{
+	if( Lookup(pPathedFilename) == ENTRY_FILE )
+	{
+		mNumStatsAvoided++;
+		return true;
+	}
+	// May have been written since the folder was read, so check.
+	return appbuild::FileExists(pPathedFilename);
+}
+
+bool DirectoryIndex::DirectoryExists(const std::string& pPath)
+{
+	// Had and issue where a path had an odd char at the end of it. So do this to make sure it's clean.
+	const std::string clean(TrimWhiteSpace(pPath));
+	if( Lookup(clean) == ENTRY_DIRECTORY )
+	{
+		mNumStatsAvoided++;
+		return true;
+	}
+	return appbuild::DirectoryExists(clean);
+}
+
+void DirectoryIndex::AddDirectory(const std::string& pPath)
+{
+	std::string path = pPath;
+	while( path.size() > 1 && path.back() == '/' )
+		path.pop_back();
+
+	std::lock_guard<std::mutex> lock(mLock);
+	SetEntry(path,ENTRY_DIRECTORY);
+
+	// It's new so we know it's empty, no need to read it. May have been read before it was made, when it could not be opened.
+	std::unique_ptr<EntryMap>& listing = mDirectories[path + "/"];
+	if( !listing )
+	{
+		listing.reset(new EntryMap);
+	}
+}
+
+void DirectoryIndex::AddFile(const std::string& pPathedFilename)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	SetEntry(pPathedFilename,ENTRY_FILE);
+}
+
+void DirectoryIndex::SetEntry(const std::string& pPath,eEntryType pType)
+{
+	const size_t slash = pPath.rfind('/');
+	const std::string folder = slash == std::string::npos ? "" : pPath.substr(0,slash+1);
+	const std::string name = slash == std::string::npos ? pPath : pPath.substr(slash+1);
+
+	// If the folder has not been read yet the file will be in the listing when it is.
+	DirectoryMap::iterator found = mDirectories.find(folder);
+	if( found != mDirectories.end() && found->second )
+	{
+		(*found->second)[name] = pType;
+	}
+}
+
+DirectoryIndex::eEntryType DirectoryIndex::Lookup(const std::string& pPath)
+{
+	mNumLookups++;
+
+	std::string path = pPath;
+	while( path.size() > 1 && path.back() == '/' )
+		path.pop_back();
+
+	const size_t slash = path.rfind('/');
+	const std::string folder = slash == std::string::npos ? "" : path.substr(0,slash+1);
+	const std::string name = slash == std::string::npos ? path : path.substr(slash+1);
+	if( name.size() == 0 || name == "." || name == ".." )
+		return ENTRY_UNKNOWN;// Leave the odd ones to stat.
+
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		DirectoryMap::const_iterator found = mDirectories.find(folder);
+		if( found != mDirectories.end() )
+		{
+			if( !found->second )
+				return ENTRY_NOT_FOUND;
+
+			EntryMap::const_iterator entry = found->second->find(name);
+			return entry == found->second->end() ? ENTRY_NOT_FOUND : entry->second;
+		}
+	}
+
+	// First time in this folder, read it without the lock held. Worst case two threads read the same folder.
+	std::unique_ptr<EntryMap> entries;
+	DIR* dir = opendir(folder.size() > 0 ? folder.c_str() : ".");
+	if( dir )
+	{
+		entries.reset(new EntryMap);
+		for( struct dirent* ent = readdir(dir) ; ent != nullptr ; ent = readdir(dir) )
+		{
+			eEntryType type = ENTRY_UNKNOWN;
+			if( ent->d_type == DT_REG )
+				type = ENTRY_FILE;
+			else if( ent->d_type == DT_DIR )
+				type = ENTRY_DIRECTORY;
+			(*entries)[ent->d_name] = type;
+		}
+		closedir(dir);
+	}
+	mNumDirectoriesRead++;
+
+	std::lock_guard<std::mutex> lock(mLock);
+	std::unique_ptr<EntryMap>& listing = mDirectories[folder];
+	if( !listing )
+		listing = std::move(entries);
+
+	if( !listing )
+		return ENTRY_NOT_FOUND;
+
+	EntryMap::const_iterator entry = listing->find(name);
+	return entry == listing->end() ? ENTRY_NOT_FOUND : entry->second;
+}
+
+//////////////////////////////////////////////////////////////////////////
+};//namespace appbuild
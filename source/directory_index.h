@@ -0,0 +1,112 @@
+/*
+   Copyright (C) 2017, Richard e Collins.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef __DIRECTORY_INDEX_H__
+#define __DIRECTORY_INDEX_H__
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "string_types.h"
+
+namespace appbuild{
+//////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Answers 'is this file there' from a listing of its folder, one listing per folder instead of a stat per question.
+ * Resolving an include tries every search path in turn, almost all of those fail, with 30 include paths that is thousands of failing stat calls.
+ * A folder is read the first time something in it is asked about and is then kept for the life of the process.
+ * So it does not see files written after the folder was read unless it's told, everything appbuild writes that could be included,
+ * the build stamp header and the resource sources, is added with AddFile and every folder it makes with AddDirectory.
+ * FileExists and DirectoryExists here only trust a listing that says yes, a no is checked with a stat.
+ * Safe to use from many threads.
+ */
+class DirectoryIndex
+{
+public:
+	static DirectoryIndex& Get();
+
+	/**
+	 * @brief Returns true if the file is there and is a regular file, the listing is trusted either way. Used for resolving includes.
+	 */
+	bool FindFile(const std::string& pPathedFilename);
+
+	/**
+	 * @brief Same as the FileExists in misc.h, but if the listing has the file no stat is needed.
+	 */
+	bool FileExists(const std::string& pPathedFilename);
+
+	/**
+	 * @brief Same as the DirectoryExists in misc.h, but if the listing has the folder no stat is needed.
+	 */
+	bool DirectoryExists(const std::string& pPath);
+
+	/**
+	 * @brief Call after making a folder so the listings know about it.
+	 */
+	void AddDirectory(const std::string& pPath);
+
+	/**
+	 * @brief Call after writing a file so FindFile sees it if its folder has already been read.
+	 */
+	void AddFile(const std::string& pPathedFilename);
+
+	size_t GetNumLookups()const{return mNumLookups;}
+	size_t GetNumStatsAvoided()const{return mNumStatsAvoided;}
+	size_t GetNumDirectoriesRead()const{return mNumDirectoriesRead;}
+
+	/**
+	 * @brief Roughly the number of system calls saved, the stat calls not made less the calls used to read the folders.
+	 */
+	long GetNumSyscallsSaved()const{return (long)mNumStatsAvoided - (long)mNumDirectoriesRead * 3;}
+
+private:
+	enum eEntryType
+	{
+		ENTRY_NOT_FOUND,
+		ENTRY_FILE,
+		ENTRY_DIRECTORY,
+		ENTRY_UNKNOWN	//!< A link or a file system that does not say, needs a stat to find out.
+	};
+
+	typedef std::unordered_map<std::string,eEntryType> EntryMap;
+	typedef std::unordered_map<std::string,std::unique_ptr<EntryMap>> DirectoryMap;	// A null entry map means the folder could not be read.
+
+	DirectoryIndex();
+
+	/**
+	 * @brief Looks the name up in the listing of the folder it is in. Reads the folder if this is the first time it's been asked about.
+	 */
+	eEntryType Lookup(const std::string& pPath);
+
+	/**
+	 * @brief Sets the type of the entry in its folder's listing, if the folder has been read. Caller must hold mLock.
+	 */
+	void SetEntry(const std::string& pPath,eEntryType pType);
+
+	std::mutex mLock;	//!< Guards mDirectories, not held while reading a folder.
+	DirectoryMap mDirectories;	//!< Keyed by the folder path as given, with a trailing '/'.
+
+	std::atomic<size_t> mNumLookups;
+	std::atomic<size_t> mNumStatsAvoided;
+	std::atomic<size_t> mNumDirectoriesRead;
+};
+
+//////////////////////////////////////////////////////////////////////////
+};//namespace appbuild
+
+#endif //#ifndef __DIRECTORY_INDEX_H__
@@ -0,0 +1,244 @@
+/*
+   Copyright (C) 2017, Richard e Collins.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+#include "misc.h"
+#include "link_stamp.h"
+
+namespace appbuild{
+//////////////////////////////////////////////////////////////////////////
+LinkStamp::LinkStamp(const std::string& pTarget,const std::string& pTool,const StringVec& pArguments,const StringVec& pInputFiles):
+	mTarget(pTarget),
+	mStampFilename(pTarget + ".linkstamp"),
+	mNumUnchanged(0)
+{
+	mCommand = HashString(pTool);
+	for( const std::string& arg : pArguments )
+	{
+		mCommand = HashString(arg + "\n",mCommand);
+	}
+
+	// The tool is found on the path the same way execvp does, if it's been updated we make the target again.
+	const std::string toolFile = FindCommandInPath(pTool);
+
+	struct stat Stats;
+	if( stat(toolFile.c_str(),&Stats) == 0 )
+	{
+		mCommand = HashData(&Stats.st_mtim,sizeof(Stats.st_mtim),mCommand);
+		mCommand = HashData(&Stats.st_size,sizeof(Stats.st_size),mCommand);
+	}
+
+	// The contents are only hashed when we know we need them, most of the time the modification time is enough.
+	mInputs.reserve(pInputFiles.size());
+	for( const std::string& file : pInputFiles )
+	{
+		Input input;
+		input.mFilename = file;
+		input.mModified = {0,0};
+		input.mSize = -1;
+		input.mHash = 0;
+		if( stat(file.c_str(),&Stats) == 0 )
+		{
+			input.mModified = Stats.st_mtim;
+			input.mSize = (int64_t)Stats.st_size;
+		}
+		mInputs.push_back(input);
+	}
+}
+
+bool LinkStamp::GetIsUpToDate()
+{
+	uint64_t savedCommand = 0;
+	std::vector<Input> savedInputs;
+	const bool loaded = Load(savedCommand,savedInputs);
+
+	std::unordered_map<std::string,const Input*> saved;
+	for( const Input& input : savedInputs )
+	{
+		saved[input.mFilename] = &input;
+	}
+
+	// Every input is given its hash, even if we already know the target is out of date, as they are needed when the stamp is saved.
+	bool same = loaded && FileExists(mTarget) && savedCommand == mCommand && savedInputs.size() == mInputs.size();
+	bool restat = false;
+	for( Input& input : mInputs )
+	{
+		const auto found = saved.find(input.mFilename);
+		const Input* last = found != saved.end() ? found->second : nullptr;
+		if( last && last->mSize == input.mSize && last->mModified.tv_sec == input.mModified.tv_sec && last->mModified.tv_nsec == input.mModified.tv_nsec )
+		{
+			input.mHash = last->mHash;
+		}
+		else
+		{
+			if( input.mSize < 0 || !HashFile(input.mFilename,input.mHash) )
+				input.mHash = 0;
+
+			if( last && last->mHash == input.mHash && input.mHash != 0 )
+			{
+				mNumUnchanged++;
+				restat = true;
+			}
+			else
+			{
+				same = false;
+			}
+		}
+	}
+
+	if( same && restat )
+	{
+		Save();
+	}
+	return same;
+}
+
+uint64_t LinkStamp::GetContentKey()const
+{
+	uint64_t key = mCommand;
+	for( const Input& input : mInputs )
+	{
+		if( input.mHash == 0 )
+			return 0;
+		key = HashData(&input.mHash,sizeof(input.mHash),key);
+	}
+	return key;
+}
+
+bool LinkStamp::Save()const
+{
+	std::ofstream file(mStampFilename,std::ofstream::trunc);
+	if( !file.is_open() )
+		return false;
+
+	// The filename is last as it may have spaces.
+	file << std::hex << mCommand << '\n';
+	for( const Input& input : mInputs )
+	{
+		file << std::hex << input.mHash << std::dec << ' ' << (int64_t)input.mModified.tv_sec << ' ' << (int64_t)input.mModified.tv_nsec << ' ' << input.mSize << ' ' << input.mFilename << '\n';
+	}
+
+	file.close();
+	return !!file;
+}
+
+void LinkStamp::Remove()const
+{
+	remove(mStampFilename.c_str());
+}
+
+bool LinkStamp::Load(uint64_t& rCommand,std::vector<Input>& rInputs)const
+{
+	std::ifstream file(mStampFilename);
+	if( !file.is_open() )
+		return false;
+
+	std::string line;
+	if( !std::getline(file,line) || !(std::istringstream(line) >> std::hex >> rCommand) )
+		return false;
+
+	while( std::getline(file,line) )
+	{
+		std::istringstream fields(line);
+		Input input;
+		int64_t seconds,nanoseconds;
+		if( !(fields >> std::hex >> input.mHash >> std::dec >> seconds >> nanoseconds >> input.mSize) || !std::getline(fields >> std::ws,input.mFilename) )
+			return false;
+
+		input.mModified.tv_sec = (time_t)seconds;
+		input.mModified.tv_nsec = (long)nanoseconds;
+		rInputs.push_back(input);
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+#ifdef DEBUG_BUILD
+// Only built into the debug build, it's the only one that runs them and in the others the values only used by the asserts would be unused.
+bool DoLinkStampUnitTests()
+{
+	// Files in /tmp that no other test or appbuild will use, one with a space in its name as that is what the stamp has last on each line.
+	const std::string target = GetTemporaryFilename("/tmp/appbuild_unit_test.a");
+	const StringVec inputs = {GetTemporaryFilename("/tmp/appbuild_unit_test_one.o"),GetTemporaryFilename("/tmp/appbuild unit test two.o")};
+	std::ofstream(target) << "target";
+	std::ofstream(inputs[0]) << "one";
+	std::ofstream(inputs[1]) << "two";
+
+	LinkStamp first(target,"ar",{"rcs",target},inputs);
+	assert( first.GetIsUpToDate() == false );
+	assert( first.GetContentKey() != 0 );
+	assert( first.Save() );
+
+	// What is loaded is what was saved.
+	uint64_t command = 0;
+	std::vector<LinkStamp::Input> loaded;
+	assert( first.Load(command,loaded) );
+	assert( command == first.mCommand );
+	assert( loaded.size() == first.mInputs.size() );
+	for( size_t n = 0 ; n < loaded.size() ; n++ )
+	{
+		assert( loaded[n].mFilename == first.mInputs[n].mFilename );
+		assert( loaded[n].mModified.tv_sec == first.mInputs[n].mModified.tv_sec );
+		assert( loaded[n].mModified.tv_nsec == first.mInputs[n].mModified.tv_nsec );
+		assert( loaded[n].mSize == first.mInputs[n].mSize );
+		assert( loaded[n].mHash == first.mInputs[n].mHash && loaded[n].mHash != 0 );
+	}
+
+	LinkStamp same(target,"ar",{"rcs",target},inputs);
+	assert( same.GetIsUpToDate() == true );
+	assert( same.GetContentKey() == first.GetContentKey() );
+
+	LinkStamp otherArgs(target,"ar",{"rc",target},inputs);
+	assert( otherArgs.GetIsUpToDate() == false );
+
+	// Given a new time but the same contents it's still up to date, as an object rebuilt after a comment only edit is.
+	const timespec newTime[2] = {{0,UTIME_NOW},{1000000000,0}};
+	assert( utimensat(AT_FDCWD,inputs[0].c_str(),newTime,0) == 0 );
+	LinkStamp touched(target,"ar",{"rcs",target},inputs);
+	assert( touched.GetIsUpToDate() == true );
+	assert( touched.GetNumUnchanged() == 1 );
+
+	std::ofstream(inputs[1]) << "changed";
+	LinkStamp edited(target,"ar",{"rcs",target},inputs);
+	assert( edited.GetIsUpToDate() == false );
+	assert( edited.GetContentKey() != first.GetContentKey() );
+
+	edited.Remove();
+	LinkStamp removed(target,"ar",{"rcs",target},inputs);
+	assert( removed.Load(command,loaded) == false );
+
+	remove(target.c_str());
+	remove(inputs[0].c_str());
+	remove(inputs[1].c_str());
+
+	std::cout << "Unit tests for link stamp source file passed.\n";
+	return true;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+};//namespace appbuild
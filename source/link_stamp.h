@@ -0,0 +1,95 @@
+/*
+   Copyright (C) 2017, Richard e Collins.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#ifndef __LINK_STAMP_H__
+#define __LINK_STAMP_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+#include "string_types.h"
+
+namespace appbuild{
+//////////////////////////////////////////////////////////////////////////
+/**
+ * @brief What a linked or archived target was made from, saved next to it in a .linkstamp file so the next build can skip making it again.
+ * Holds a hash of the tool and its arguments and, for each input file, its size, modification time and a hash of its contents.
+ * An input with a new modification time is hashed, if the contents are the same as last time it has not changed. Like ninja's restat.
+ * So an object rebuilt after a comment only edit, or a library archived again from the same objects, does not cause a link.
+ */
+class LinkStamp
+{
+public:
+	/**
+	 * @param pTarget The file being made, the stamp is saved next to it.
+	 * @param pTool The linker or archiver. If it's been updated the target is made again.
+	 * @param pArguments Everything passed to the tool.
+	 * @param pInputFiles The files the tool reads, the object files and the libraries of the projects we depend on.
+	 */
+	LinkStamp(const std::string& pTarget,const std::string& pTool,const StringVec& pArguments,const StringVec& pInputFiles);
+
+	/**
+	 * @brief True if the target is there and it was made with the same arguments from inputs with the same contents.
+	 * If it is, and some inputs only had their modification times changed, the stamp is saved again with the new times so they are not hashed next time.
+	 */
+	bool GetIsUpToDate();
+
+	/**
+	 * @brief Call when the target has been made. If making it failed call Remove instead so it's made again next time.
+	 */
+	bool Save()const;
+	void Remove()const;
+
+	/**
+	 * @brief A hash of the command and the contents of the inputs, the same for any build that would make the same target. Zero if an input is missing.
+	 * Only valid after GetIsUpToDate, that is what hashes the inputs.
+	 */
+	uint64_t GetContentKey()const;
+
+	/**
+	 * @brief How many inputs were newer than last time but had the same contents.
+	 */
+	size_t GetNumUnchanged()const{return mNumUnchanged;}
+
+private:
+	friend bool DoLinkStampUnitTests();
+
+	struct Input
+	{
+		std::string mFilename;
+		timespec mModified;
+		int64_t mSize;
+		uint64_t mHash;		//!< Zero if the file is missing.
+	};
+
+	bool Load(uint64_t& rCommand,std::vector<Input>& rInputs)const;
+
+	const std::string mTarget;
+	const std::string mStampFilename;
+	uint64_t mCommand;
+	std::vector<Input> mInputs;
+	size_t mNumUnchanged;
+};
+
+//////////////////////////////////////////////////////////////////////////
+bool DoLinkStampUnitTests();
+
+//////////////////////////////////////////////////////////////////////////
+};//namespace appbuild
+
+#endif //#ifndef __LINK_STAMP_H__
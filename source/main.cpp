@@ -19,8 +19,11 @@
 #include "string_types.h"
 #include "project.h"
 #include "misc.h"
+#include "dependencies.h"
 #include "new_project.h"
 #include "logging.h"
+#include "object_cache.h"
+#include "remote_cache.h"
 
 #include <iostream>
 #include <fstream>
@@ -73,10 +76,9 @@ static int BuildProjectFile(const std::string& a_ProjectFilename,appbuild::Comma
 	const std::string projectPath = appbuild::GetPath(a_ProjectFilename);
 
 	if( verbose ){std::cout << "Creating the project from file " << a_ProjectFilename << "\n";}
-	appbuild::Project TheProject(projectRoot,a_ProjectFilename,projectPath,a_Args.GetNumThreads(),a_Args.GetLoggingMode(),a_Args.GetReBuild(),a_Args.GetTruncateOutput());
+	appbuild::Project TheProject(projectRoot,a_ProjectFilename,projectPath,a_Args.GetNumThreads(),a_Args.GetLoggingMode(),a_Args.GetReBuild(),a_Args.GetTruncateOutput(),a_Args.GetContentHash(),a_Args.GetFailFast());
 	if( TheProject )
 	{
-		TheProject.AddGenericFileDependency(a_ProjectFilename);
 		if( a_Args.GetInteractiveMode() )
 		{
 			if( a_Args.ProcessInteractiveMode(TheProject) == false )
@@ -108,11 +110,14 @@ static int BuildProjectFile(const std::string& a_ProjectFilename,appbuild::Comma
 		else if( configname.size() > 0 )
 		{
 			const std::chrono::system_clock::time_point build_start = std::chrono::system_clock::now();
+			const double build_start_cpu = appbuild::GetThreadCPUTime();
 			if( TheProject.Build(configname) )
 			{
 				if( a_Args.GetTimeBuild() )
 				{
 					std::cout << "Build took: " << appbuild::GetTimeDifference(build_start,std::chrono::system_clock::now()) << std::endl;
+					// Should be tiny, it only hands out the work. If it's not then it's taking cpu from the compilers.
+					std::cout << "Main thread cpu time: " << (int)((appbuild::GetThreadCPUTime() - build_start_cpu) * 1000.0) << "ms" << std::endl;
 				}
 
 				if( a_Args.GetRunAfterBuild() )
@@ -160,6 +165,10 @@ int main(int argc, char *argv[])
 
     std::cout << std::endl << "Runtime debug only unit tests.\n";
 	assert( appbuild::DoMiscUnitTests() );
+	assert( appbuild::DoDependenciesUnitTests() );
+	assert( appbuild::DoLinkStampUnitTests() );
+	assert( appbuild::DoObjectCacheUnitTests() );
+	assert( appbuild::DoRemoteCacheUnitTests() );
 	std::cout << std::endl;
 	std::cout << std::endl;
 
@@ -189,20 +198,60 @@ int main(int argc, char *argv[])
 			Args.PrintProjectSchema();
 		}
 	}
+	else if( Args.GetRunCacheServer() )
+	{
+		return appbuild::RunCacheServer(Args.GetCacheServerPort(),Args.GetObjectCacheFolder() + "remote/",Args.GetLoggingMode());
+	}
 	else if (Args.GetCreateNewProject() )
 	{
 		return appbuild::CreateNewProject(Args.GetNewProjectName(),Args.GetLoggingMode());
 	}
 	else if( Args.GetProjectFiles().size() > 0 )
 	{
+		appbuild::ObjectCache& objectCache = appbuild::ObjectCache::Get();
+		if( Args.GetObjectCache() && objectCache.Enable(Args.GetObjectCacheFolder(),Args.GetObjectCacheSize()) == false )
+		{
+			std::cout << "Could not make the object cache folder " << Args.GetObjectCacheFolder() << ", building without it\n";
+		}
+		else if( Args.GetRemoteCache().size() > 0 && objectCache.EnableRemote(Args.GetRemoteCache()) == false )
+		{
+			std::cout << "The remote cache " << Args.GetRemoteCache() << " is not a http:// location or a folder, building without it\n";
+		}
+
+		if( objectCache.GetIsEnabled() && Args.GetCacheBaseDir().size() > 0 && objectCache.SetBaseFolder(Args.GetCacheBaseDir()) == false )
+		{
+			std::cout << "The cache base folder " << Args.GetCacheBaseDir() << " was not found, paths will not be made relative to it\n";
+		}
+
+		int result = EXIT_SUCCESS;
 		for(const std::string& file : Args.GetProjectFiles() )
 		{
 			if( BuildProjectFile(file,Args) == EXIT_FAILURE )
 			{
 				Args.PrintGetHelp();
-				return EXIT_FAILURE;
+				result = EXIT_FAILURE;
+				break;
+			}
+		}
+
+		// Saved even if the build failed, the objects that did build are in the cache.
+		if( objectCache.GetIsEnabled() )
+		{
+			objectCache.Save();
+			if( Args.GetLoggingMode() >= appbuild::LOG_VERBOSE )
+			{
+				std::cout << "Object cache " << objectCache.GetFolder() << ": " << objectCache.GetNumHits() << " hits, " << objectCache.GetNumMisses() << " misses, "
+					<< objectCache.GetNumStored() << " objects stored. " << objectCache.GetTotalHits() << " hits and " << objectCache.GetTotalMisses() << " misses in all builds, "
+					<< objectCache.GetSize() / (1024*1024) << "MB of " << objectCache.GetMaxSize() / (1024*1024) << "MB used\n";
+				const appbuild::RemoteCache* remote = objectCache.GetRemote();
+				if( remote )
+				{
+					std::cout << "Remote cache " << remote->GetLocation() << ": " << objectCache.GetNumRemoteHits() << " of the hits were from it, "
+						<< remote->GetNumDownloaded() << " files downloaded and " << remote->GetNumUploaded() << " uploaded" << (remote->GetHasFailed() ? ", it failed and was not used for all of the build\n" : "\n");
+				}
 			}
 		}
+		return result;
 	}
 	else
 	{
@@ -15,15 +15,23 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <iostream>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <dirent.h>
 #include <algorithm>
 #include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <thread>
+#include <functional>
 
 #include "misc.h"
+#include "directory_index.h"
 
 
 namespace appbuild{
@@ -58,14 +66,16 @@ bool MakeDir(const std::string& pPath)
         CurrentPath += seperator;
         CurrentPath += path;
         seperator = "/";
-        if(DirectoryExists(CurrentPath) == false)
+        if(DirectoryIndex::Get().DirectoryExists(CurrentPath) == false)
         {
-            if( mkdir(CurrentPath.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) != 0 )
+            // EEXIST, another thread beat us to it.
+            if( mkdir(CurrentPath.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) != 0 && errno != EEXIST )
             {
                 std::cout << "Making folders failed for " << pPath << std::endl;
                 std::cout << "Failed AT " << path << std::endl;
                 return false;
             }
+            DirectoryIndex::Get().AddDirectory(CurrentPath);
         }
     }
     return true;
@@ -400,6 +410,21 @@ std::string GetTimeString(const char* pFormat)
     return buf;
 }
 
+std::string GetBuildTimeString(const char* pFormat)
+{
+    const char* epoch = getenv("SOURCE_DATE_EPOCH");
+    if( epoch == nullptr || strlen(epoch) == 0 )
+        return GetTimeString(pFormat);
+
+    // The spec says the time is UTC, so the same value gives the same text wherever it's built.
+    const time_t when = (time_t)strtoll(epoch,nullptr,10);
+    struct tm  tstruct;
+    char       buf[128];
+    gmtime_r(&when,&tstruct);
+    strftime(buf, sizeof(buf), pFormat, &tstruct);
+    return buf;
+}
+
 std::string GetTimeDifference(const std::chrono::system_clock::time_point& pStart,const std::chrono::system_clock::time_point& pEnd)
 {
     assert( pStart <= pEnd );
@@ -439,6 +464,104 @@ std::string GetTimeDifference(const std::chrono::system_clock::time_point& pStar
     return time;
 }
 
+double GetThreadCPUTime()
+{
+    timespec time;
+    if( clock_gettime(CLOCK_THREAD_CPUTIME_ID,&time) != 0 )
+        return 0.0;
+    return (double)time.tv_sec + ((double)time.tv_nsec / 1000000000.0);
+}
+
+uint64_t HashData(const void* pData,size_t pSize,uint64_t pHash)
+{
+    const uint8_t* bytes = (const uint8_t*)pData;
+    for( size_t n = 0 ; n < pSize ; n++ )
+    {
+        pHash ^= bytes[n];
+        pHash *= 1099511628211ULL;
+    }
+    return pHash;
+}
+
+bool HashFile(const std::string& pFilename,uint64_t& rHash)
+{
+    const int file = open(pFilename.c_str(),O_RDONLY);
+    if( file < 0 )
+        return false;
+
+    uint64_t hash = HashData(nullptr,0);
+    char buffer[64*1024];
+    ssize_t bytesRead;
+    while( (bytesRead = read(file,buffer,sizeof(buffer))) > 0 )
+    {
+        hash = HashData(buffer,bytesRead,hash);
+    }
+    close(file);
+
+    if( bytesRead < 0 )
+        return false;
+
+    rHash = hash;
+    return true;
+}
+
+std::string FindCommandInPath(const std::string& pCommand)
+{
+    if( pCommand.find('/') != std::string::npos )
+        return pCommand;
+
+    const char* path = getenv("PATH");
+    for( const std::string& dir : SplitString(path ? path : "/usr/bin:/bin",":") )
+    {
+        const std::string file = dir + "/" + pCommand;
+        if( access(file.c_str(),X_OK) == 0 )
+            return file;
+    }
+    return pCommand;
+}
+
+std::string GetTemporaryFilename(const std::string& pFilename)
+{
+    return pFilename + ".tmp" + std::to_string(getpid()) + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+}
+
+bool CopyFile(const std::string& pSource,const std::string& pDestination)
+{
+    const int source = open(pSource.c_str(),O_RDONLY);
+    if( source < 0 )
+        return false;
+
+    const std::string temp = GetTemporaryFilename(pDestination);
+    const int dest = open(temp.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if( dest < 0 )
+    {
+        close(source);
+        return false;
+    }
+
+    bool ok = true;
+    char buffer[64*1024];
+    ssize_t bytesRead;
+    while( ok && (bytesRead = read(source,buffer,sizeof(buffer))) > 0 )
+    {
+        for( ssize_t done = 0 ; ok && done < bytesRead ; )
+        {
+            const ssize_t written = write(dest,buffer + done,bytesRead - done);
+            ok = written > 0;
+            done += written;
+        }
+    }
+    ok = ok && bytesRead == 0;
+    close(source);
+    ok = close(dest) == 0 && ok;
+
+    if( ok && rename(temp.c_str(),pDestination.c_str()) == 0 )
+        return true;
+
+    remove(temp.c_str());
+    return false;
+}
+
 //////////////////////////////////////////////////////////////////////////
 bool DoMiscUnitTests()
 {
@@ -461,6 +584,10 @@ bool DoMiscUnitTests()
     assert( GetExtension("test").size() == 0 );
     assert( GetExtension("test.bmp.jpeg") == "jpeg" );
 
+    assert( HashString("") == 14695981039346656037ULL );
+    assert( HashString("a") == 0xaf63dc4c8601ec8cULL );
+    assert( HashString("b",HashString("a")) == HashString("ab") );
+
 
     std::cout << "Unit tests for misc source file passed.\n";
     return true;
@@ -131,8 +131,64 @@ std::string TrimWhiteSpace(const std::string &s);
 // for more information about date/time format
 std::string GetTimeString(const char* pFormat = "%d-%m-%Y %X");
 
+/**
+ * @brief The same as GetTimeString but for the time stamped into a build. If SOURCE_DATE_EPOCH is set that is used, in UTC, so the build can be reproduced.
+ * See https://reproducible-builds.org/specs/source-date-epoch/
+ */
+std::string GetBuildTimeString(const char* pFormat);
+
 std::string GetTimeDifference(const std::chrono::system_clock::time_point& pStart,const std::chrono::system_clock::time_point& pEnd);
 
+/**
+ * @brief The cpu time the calling thread has used so far, in seconds.
+ */
+double GetThreadCPUTime();
+
+/**
+ * @brief A fast none cryptographic hash, FNV-1a 64bit.
+ * Used for cache keys and stamps so that we can tell if something has changed, NOT for security!
+ * 
+ * @param pData The memory to hash.
+ * @param pSize Number of bytes to hash.
+ * @param pHash The hash to continue from, allows hashing of data in parts.
+ * @return uint64_t 
+ */
+uint64_t HashData(const void* pData,size_t pSize,uint64_t pHash = 14695981039346656037ULL);
+inline uint64_t HashString(const std::string& pString,uint64_t pHash = 14695981039346656037ULL){return HashData(pString.data(),pString.size(),pHash);}
+
+/**
+ * @brief Hashes the contents of a file with HashData.
+ * 
+ * @param pFilename The file to read.
+ * @param rHash The hash of the contents.
+ * @return true The file was read.
+ * @return false The file could not be opened or read.
+ */
+bool HashFile(const std::string& pFilename,uint64_t& rHash);
+
+/**
+ * @brief Finds the command on the PATH the same way execvp does.
+ * 
+ * @param pCommand The command, if it has a '/' in it, it is returned as is.
+ * @return std::string The pathed file of the command or the command as passed in if it was not found.
+ */
+std::string FindCommandInPath(const std::string& pCommand);
+
+/**
+ * @brief A name next to the file to write it to first, then rename it to the file, so no one sees a part written file.
+ * Unique to this process and thread, two builds sharing a folder could be writing the same file.
+ */
+std::string GetTemporaryFilename(const std::string& pFilename);
+
+/**
+ * @brief Copies the file, writing to a temporary file first that is then renamed.
+ * So another process, or another appbuild, never sees part of the file.
+ * 
+ * @return true The file was copied.
+ * @return false Failed to read the source or write the destination, nothing is left at the destination.
+ */
+bool CopyFile(const std::string& pSource,const std::string& pDestination);
+
 
 //////////////////////////////////////////////////////////////////////////
 bool DoMiscUnitTests();
@@ -0,0 +1,723 @@
+/*
+   Copyright (C) 2017, Richard e Collins.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+#include "misc.h"
+#include "object_cache.h"
+#include "remote_cache.h"
+
+namespace appbuild{
+//////////////////////////////////////////////////////////////////////////
+
+// Change if the format of the cache changes or an object made by this version could differ to one made by the last for the same key.
+static const char* CACHE_VERSION = "appbuild-object-cache-2";
+
+// How many different sets of inputs are kept for one command, a header being edited back and forth or two branches.
+static const size_t MAX_MANIFEST_ENTRIES = 8;
+
+// When the cache is over its size it's trimmed to this much of it, so it's not trimmed again on the next build.
+static const uint64_t TRIM_PERCENT = 90;
+
+static std::string ToHex(uint64_t pValue)
+{
+	char hex[17];
+	snprintf(hex,sizeof(hex),"%016llx",(unsigned long long)pValue);
+	return hex;
+}
+
+// As the compiler writes them in a depfile, so Dependencies::ParseDepfile reads them back the same.
+static std::string EscapeDepfileName(const std::string& pFilename)
+{
+	std::string escaped;
+	for( char c : pFilename )
+	{
+		if( c == ' ' || c == '#' )
+			escaped += '\\';
+		else if( c == '$' )
+			escaped += '$';
+		escaped += c;
+	}
+	return escaped;
+}
+
+ObjectCache& ObjectCache::Get()
+{
+	static ObjectCache TheCache;
+	return TheCache;
+}
+
+ObjectCache::ObjectCache():
+	mEnabled(false),
+	mMaxSize(0),
+	mNumHits(0),
+	mNumMisses(0),
+	mNumStored(0),
+	mBytesStored(0),
+	mNumRemoteHits(0),
+	mTotalHits(0),
+	mTotalMisses(0),
+	mSize(0),
+	mSavedHits(0),
+	mSavedMisses(0),
+	mSavedBytes(0)
+{
+}
+
+ObjectCache::~ObjectCache()
+{
+}
+
+bool ObjectCache::Enable(const std::string& pFolder,uint64_t pMaxSize)
+{
+	mFolder = pFolder;
+	if( mFolder.size() == 0 || mFolder.back() != '/' )
+		mFolder += '/';
+
+	mMaxSize = pMaxSize;
+	mWorkingFolder = GetCurrentWorkingDirectory() + "/";
+	mEnabled = MakeDir(mFolder);
+	return mEnabled;
+}
+
+bool ObjectCache::SetBaseFolder(const std::string& pFolder)
+{
+	char realPath[PATH_MAX];
+	if( realpath(pFolder.c_str(),realPath) == nullptr )
+		return false;
+
+	mBaseFolder = realPath;
+	if( mBaseFolder.back() != '/' )
+		mBaseFolder += '/';
+	return true;
+}
+
+bool ObjectCache::EnableRemote(const std::string& pLocation)
+{
+	std::unique_ptr<CacheBackend> backend = CacheBackend::Create(pLocation);
+	if( !mEnabled || !backend )
+		return false;
+
+	mRemote.reset(new RemoteCache(std::move(backend)));
+	return true;
+}
+
+bool ObjectCache::Fetch(const std::string& pCommand,const StringVec& pArgs,const std::string& pObjectFile,const std::string& pDepfile,std::string& rOutput)
+{
+	if( !mEnabled )
+		return false;
+
+	// What is found in the remote cache is added to ours, then it's used the same as if it had been there.
+	const uint64_t commandKey = GetCommandKey(pCommand,pArgs);
+	if( FetchLocal(commandKey,pObjectFile,pDepfile,rOutput) || (mRemote && FetchRemote(commandKey) && FetchLocal(commandKey,pObjectFile,pDepfile,rOutput)) )
+	{
+		mNumHits++;
+		return true;
+	}
+
+	mNumMisses++;
+	return false;
+}
+
+bool ObjectCache::Store(const std::string& pCommand,const StringVec& pArgs,const std::string& pObjectFile,const StringVec& pInputFiles,const std::string& pOutput,const timespec& pCompileStartTime)
+{
+	if( !mEnabled )
+		return false;
+
+	const uint64_t commandKey = GetCommandKey(pCommand,pArgs);
+	ManifestEntry entry;
+	entry.mObject = commandKey;
+	for( const std::string& file : pInputFiles )
+	{
+		uint64_t hash;
+		timespec modified;
+		if( !GetFileHash(file,hash,modified) )
+			return false;
+
+		if( modified.tv_sec > pCompileStartTime.tv_sec || (modified.tv_sec == pCompileStartTime.tv_sec && modified.tv_nsec >= pCompileStartTime.tv_nsec) )
+			return false;
+
+		entry.mInputs.push_back({hash,file});
+		entry.mObject = HashString(GetStoredPath(file) + "\n",HashData(&hash,sizeof(hash),entry.mObject));
+	}
+
+	const std::string cachedObject = GetBlobFilename(entry.mObject,".o");
+	if( !AddBlob(pObjectFile,cachedObject) )
+		return false;
+
+	if( pOutput.size() > 0 )
+	{
+		std::ofstream output(cachedObject + ".txt",std::ofstream::trunc);
+		output << pOutput;
+	}
+
+	const std::string manifestFile = GetManifestFilename(commandKey);
+	if( !AddToManifest(manifestFile,entry) )
+		return false;
+
+	// The object first, someone that gets the manifest can then get the object.
+	if( mRemote )
+	{
+		mRemote->Upload(GetFileName(cachedObject),cachedObject);
+		if( pOutput.size() > 0 )
+			mRemote->Upload(GetFileName(cachedObject + ".txt"),cachedObject + ".txt");
+		mRemote->Upload(GetFileName(manifestFile),manifestFile,[this,manifestFile](const std::string& pRemoteFile,const std::string& pMergedFile)
+		{
+			return MergeManifest(manifestFile,pRemoteFile,pMergedFile);
+		});
+	}
+
+	mNumStored++;
+	return true;
+}
+
+bool ObjectCache::FetchArchive(uint64_t pKey,const std::string& pTarget)
+{
+	if( !mEnabled || pKey == 0 )
+		return false;
+
+	const std::string cachedArchive = GetBlobFilename(pKey,".a");
+	if( CopyFile(cachedArchive,pTarget) ||
+		(mRemote && MakeDir(GetPath(cachedArchive)) && mRemote->Download(GetFileName(cachedArchive),cachedArchive) && AddBlobSize(cachedArchive) && CopyFile(cachedArchive,pTarget)) )
+	{
+		utimensat(AT_FDCWD,cachedArchive.c_str(),nullptr,0);
+		mNumHits++;
+		return true;
+	}
+
+	mNumMisses++;
+	return false;
+}
+
+bool ObjectCache::StoreArchive(uint64_t pKey,const std::string& pTarget)
+{
+	if( !mEnabled || pKey == 0 )
+		return false;
+
+	const std::string cachedArchive = GetBlobFilename(pKey,".a");
+	if( !AddBlob(pTarget,cachedArchive) )
+		return false;
+
+	if( mRemote )
+		mRemote->Upload(GetFileName(cachedArchive),cachedArchive);
+
+	mNumStored++;
+	return true;
+}
+
+bool ObjectCache::FetchLocal(uint64_t pCommandKey,const std::string& pObjectFile,const std::string& pDepfile,std::string& rOutput)
+{
+	const std::string manifestFile = GetManifestFilename(pCommandKey);
+	ManifestEntryVec entries;
+	if( !LoadManifest(manifestFile,entries) )
+		return false;
+
+	for( const ManifestEntry& entry : entries )
+	{
+		if( !GetIsUpToDate(entry) )
+			continue;
+
+		// It may have been trimmed by another build, if so it's a miss.
+		const std::string cachedObject = GetBlobFilename(entry.mObject,".o");
+		if( !CopyFile(cachedObject,pObjectFile) )
+			return false;
+
+		std::ofstream depfile(pDepfile,std::ofstream::trunc);
+		depfile << EscapeDepfileName(pObjectFile) << ":";
+		for( const auto& input : entry.mInputs )
+		{
+			depfile << " \\\n " << EscapeDepfileName(input.second);
+		}
+		depfile << '\n';
+		depfile.close();
+		if( !depfile )
+		{
+			remove(pObjectFile.c_str());
+			return false;
+		}
+
+		std::ifstream output(cachedObject + ".txt");
+		if( output.is_open() )
+		{
+			rOutput.assign((std::istreambuf_iterator<char>(output)),std::istreambuf_iterator<char>());
+		}
+
+		// Used now, so it's the last to be trimmed.
+		utimensat(AT_FDCWD,cachedObject.c_str(),nullptr,0);
+		utimensat(AT_FDCWD,manifestFile.c_str(),nullptr,0);
+		return true;
+	}
+	return false;
+}
+
+bool ObjectCache::FetchRemote(uint64_t pCommandKey)
+{
+	const std::string manifestFile = GetManifestFilename(pCommandKey);
+	const std::string remoteManifest = GetTemporaryFilename(manifestFile);
+	if( !MakeDir(GetPath(manifestFile)) || !mRemote->Download(GetFileName(manifestFile),remoteManifest) )
+		return false;
+
+	ManifestEntryVec entries;
+	LoadManifest(remoteManifest,entries);
+	remove(remoteManifest.c_str());
+
+	for( const ManifestEntry& entry : entries )
+	{
+		if( !GetIsUpToDate(entry) )
+			continue;
+
+		const std::string cachedObject = GetBlobFilename(entry.mObject,".o");
+		if( !MakeDir(GetPath(cachedObject)) || !mRemote->Download(GetFileName(cachedObject),cachedObject) )
+			return false;
+
+		// Only there if the compiler printed something, so not finding it is fine.
+		mRemote->Download(GetFileName(cachedObject + ".txt"),cachedObject + ".txt");
+		AddBlobSize(cachedObject);
+		mNumRemoteHits++;
+		return AddToManifest(manifestFile,entry);
+	}
+	return false;
+}
+
+bool ObjectCache::GetIsUpToDate(const ManifestEntry& pEntry)
+{
+	for( const auto& input : pEntry.mInputs )
+	{
+		uint64_t hash;
+		timespec modified;
+		if( !GetFileHash(input.second,hash,modified) || hash != input.first )
+			return false;
+	}
+	return pEntry.mInputs.size() > 0;
+}
+
+bool ObjectCache::AddBlob(const std::string& pFilename,const std::string& pBlobFilename)
+{
+	return MakeDir(GetPath(pBlobFilename)) && CopyFile(pFilename,pBlobFilename) && AddBlobSize(pBlobFilename);
+}
+
+bool ObjectCache::AddBlobSize(const std::string& pBlobFilename)
+{
+	struct stat Stats;
+	if( stat(pBlobFilename.c_str(),&Stats) != 0 )
+		return false;
+
+	mBytesStored += (uint64_t)Stats.st_size;
+	return true;
+}
+
+bool ObjectCache::AddToManifest(const std::string& pManifestFile,const ManifestEntry& pEntry)
+{
+	// The newest goes first, it's the most likely to be asked for again.
+	ManifestEntryVec entries;
+	LoadManifest(pManifestFile,entries);
+	entries.erase(std::remove_if(entries.begin(),entries.end(),[&pEntry](const ManifestEntry& pOther){return pOther.mObject == pEntry.mObject;}),entries.end());
+	entries.insert(entries.begin(),pEntry);
+	if( entries.size() > MAX_MANIFEST_ENTRIES )
+		entries.resize(MAX_MANIFEST_ENTRIES);
+
+	return MakeDir(GetPath(pManifestFile)) && SaveManifest(pManifestFile,entries);
+}
+
+bool ObjectCache::MergeManifest(const std::string& pManifestFile,const std::string& pRemoteFile,const std::string& pMergedFile)const
+{
+	ManifestEntryVec entries,remoteEntries;
+	if( !LoadManifest(pManifestFile,entries) )
+		return false;
+
+	// One that can't be read is replaced, what could be read of it is kept.
+	if( pRemoteFile.size() > 0 )
+		LoadManifest(pRemoteFile,remoteEntries);
+
+	for( const ManifestEntry& remote : remoteEntries )
+	{
+		if( std::none_of(entries.begin(),entries.end(),[&remote](const ManifestEntry& pEntry){return pEntry.mObject == remote.mObject;}) )
+			entries.push_back(remote);
+	}
+	if( entries.size() > MAX_MANIFEST_ENTRIES )
+		entries.resize(MAX_MANIFEST_ENTRIES);
+
+	return SaveManifest(pMergedFile,entries);
+}
+
+void ObjectCache::Save()
+{
+	if( !mEnabled )
+		return;
+
+	// Before a trim, the files being sent must still be there.
+	if( mRemote )
+		mRemote->Flush();
+
+	// Read again, another build may have saved since we last did. Two saving at once may lose one's counts, they're only for information.
+	const std::string statsFile = mFolder + "stats";
+	uint64_t hits = 0,misses = 0,size = 0;
+	std::ifstream in(statsFile);
+	if( in.is_open() )
+	{
+		std::string name;
+		uint64_t value;
+		while( in >> name >> value )
+		{
+			if( name == "hits" )
+				hits = value;
+			else if( name == "misses" )
+				misses = value;
+			else if( name == "size" )
+				size = value;
+		}
+		in.close();
+	}
+	else
+	{// First time, or it's been deleted, so we don't know the size.
+		size = mMaxSize + 1;
+	}
+
+	const size_t numHits = mNumHits;
+	const size_t numMisses = mNumMisses;
+	const uint64_t bytesStored = mBytesStored;
+	mTotalHits = hits + (numHits - mSavedHits);
+	mTotalMisses = misses + (numMisses - mSavedMisses);
+	mSize = size + (bytesStored - mSavedBytes);
+	mSavedHits = numHits;
+	mSavedMisses = numMisses;
+	mSavedBytes = bytesStored;
+
+	if( mSize > mMaxSize )
+	{
+		Trim();
+	}
+
+	const std::string temp = GetTemporaryFilename(statsFile);
+	std::ofstream out(temp,std::ofstream::trunc);
+	out << "hits " << mTotalHits << "\nmisses " << mTotalMisses << "\nsize " << mSize << '\n';
+	out.close();
+	if( !out || rename(temp.c_str(),statsFile.c_str()) != 0 )
+		remove(temp.c_str());
+}
+
+uint64_t ObjectCache::GetCommandKey(const std::string& pCommand,const StringVec& pArgs)
+{
+	uint64_t compiler = 0;
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		const auto found = mCompilers.find(pCommand);
+		if( found != mCompilers.end() )
+			compiler = found->second;
+	}
+
+	if( compiler == 0 )
+	{// The same way execvp finds it, a new version of the compiler is a new key.
+		const std::string pathed = FindCommandInPath(pCommand);
+		compiler = HashString(pathed);
+		struct stat Stats;
+		if( stat(pathed.c_str(),&Stats) == 0 )
+		{
+			compiler = HashData(&Stats.st_mtim,sizeof(Stats.st_mtim),compiler);
+			compiler = HashData(&Stats.st_size,sizeof(Stats.st_size),compiler);
+		}
+		std::lock_guard<std::mutex> lock(mLock);
+		mCompilers[pCommand] = compiler;
+	}
+
+	// Relative paths in the arguments and the debug info depend on where it's run from.
+	// With a base folder only the part of a path after it counts, it is taken out of the args too, so -I/ci/job1/src/ is the same as -I/ci/job2/src/.
+	uint64_t key = HashString(CACHE_VERSION);
+	key = HashData(&compiler,sizeof(compiler),key);
+	key = HashString(mBaseFolder.size() > 0 ? "base\n" : "\n",key);
+	key = HashString(GetStoredPath(mWorkingFolder) + "\n",key);
+	for( size_t n = 0 ; n < pArgs.size() ; n++ )
+	{
+		key = HashString((mBaseFolder.size() > 0 ? ReplaceString(pArgs[n],mBaseFolder,"") : pArgs[n]) + "\n",key);
+		if( (pArgs[n] == "-o" || pArgs[n] == "-MF") && n + 1 < pArgs.size() )
+		{// Where the files are written does not change what is in them.
+			n++;
+		}
+	}
+	return key;
+}
+
+bool ObjectCache::GetFileHash(const std::string& pFilename,uint64_t& rHash,timespec& rModified)
+{
+	struct stat Stats;
+	if( stat(pFilename.c_str(),&Stats) != 0 )
+		return false;
+
+	rModified = Stats.st_mtim;
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		const auto found = mFileHashes.find(pFilename);
+		if( found != mFileHashes.end() && found->second.mSize == (int64_t)Stats.st_size &&
+			found->second.mModified.tv_sec == Stats.st_mtim.tv_sec && found->second.mModified.tv_nsec == Stats.st_mtim.tv_nsec )
+		{
+			rHash = found->second.mHash;
+			return true;
+		}
+	}
+
+	if( !HashFile(pFilename,rHash) )
+		return false;
+
+	std::lock_guard<std::mutex> lock(mLock);
+	mFileHashes[pFilename] = {Stats.st_mtim,(int64_t)Stats.st_size,rHash};
+	return true;
+}
+
+std::string ObjectCache::GetManifestFilename(uint64_t pCommandKey)const
+{
+	// Spread over 256 folders so no one folder gets too big.
+	const std::string hex = ToHex(pCommandKey);
+	return mFolder + "m/" + hex.substr(0,2) + "/" + hex + ".manifest";
+}
+
+std::string ObjectCache::GetBlobFilename(uint64_t pKey,const char* pExtension)const
+{
+	const std::string hex = ToHex(pKey);
+	return mFolder + "o/" + hex.substr(0,2) + "/" + hex + pExtension;
+}
+
+std::string ObjectCache::GetStoredPath(const std::string& pFilename)const
+{
+	if( mBaseFolder.size() == 0 )
+		return pFilename;
+
+	// The compiler writes the names as they were given to it, which may be relative to where it was run.
+	const std::string pathed = pFilename.size() > 0 && pFilename[0] == '/' ? pFilename : CleanPath(mWorkingFolder + pFilename);
+	if( pathed.compare(0,mBaseFolder.size(),mBaseFolder) == 0 )
+		return pathed.substr(mBaseFolder.size());
+	return pathed;
+}
+
+std::string ObjectCache::GetLocalPath(const std::string& pStoredPath)const
+{
+	if( mBaseFolder.size() == 0 || (pStoredPath.size() > 0 && pStoredPath[0] == '/') )
+		return pStoredPath;
+	return mBaseFolder + pStoredPath;
+}
+
+bool ObjectCache::LoadManifest(const std::string& pFilename,ManifestEntryVec& rEntries)const
+{
+	std::ifstream file(pFilename);
+	if( !file.is_open() )
+		return false;
+
+	// For each entry, the object key and the number of inputs, then a line for each input with its hash and name.
+	std::string line;
+	while( std::getline(file,line) )
+	{
+		ManifestEntry entry;
+		size_t numInputs;
+		if( !(std::istringstream(line) >> std::hex >> entry.mObject >> std::dec >> numInputs) )
+			return false;
+
+		for( size_t n = 0 ; n < numInputs ; n++ )
+		{
+			uint64_t hash;
+			std::string name;
+			if( !std::getline(file,line) )
+				return false;
+
+			std::istringstream fields(line);
+			if( !(fields >> std::hex >> hash) || !std::getline(fields >> std::ws,name) )
+				return false;
+
+			entry.mInputs.push_back({hash,GetLocalPath(name)});
+		}
+		rEntries.push_back(entry);
+	}
+	return true;
+}
+
+bool ObjectCache::SaveManifest(const std::string& pFilename,const ManifestEntryVec& pEntries)const
+{
+	const std::string temp = GetTemporaryFilename(pFilename);
+	std::ofstream file(temp,std::ofstream::trunc);
+	if( !file.is_open() )
+		return false;
+
+	for( const ManifestEntry& entry : pEntries )
+	{
+		file << std::hex << entry.mObject << std::dec << ' ' << entry.mInputs.size() << '\n';
+		for( const auto& input : entry.mInputs )
+		{
+			file << std::hex << input.first << std::dec << ' ' << GetStoredPath(input.second) << '\n';
+		}
+	}
+	file.close();
+
+	if( !file || rename(temp.c_str(),pFilename.c_str()) != 0 )
+	{
+		remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+void ObjectCache::Trim()
+{
+	struct CachedFile
+	{
+		timespec mModified;
+		uint64_t mSize;
+		std::string mFilename;
+	};
+	std::vector<CachedFile> files;
+	uint64_t total = 0;
+
+	for( const char* kind : {"m/","o/"} )
+	{
+		const std::string kindFolder = mFolder + kind;
+		DIR* folders = opendir(kindFolder.c_str());
+		if( folders == nullptr )
+			continue;
+
+		while( const dirent* folder = readdir(folders) )
+		{
+			if( folder->d_name[0] == '.' )
+				continue;
+
+			const std::string path = kindFolder + folder->d_name + "/";
+			DIR* dir = opendir(path.c_str());
+			if( dir == nullptr )
+				continue;
+
+			while( const dirent* entry = readdir(dir) )
+			{
+				struct stat Stats;
+				const std::string filename = path + entry->d_name;
+				if( entry->d_name[0] != '.' && stat(filename.c_str(),&Stats) == 0 && S_ISREG(Stats.st_mode) )
+				{
+					files.push_back({Stats.st_mtim,(uint64_t)Stats.st_size,filename});
+					total += (uint64_t)Stats.st_size;
+				}
+			}
+			closedir(dir);
+		}
+		closedir(folders);
+	}
+
+	const uint64_t target = mMaxSize / 100 * TRIM_PERCENT;
+	if( total > target )
+	{
+		std::sort(files.begin(),files.end(),[](const CachedFile& pA,const CachedFile& pB)
+		{
+			return pA.mModified.tv_sec < pB.mModified.tv_sec || (pA.mModified.tv_sec == pB.mModified.tv_sec && pA.mModified.tv_nsec < pB.mModified.tv_nsec);
+		});
+
+		for( size_t n = 0 ; n < files.size() && total > target ; n++ )
+		{
+			if( remove(files[n].mFilename.c_str()) == 0 )
+				total -= files[n].mSize;
+		}
+	}
+	mSize = total;
+}
+
+//////////////////////////////////////////////////////////////////////////
+#ifdef DEBUG_BUILD
+// Only built into the debug build, it's the only one that runs them.
+bool DoObjectCacheUnitTests()
+{
+	ObjectCache& cache = ObjectCache::Get();
+	const std::string baseFolder = cache.mBaseFolder;
+	const std::string workingFolder = cache.mWorkingFolder;
+	const std::string manifest = GetTemporaryFilename("/tmp/appbuild_unit_test.manifest");
+	auto WriteManifest = [&manifest](const std::string& pText)
+	{
+		std::ofstream(manifest) << pText;
+	};
+
+	// A name is the rest of the line so it can have spaces.
+	ObjectCache::ManifestEntryVec entries;
+	WriteManifest("1f 2\nabc /src/a.cpp\ndef /src/my file.h\n20 0\n");
+	assert( cache.LoadManifest(manifest,entries) );
+	assert( entries.size() == 2 );
+	assert( entries[0].mObject == 0x1f && entries[0].mInputs.size() == 2 );
+	assert( entries[0].mInputs[0].first == 0xabc && entries[0].mInputs[0].second == "/src/a.cpp" );
+	assert( entries[0].mInputs[1].first == 0xdef && entries[0].mInputs[1].second == "/src/my file.h" );
+	assert( entries[1].mObject == 0x20 && entries[1].mInputs.size() == 0 );
+
+	// One that is cut short or is not a manifest is not used.
+	entries.clear();
+	WriteManifest("1f 2\nabc /src/a.cpp\n");
+	assert( cache.LoadManifest(manifest,entries) == false );
+	WriteManifest("not a manifest\n");
+	assert( cache.LoadManifest(manifest,entries) == false );
+	WriteManifest("1f 1\nnothex /src/a.cpp\n");
+	assert( cache.LoadManifest(manifest,entries) == false );
+	assert( cache.LoadManifest("/tmp/appbuild_no_such_file.manifest",entries) == false );
+
+	// Merging with the remote copy keeps ours first and adds what only the remote one has, one that can't be read is replaced.
+	const std::string remote = GetTemporaryFilename("/tmp/appbuild_unit_test_remote.manifest");
+	const std::string merged = GetTemporaryFilename("/tmp/appbuild_unit_test_merged.manifest");
+	WriteManifest("1f 1\nabc /src/a.cpp\n");
+	std::ofstream(remote) << "20 1\n123 /src/a.cpp\n1f 1\nabc /src/a.cpp\n";
+	entries.clear();
+	assert( cache.MergeManifest(manifest,remote,merged) && cache.LoadManifest(merged,entries) );
+	assert( entries.size() == 2 && entries[0].mObject == 0x1f && entries[1].mObject == 0x20 );
+	std::ofstream(remote) << "not a manifest\n";
+	entries.clear();
+	assert( cache.MergeManifest(manifest,remote,merged) && cache.LoadManifest(merged,entries) );
+	assert( entries.size() == 1 && entries[0].mObject == 0x1f );
+	entries.clear();
+	assert( cache.MergeManifest(manifest,"",merged) && cache.LoadManifest(merged,entries) );
+	assert( entries.size() == 1 && entries[0].mObject == 0x1f );
+	remove(remote.c_str());
+	remove(merged.c_str());
+
+	// Files under the base folder, a relative name is under the working folder, are saved relative to it and loaded under the base folder of the machine that reads it.
+	cache.mBaseFolder = "/work/one/";
+	cache.mWorkingFolder = "/work/one/build/";
+	entries = {{0x1f,{{0xabc,"/work/one/src/a.cpp"},{0xdef,"gen/a.h"},{0x123,"/usr/include/stdio.h"}}}};
+	assert( cache.SaveManifest(manifest,entries) );
+	{
+		std::ifstream file(manifest);
+		const std::string text((std::istreambuf_iterator<char>(file)),std::istreambuf_iterator<char>());
+		assert( text == "1f 3\nabc src/a.cpp\ndef build/gen/a.h\n123 /usr/include/stdio.h\n" );
+	}
+
+	cache.mBaseFolder = "/work/two/";
+	cache.mWorkingFolder = "/work/two/build/";
+	entries.clear();
+	assert( cache.LoadManifest(manifest,entries) );
+	assert( entries.size() == 1 && entries[0].mObject == 0x1f && entries[0].mInputs.size() == 3 );
+	assert( entries[0].mInputs[0].second == "/work/two/src/a.cpp" );
+	assert( entries[0].mInputs[1].second == "/work/two/build/gen/a.h" );
+	assert( entries[0].mInputs[2].second == "/usr/include/stdio.h" );
+
+	cache.mBaseFolder = baseFolder;
+	cache.mWorkingFolder = workingFolder;
+	remove(manifest.c_str());
+
+	std::cout << "Unit tests for object cache source file passed.\n";
+	return true;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+};//namespace appbuild
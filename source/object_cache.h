@@ -0,0 +1,236 @@
+/*
+   Copyright (C) 2017, Richard e Collins.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef __OBJECT_CACHE_H__
+#define __OBJECT_CACHE_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "string_types.h"
+
+namespace appbuild{
+//////////////////////////////////////////////////////////////////////////
+class RemoteCache;
+
+/**
+ * @brief A folder of object files that have been built before, shared by every project and every build on the machine, like ccache.
+ * An object is found by what made it, the compiler, its arguments and the contents of every file the compiler read. So a clean
+ * build, a second checkout or going back to an old branch gets the objects it has built before instead of compiling them again.
+ *
+ * The files the compiler read are only known after it has run, from its depfile. So the compiler and arguments are hashed to find a
+ * manifest that lists, for the last few times that command was run, the files it read with a hash of their contents. If all the files
+ * in one of them still have those contents the object is copied out of the cache. Headers in the system include paths are in the
+ * manifest too, so a package update is seen.
+ *
+ * With a remote cache, see EnableRemote, what is not found here is looked for there, and what is stored here is sent there too.
+ *
+ * The cache is trimmed to its size limit at the end of the build, the files used longest ago are deleted first.
+ * Safe to use from many threads, and for many appbuilds to share the folder, every file is written to a temporary and renamed.
+ */
+class ObjectCache
+{
+public:
+	static ObjectCache& Get();
+
+	/**
+	 * @brief Turns the cache on, till this is called Fetch and Store do nothing.
+	 *
+	 * @param pFolder Where the cache is kept, made if it's not there.
+	 * @param pMaxSize The size in bytes the cache is trimmed to at the end of the build.
+	 * @return false The folder could not be made, the cache is not used.
+	 */
+	bool Enable(const std::string& pFolder,uint64_t pMaxSize);
+	bool GetIsEnabled()const{return mEnabled;}
+
+	/**
+	 * @brief Adds a cache shared with other machines behind this one, call after Enable.
+	 * @param pLocation See CacheBackend::Create.
+	 * @return false The location is not understood.
+	 */
+	bool EnableRemote(const std::string& pLocation);
+	const RemoteCache* GetRemote()const{return mRemote.get();}
+
+	/**
+	 * @brief Paths under the base folder are made relative to it in the keys and manifests, like the base_dir of ccache.
+	 * Without it the cache only gets hits when the project is built from the same absolute path, so two checkouts,
+	 * or build machines that each use a different workspace folder, don't share objects.
+	 * The debug info in an object still has the paths of where it was built, -fdebug-prefix-map in the compiler args fixes that.
+	 * Call after Enable and before the build.
+	 *
+	 * @param pFolder The folder, normally the top of the checkout.
+	 * @return false The folder is not there.
+	 */
+	bool SetBaseFolder(const std::string& pFolder);
+
+	/**
+	 * @brief Looks for an object built by the same compile from files with the same contents.
+	 *
+	 * @param pCommand The compiler.
+	 * @param pArgs The arguments the compile will be run with. The object and depfile names are not part of the key, so the object can be built to any mOutputPath.
+	 * @param pObjectFile Where the object is copied too if it's found.
+	 * @param pDepfile Written as the compiler would have so the dependency checks know what the object was made from.
+	 * @param rOutput What the compiler printed when the object was made, the warnings are shown again.
+	 * @return true The object and depfile have been written, no need to compile.
+	 */
+	bool Fetch(const std::string& pCommand,const StringVec& pArgs,const std::string& pObjectFile,const std::string& pDepfile,std::string& rOutput);
+
+	/**
+	 * @brief Adds an object that has just been built to the cache.
+	 *
+	 * @param pInputFiles The files the compiler read, from its depfile.
+	 * @param pCompileStartTime If any of the input files have been modified since the compile started we can't know what the compiler read, so nothing is stored.
+	 * @return true The object was added.
+	 */
+	bool Store(const std::string& pCommand,const StringVec& pArgs,const std::string& pObjectFile,const StringVec& pInputFiles,const std::string& pOutput,const timespec& pCompileStartTime);
+
+	/**
+	 * @brief The same for a library archive, no depfile is needed as the key is made from the contents of what went into it.
+	 * @param pKey See LinkStamp::GetContentKey, if zero nothing is done.
+	 */
+	bool FetchArchive(uint64_t pKey,const std::string& pTarget);
+	bool StoreArchive(uint64_t pKey,const std::string& pTarget);
+
+	/**
+	 * @brief Waits for the uploads to the remote cache, then adds the hits and misses of this build to the totals kept in the cache folder and trims the cache if it is over its size.
+	 * Call when the build is done, it can be called again if there is another build.
+	 */
+	void Save();
+
+	size_t GetNumHits()const{return mNumHits;}
+	size_t GetNumMisses()const{return mNumMisses;}
+	size_t GetNumStored()const{return mNumStored;}
+	size_t GetNumRemoteHits()const{return mNumRemoteHits;}	//!< The hits that were found in the remote cache.
+
+	/**
+	 * @brief The totals for every build that has used the cache folder, only valid after Save.
+	 */
+	uint64_t GetTotalHits()const{return mTotalHits;}
+	uint64_t GetTotalMisses()const{return mTotalMisses;}
+	uint64_t GetSize()const{return mSize;}	//!< Roughly, only a trim works out the real size.
+	uint64_t GetMaxSize()const{return mMaxSize;}
+	const std::string& GetFolder()const{return mFolder;}
+
+private:
+	friend bool DoObjectCacheUnitTests();
+
+	struct ManifestEntry
+	{
+		uint64_t mObject;		//!< The key of the object in the cache.
+		std::vector<std::pair<uint64_t,std::string>> mInputs;	//!< The hash of the contents of each file the compiler read.
+	};
+	typedef std::vector<ManifestEntry> ManifestEntryVec;
+
+	struct FileHash
+	{
+		timespec mModified;
+		int64_t mSize;
+		uint64_t mHash;
+	};
+
+	ObjectCache();
+	~ObjectCache();
+
+	/**
+	 * @brief Hashes the version of the compiler, the folder it's run from and all of the arguments but the names of the files it writes.
+	 */
+	uint64_t GetCommandKey(const std::string& pCommand,const StringVec& pArgs);
+
+	/**
+	 * @brief The path as it is kept in a manifest. Under the base folder relative to it, else absolute, see SetBaseFolder.
+	 * GetLocalPath turns it back into the path on this machine.
+	 */
+	std::string GetStoredPath(const std::string& pFilename)const;
+	std::string GetLocalPath(const std::string& pStoredPath)const;
+
+	/**
+	 * @brief Hashes the contents of the file, each file is only read once per build unless it changes.
+	 * @param rModified Set to the modification time of the file.
+	 */
+	bool GetFileHash(const std::string& pFilename,uint64_t& rHash,timespec& rModified);
+
+	bool FetchLocal(uint64_t pCommandKey,const std::string& pObjectFile,const std::string& pDepfile,std::string& rOutput);
+
+	/**
+	 * @brief Gets the manifest from the remote cache and if one of its entries is for the files we have, downloads the object and adds it to our cache.
+	 */
+	bool FetchRemote(uint64_t pCommandKey);
+
+	/**
+	 * @brief True if all the files the entry was made from still have the same contents.
+	 */
+	bool GetIsUpToDate(const ManifestEntry& pEntry);
+
+	bool AddBlob(const std::string& pFilename,const std::string& pBlobFilename);
+	bool AddBlobSize(const std::string& pBlobFilename);
+	bool AddToManifest(const std::string& pManifestFile,const ManifestEntry& pEntry);
+
+	/**
+	 * @brief Writes our entries and then those in the remote copy that we don't have, for RemoteCache::Upload.
+	 */
+	bool MergeManifest(const std::string& pManifestFile,const std::string& pRemoteFile,const std::string& pMergedFile)const;
+
+	/**
+	 * @brief The names of the files in the cache, the file name without the path is the key in the remote cache.
+	 */
+	std::string GetManifestFilename(uint64_t pCommandKey)const;
+	std::string GetBlobFilename(uint64_t pKey,const char* pExtension)const;
+	bool LoadManifest(const std::string& pFilename,ManifestEntryVec& rEntries)const;
+	bool SaveManifest(const std::string& pFilename,const ManifestEntryVec& pEntries)const;
+
+	/**
+	 * @brief Deletes the files used longest ago till the cache is under its limit, the access time is not used as it is often turned off so a hit touches the modification time.
+	 */
+	void Trim();
+
+	bool mEnabled;
+	std::string mFolder;	//!< Ends with a '/'.
+	std::string mBaseFolder;	//!< Empty or absolute and ends with a '/'.
+	std::string mWorkingFolder;	//!< The current working directory, ends with a '/'.
+	uint64_t mMaxSize;
+
+	std::mutex mLock;	//!< Guards the maps, not held while doing file IO.
+	std::unordered_map<std::string,uint64_t> mCompilers;	//!< The version of each compiler, the hash of its size and modification time.
+	std::unordered_map<std::string,FileHash> mFileHashes;
+
+	std::atomic<size_t> mNumHits;
+	std::atomic<size_t> mNumMisses;
+	std::atomic<size_t> mNumStored;
+	std::atomic<uint64_t> mBytesStored;
+	std::atomic<size_t> mNumRemoteHits;
+	std::unique_ptr<RemoteCache> mRemote;
+
+	// The totals kept in the stats file. What has been saved so far, so Save can be called more than once.
+	uint64_t mTotalHits;
+	uint64_t mTotalMisses;
+	uint64_t mSize;
+	size_t mSavedHits;
+	size_t mSavedMisses;
+	uint64_t mSavedBytes;
+};
+
+//////////////////////////////////////////////////////////////////////////
+bool DoObjectCacheUnitTests();
+
+//////////////////////////////////////////////////////////////////////////
+};//namespace appbuild
+
+#endif //#ifndef __OBJECT_CACHE_H__
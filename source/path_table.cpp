@@ -0,0 +1,110 @@
+/*
+   Copyright (C) 2017, Richard e Collins.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include <string.h>
+#include <assert.h>
+
+#include "misc.h"
+#include "path_table.h"
+
+namespace appbuild{
+//////////////////////////////////////////////////////////////////////////
+PathTable::PathTable():
+	mSlots(1024,0),
+	mLargeBytes(0),
+	mBlockUsed(BLOCK_SIZE)
+{
+}
+
+uint32_t PathTable::Intern(const std::string& pPath)
+{
+	const uint32_t hash = (uint32_t)HashString(pPath);
+	const uint32_t slot = FindSlot(pPath.data(),(uint32_t)pPath.size(),hash);
+	if( mSlots[slot] != 0 )
+		return mSlots[slot] - 1;
+
+	assert( mEntries.size() < INVALID_ID );
+	const uint32_t id = (uint32_t)mEntries.size();
+	mEntries.push_back({Store(pPath),(uint32_t)pPath.size(),hash});
+	mSlots[slot] = id + 1;
+
+	// Keep it under three quarters full so the probes stay short.
+	if( mEntries.size() * 4 > mSlots.size() * 3 )
+		GrowSlots();
+
+	return id;
+}
+
+uint32_t PathTable::Find(const std::string& pPath)const
+{
+	const uint32_t slot = FindSlot(pPath.data(),(uint32_t)pPath.size(),(uint32_t)HashString(pPath));
+	return mSlots[slot] - 1;// Empty is zero, so this gives INVALID_ID.
+}
+
+uint32_t PathTable::FindSlot(const char* pPath,uint32_t pLength,uint32_t pHash)const
+{
+	const uint32_t mask = (uint32_t)mSlots.size() - 1;
+	for( uint32_t slot = pHash & mask ; ; slot = (slot + 1) & mask )
+	{
+		if( mSlots[slot] == 0 )
+			return slot;
+
+		const Entry& entry = mEntries[mSlots[slot] - 1];
+		if( entry.mHash == pHash && entry.mLength == pLength && memcmp(entry.mPath,pPath,pLength) == 0 )
+			return slot;
+	}
+}
+
+const char* PathTable::Store(const std::string& pPath)
+{
+	const size_t size = pPath.size() + 1;
+	char* dest;
+	if( size > BLOCK_SIZE )
+	{
+		mLarge.emplace_back(new char[size]);
+		mLargeBytes += size;
+		dest = mLarge.back().get();
+	}
+	else
+	{
+		if( mBlockUsed + size > BLOCK_SIZE )
+		{
+			mBlocks.emplace_back(new char[BLOCK_SIZE]);
+			mBlockUsed = 0;
+		}
+		dest = mBlocks.back().get() + mBlockUsed;
+		mBlockUsed += size;
+	}
+	memcpy(dest,pPath.c_str(),size);
+	return dest;
+}
+
+void PathTable::GrowSlots()
+{
+	mSlots.assign(mSlots.size() * 2,0);
+	const uint32_t mask = (uint32_t)mSlots.size() - 1;
+	for( uint32_t id = 0 ; id < (uint32_t)mEntries.size() ; id++ )
+	{
+		uint32_t slot = mEntries[id].mHash & mask;
+		while( mSlots[slot] != 0 )
+			slot = (slot + 1) & mask;
+		mSlots[slot] = id + 1;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+};//namespace appbuild
@@ -0,0 +1,93 @@
+/*
+   Copyright (C) 2017, Richard e Collins.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#ifndef __PATH_TABLE_H__
+#define __PATH_TABLE_H__
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+#include "string_types.h"
+
+namespace appbuild{
+//////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Gives each path a 32 bit id, the same path always gets the same id.
+ * The characters are kept in large blocks that never move, so the pointer GetPath returns stays valid for the life of the table even as more are added.
+ * The lookup is an open addressed hash table of ids, no std::string or node allocation per path.
+ * Not thread safe, the owner has to hold its own lock. The pointers it hands out can be used without the lock.
+ */
+class PathTable
+{
+public:
+	static const uint32_t INVALID_ID = 0xffffffff;
+
+	PathTable();
+
+	/**
+	 * @brief Returns the id of the path, adding it if it's not been seen before.
+	 */
+	uint32_t Intern(const std::string& pPath);
+
+	/**
+	 * @brief Returns the id of the path or INVALID_ID if it's not in the table.
+	 */
+	uint32_t Find(const std::string& pPath)const;
+
+	/**
+	 * @brief The path for the id, null terminated. Stays valid till the table is destroyed.
+	 */
+	const char* GetPath(uint32_t pID)const{return mEntries[pID].mPath;}
+	uint32_t GetLength(uint32_t pID)const{return mEntries[pID].mLength;}
+
+	/**
+	 * @brief How many paths are in the table, the ids are 0 to GetCount()-1.
+	 */
+	uint32_t GetCount()const{return (uint32_t)mEntries.size();}
+
+	/**
+	 * @brief How much memory the characters are using, for the verbose stats.
+	 */
+	size_t GetArenaSize()const{return mBlocks.size() * BLOCK_SIZE + mLargeBytes;}
+
+private:
+	static const size_t BLOCK_SIZE = 64 * 1024;
+
+	struct Entry
+	{
+		const char* mPath;
+		uint32_t mLength;
+		uint32_t mHash;		//!< Kept so growing the lookup table and most failed compares don't need to touch the characters.
+	};
+
+	uint32_t FindSlot(const char* pPath,uint32_t pLength,uint32_t pHash)const;
+	const char* Store(const std::string& pPath);
+	void GrowSlots();
+
+	std::vector<Entry> mEntries;					//!< Indexed by id.
+	std::vector<uint32_t> mSlots;					//!< id + 1 of the path that lives there, zero for empty. Always a power of two in size.
+	std::vector<std::unique_ptr<char[]>> mBlocks;	//!< The arena, each BLOCK_SIZE bytes.
+	std::vector<std::unique_ptr<char[]>> mLarge;	//!< Paths too big for a block get their own allocation, should never happen.
+	size_t mLargeBytes;
+	size_t mBlockUsed;								//!< How much of the last block has been used.
+};
+
+//////////////////////////////////////////////////////////////////////////
+};//namespace appbuild
+
+#endif //#ifndef __PATH_TABLE_H__
@@ -22,9 +22,15 @@
 #include <iostream>
 #include <libgen.h>
 #include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <algorithm>
 
 #include "project.h"
 #include "misc.h"
+#include "directory_index.h"
+#include "worker_pool.h"
+#include "object_cache.h"
 #include "shell.h"
 #include "arg_list.h"
 #include "build_task_resource_files.h"
@@ -37,18 +43,28 @@ namespace appbuild{
 StringSet Project::sLoadedProjects;
 
 //////////////////////////////////////////////////////////////////////////
-Project::Project(const tinyjson::JsonValue& pProjectJson,const std::string& pProjectName,const std::string& pProjectPath,size_t pNumThreads,int pLoggingMode,bool pRebuild,size_t pTruncateOutput):
+Project::Project(const tinyjson::JsonValue& pProjectJson,const std::string& pProjectName,const std::string& pProjectPath,size_t pNumThreads,int pLoggingMode,bool pRebuild,size_t pTruncateOutput,bool pContentHash,bool pFailFast):
 		mNumThreads(pNumThreads>0?pNumThreads:1),
 		mLoggingMode(pLoggingMode),
 		mRebuild(pRebuild),
 		mTruncateOutput(pTruncateOutput),
+		mContentHash(pContentHash),
+		mFailFast(pFailFast),
 		mProjectName(pProjectName),
 		mProjectDir(pProjectPath),
+		mDependencies(pContentHash),
 		mSourceFiles(pProjectPath,pLoggingMode),
 		mResourceFiles(pProjectPath,pLoggingMode),
 		mIncludeSearchPaths(pProjectPath),
+		mSystemIncludeSearchPaths(pProjectPath),
 		mLibrarySearchPaths(pProjectPath),
 		mLibraryFiles(pProjectPath),
+		mBuildEvent(nullptr),
+		mBuildStage(STAGE_NOT_STARTED),
+		mCompileStarted(false),
+		mCompileOk(false),
+		mLinkFinished(false),
+		mLinkOk(false),
 		mProjectVersion(0),
 		mOk(false)
 {
@@ -111,6 +127,15 @@ Project::Project(const tinyjson::JsonValue& pProjectJson,const std::string& pPro
         }
     }
 
+	if( pProjectJson.HasValue("system_include") )
+	{
+        if( mSystemIncludeSearchPaths.AddPaths(pProjectJson["system_include"]) == false )
+        {
+            std::cerr << "The \'system_include\' object in the \'root project\' is not an array\n";
+            return; // We're done, no need to continue.
+        }
+    }
+
 	if( pProjectJson.HasValue("libpaths") )
     {
         if( mLibrarySearchPaths.AddPaths(pProjectJson["libpaths"]) == false )
@@ -165,159 +190,81 @@ Project::~Project()
 
 bool Project::Build(const std::string& pConfigName)
 {
-	const bool verbose = mLoggingMode >= appbuild::LOG_VERBOSE;
 	ConfigurationPtr activeConfig = GetConfiguration(pConfigName);
-
 	if(activeConfig == nullptr)
 	{
 		return false;
 	}
 
-	// See if there are any dependant projects that need to be built first.
-	const StringMap& DependantProjects = activeConfig->GetDependantProjects();
-	for( auto& proj : DependantProjects )
+	// Load all the projects first, so they can all be compiled at once. Each is loaded once however many projects depend on it.
+	ProjectMap LoadedProjects;
+	if( !LoadDependantProjects(activeConfig,LoadedProjects) )
 	{
-		const std::string ProjectFile = proj.first;
-		std::cout << "Checking dependency \'" << ProjectFile << "\'\n";
-
-		std::ifstream jsonFile(ProjectFile);
-		if( !jsonFile.is_open() )
-		{
-			if( verbose )
-			{
-				std::cout << "The project dependancy file \'" << ProjectFile << "\' could not be loaded\n";
-			}
-			return false;
-		}
-
-		std::stringstream jsonStream;
-		jsonStream << jsonFile.rdbuf();// Read the whole file in...
-
-		tinyjson::JsonProcessor projectFile(jsonStream.str());
-		tinyjson::JsonValue projectRoot = projectFile.GetRoot();
-		appbuild::UpdateJsonProjectWithDefaults(projectRoot,verbose);
-
-
-		if( ValidateJsonAgainstSchema(projectRoot,verbose) == false )
-		{
-			return false;
-		}
-
-		const std::string projectPath = appbuild::GetPath(ProjectFile);
-
-		Project TheProject(projectRoot,ProjectFile,projectPath,mNumThreads,mLoggingMode,mRebuild,mTruncateOutput);
-		if( TheProject )
-		{
-			std::string configname = proj.second;
-			if( configname.empty() )
-				configname = activeConfig->GetName();
-
-			if( TheProject.Build(configname) == false )
-			{
-				return false;
-			}
-
-			// That worked, lets add it's output file to our input libs.
-			ConfigurationPtr DepConfig = TheProject.GetConfiguration(configname);
-			assert( DepConfig != nullptr );// Should not happen, it was built ok...		
-			if( DepConfig->GetTargetType() == TARGET_LIBRARY || DepConfig->GetTargetType() == TARGET_SHARED_OBJECT )
-			{
-				const std::string RelativeOutputpath = GetPath(DepConfig->GetPathedTargetName());
-				mDependencyLibraryFiles.push_back(DepConfig->GetOutputName());
-				mDependencyLibrarySearchPaths.push_back(RelativeOutputpath);
-
-				if( DepConfig->GetTargetType() == TARGET_SHARED_OBJECT )
-				{
-					if( mSharedObjectPaths.size() > 0 )
-					{
-						mSharedObjectPaths += ":";
-					}
-					mSharedObjectPaths += RelativeOutputpath;
-				}
-
-				if( verbose )
-					std::cout << "Adding dependency for lib \'" << DepConfig->GetOutputName() << "\' located at \'" << RelativeOutputpath << "\'\n";
-			}
-		}
-		else
-		{
-			std::cout << "There was an error in the project file \'" << ProjectFile << "\'\n";
-			return false;
-		}		
+		return false;
 	}
 
-	// We know what config to build with, lets go.
-    if( mLoggingMode >= LOG_INFO )
-    {
-    	std::cout << "Compiling configuration \'" << activeConfig->GetName() << "\'\n";
-    }
+	std::vector<Project*> BuildOrder;
+	GetBuildOrder(BuildOrder);
 
-	BuildTaskStack BuildTasks;
+	// The dependency checks and the end of each compile, reading its depfile, can both be running at once, each up to the number of threads, so the pool needs room for both.
+	WorkerPool::Get().SetMaxThreads(std::max((size_t)1,mNumThreads) * 2);
 
-	// See if we need to build the resoure files first.
-	SourceFiles GeneratedResourceFiles(mProjectDir,mLoggingMode);
-	if( mResourceFiles.size() > 0 )
+	// One event for every project, a task finishing, a new one being found or a link finishing in any of them wakes us up.
+	BuildEvent Event;
+	bool BuildOk = true;
+	for( Project* project : BuildOrder )
 	{
-		// We run this build task now as it's a prebuild step and will need to make new tasks of it's own.
-		BuildTaskResourceFiles ResourceTask(mResourceFiles,activeConfig->GetOutputPath(),mLoggingMode);
-
-		ResourceTask.Execute();
-		while( ResourceTask.GetIsCompleted() == false )
-		{
-			std::this_thread::yield();
-		}
-
-		if( ResourceTask.GetOk() )
+		if( !project->BeginBuild(Event) )
 		{
-			ResourceTask.GetGeneratedResourceFiles(GeneratedResourceFiles);
+			BuildOk = false;
+			break;
 		}
 	}
 
-	ArgList additionalArgs;
-	// If we're creating a shared object then we need to build source files with -fpic option.
-	if( activeConfig->GetTargetType() == TARGET_SHARED_OBJECT )
+	// The projects earlier in the order are the ones the later ones need, so they get the first pick of the threads.
+	const size_t ThreadCount = std::max((size_t)1,mNumThreads);
+	size_t NumRunning = 0;
+	bool Cancelled = false;
+	for(;;)
 	{
-		additionalArgs.AddArg("-fpic"); // Enable position independent code
-	}
+		bool SomethingHappened = false;
+		bool Finished = true;
+		for( Project* project : BuildOrder )
+		{
+			// A project that finished compiling after the cancel must not go on to link.
+			if( Cancelled && project->mBuildStage == STAGE_WAITING_TO_LINK )
+				project->CancelBuild(mFailFast);
 
-	// Also add the define for the app version.
-	const std::string DEF_APP_VERSION = "-DAPP_VERSION=\"" + VERSION_TO_STRING(mProjectVersion) + "\"";
-	additionalArgs.AddArg(DEF_APP_VERSION);
+			if( project->UpdateBuild(NumRunning,ThreadCount) )
+				SomethingHappened = true;
 
-	StringVec OutputFiles;
-	if( activeConfig->GetBuildTasks(mSourceFiles,GeneratedResourceFiles,mRebuild,additionalArgs,mIncludeSearchPaths,BuildTasks,mDependencies,OutputFiles) )
-	{
-		if( BuildTasks.size() > 0 )
-		{
-			if( !CompileSource(activeConfig,BuildTasks) )
-			{
-				return false;
-			}
+			// A failed compile is seen as soon as it happens and not when the project has finished compiling, so with fail fast the others can be killed now.
+			// It's still not finished, the compiles that are running have to be waited for and FinishCompile run.
+			if( project->mBuildStage == STAGE_FAILED || (project->mBuildStage == STAGE_COMPILING && !project->mCompileOk) )
+				BuildOk = false;
+
+			if( project->mBuildStage != STAGE_DONE && project->mBuildStage != STAGE_NOT_STARTED && project->mBuildStage != STAGE_FAILED )
+				Finished = false;
 		}
 
-		switch(activeConfig->GetTargetType())
+		// If anything failed there is no point starting anything else, just wait for what is running to finish or, with fail fast, kill it.
+		if( !BuildOk && !Cancelled )
 		{
-		case TARGET_EXEC:
-			// Link. May just do a link if none of the source files needed to be build.
-			return LinkTarget(activeConfig,OutputFiles);
-
-		case TARGET_LIBRARY:
-			return ArchiveLibrary(activeConfig,OutputFiles);
+			Cancelled = true;
+			for( Project* project : BuildOrder )
+				project->CancelBuild(mFailFast);
 
-		case TARGET_SHARED_OBJECT:
-			return LinkSharedObject(activeConfig,OutputFiles);
+			continue;
+		}
 
-		case TARGET_NOT_SET:
-			std::cerr << "Target type not set, unable to compile configuration \'" << activeConfig->GetName() << "\' in project \'" << mProjectName << "\'\n";
+		if( Finished )
 			break;
-		}
-	}
-	else
-	{
-		std::cerr << "Unable to create build tasks for the configuration \'" << activeConfig->GetName() << "\' in project \'" << mProjectName << "\'\n";
+
+		if( !SomethingHappened )
+			Event.Wait();
 	}
 
-	return false;
+	return BuildOk && mBuildStage == STAGE_DONE;
 }
 
 bool Project::RunOutputFile(const std::string& pConfigName)const
@@ -343,6 +290,7 @@ void Project::Write(tinyjson::JsonValue& pDocument)const
 	pDocument.Emplace("configurations",configurations);
 	pDocument.Emplace("source_files",mSourceFiles.GetFiles());
 	pDocument.Emplace("include",mIncludeSearchPaths);
+	pDocument.Emplace("system_include",mSystemIncludeSearchPaths);
 	pDocument.Emplace("libpaths",mLibrarySearchPaths);
 	pDocument.Emplace("libs",mLibraryFiles);
 
@@ -474,106 +422,459 @@ bool Project::ReadConfigurations(const tinyjson::JsonValue& pConfigs)
 	return true;
 }
 
-bool Project::CompileSource(ConfigurationPtr pConfig,BuildTaskStack& pBuildTasks)
+bool Project::LoadDependantProjects(ConfigurationPtr pConfig,ProjectMap& rLoadedProjects)
 {
-	assert(pConfig);
-	if( !pConfig )
-		return false;
+	const bool verbose = mLoggingMode >= appbuild::LOG_VERBOSE;
+	mActiveConfig = pConfig;
+
+	// See if there are any dependant projects that need to be built first.
+	const StringMap& DependantProjects = pConfig->GetDependantProjects();
+	for( auto& proj : DependantProjects )
+	{
+		const std::string ProjectFile = proj.first;
+		std::string configname = proj.second;
+		if( configname.empty() )
+			configname = pConfig->GetName();
+
+		// Two projects can name the same one in different ways, ../core/core.proj and ../lib/../core/core.proj, so it's known by its real path.
+		char realPath[PATH_MAX];
+		const std::string ProjectKey = std::string(realpath(ProjectFile.c_str(),realPath) ? realPath : ProjectFile.c_str()) + "|" + configname;
+
+		std::shared_ptr<Project> TheProject;
+		ProjectMap::const_iterator found = rLoadedProjects.find(ProjectKey);
+		if( found != rLoadedProjects.end() )
+		{// Another project depends on it too, it is already loaded and will be built once for both of us.
+			if( verbose )
+				std::cout << "Dependency \'" << ProjectFile << "\' is already loaded\n";
+
+			TheProject = found->second;
+		}
+		else
+		{
+			std::cout << "Checking dependency \'" << ProjectFile << "\'\n";
+
+			std::ifstream jsonFile(ProjectFile);
+			if( !jsonFile.is_open() )
+			{
+				if( verbose )
+				{
+					std::cout << "The project dependancy file \'" << ProjectFile << "\' could not be loaded\n";
+				}
+				return false;
+			}
+
+			std::stringstream jsonStream;
+			jsonStream << jsonFile.rdbuf();// Read the whole file in...
+
+			tinyjson::JsonProcessor projectFile(jsonStream.str());
+			tinyjson::JsonValue projectRoot = projectFile.GetRoot();
+			appbuild::UpdateJsonProjectWithDefaults(projectRoot,verbose);
+
+
+			if( ValidateJsonAgainstSchema(projectRoot,verbose) == false )
+			{
+				return false;
+			}
 
-	assert( pBuildTasks.size() > 0 );
+			const std::string projectPath = appbuild::GetPath(ProjectFile);
+
+			TheProject = std::make_shared<Project>(projectRoot,ProjectFile,projectPath,mNumThreads,mLoggingMode,mRebuild,mTruncateOutput,mContentHash,mFailFast);
+			if( !*TheProject )
+			{
+				std::cout << "There was an error in the project file \'" << ProjectFile << "\'\n";
+				return false;
+			}
+
+			ConfigurationPtr DepConfig = TheProject->GetConfiguration(configname);
+			if( DepConfig == nullptr )
+			{
+				return false;
+			}
+
+			const bool loaded = TheProject->LoadDependantProjects(DepConfig,rLoadedProjects);
+
+			// The projects below it are loaded, so it's no longer on the path being loaded. Another project can depend on it too without it being a loop.
+			sLoadedProjects.erase(TheProject->mProjectName);
+			if( !loaded )
+			{
+				return false;
+			}
+
+			// Only added once it and everything below it has loaded, so a loop back to it is still caught by sLoadedProjects.
+			rLoadedProjects[ProjectKey] = TheProject;
+		}
+
+		// Lets add it's output file to our input libs, it will be there by the time we link.
+		ConfigurationPtr DepConfig = TheProject->mActiveConfig;
+		if( DepConfig->GetTargetType() == TARGET_LIBRARY || DepConfig->GetTargetType() == TARGET_SHARED_OBJECT )
+		{
+			const std::string RelativeOutputpath = GetPath(DepConfig->GetPathedTargetName());
+			mDependencyLibraryFiles.push_back(DepConfig->GetOutputName());
+			mDependencyLibrarySearchPaths.push_back(RelativeOutputpath);
+			mDependencyLibraryTargets.push_back(DepConfig->GetPathedTargetName());
+
+			if( DepConfig->GetTargetType() == TARGET_SHARED_OBJECT )
+			{
+				if( mSharedObjectPaths.size() > 0 )
+				{
+					mSharedObjectPaths += ":";
+				}
+				mSharedObjectPaths += RelativeOutputpath;
+			}
+
+			if( verbose )
+				std::cout << "Adding dependency for lib \'" << DepConfig->GetOutputName() << "\' located at \'" << RelativeOutputpath << "\'\n";
+		}
+
+		mDependantProjects.push_back({TheProject,configname});
+	}
+	return true;
+}
+
+void Project::GetBuildOrder(std::vector<Project*>& rBuildOrder)
+{
+	// A project more than one depends on is only built once, where it's first needed.
+	if( std::find(rBuildOrder.begin(),rBuildOrder.end(),this) != rBuildOrder.end() )
+		return;
+
+	for( auto& dep : mDependantProjects )
+	{
+		dep.mProject->GetBuildOrder(rBuildOrder);
+	}
+	rBuildOrder.push_back(this);
+}
 
-	// I always delete the target if something needs to be build so there is no exec to run if the source has failed to build.
-	remove(pConfig->GetPathedTargetName().c_str());
+bool Project::BeginBuild(BuildEvent& rEvent)
+{
+	const bool verbose = mLoggingMode >= appbuild::LOG_VERBOSE;
+	assert(mActiveConfig);
+	ConfigurationPtr activeConfig = mActiveConfig;
 
+	// We know what config to build with, lets go.
     if( mLoggingMode >= LOG_INFO )
     {
-    	std::cout << "Building: " << pBuildTasks.size() << " file" << (pBuildTasks.size()>1?"s.":".");
+    	std::cout << "Compiling configuration \'" << activeConfig->GetName() << "\' of \'" << mProjectName << "\'\n";
     }
 
-	const size_t ThreadCount = std::max((size_t)1,std::min(mNumThreads,pBuildTasks.size()));
+	mBuildEvent = &rEvent;
+	mBuildTasks.reset(new BuildTaskStack(rEvent));
 
-    if( mLoggingMode >= LOG_INFO )
-    {
-        if( ThreadCount > 1 )
-            std::cout << " Num threads " << ThreadCount;
+	// See if we need to build the resoure files first.
+	SourceFiles GeneratedResourceFiles(mProjectDir,mLoggingMode);
+	if( mResourceFiles.size() > 0 )
+	{
+		// We run this build task now as it's a prebuild step and will need to make new tasks of it's own.
+		BuildTaskResourceFiles ResourceTask(mResourceFiles,activeConfig->GetOutputPath(),mLoggingMode);
 
-        std::cout << " Output path " << pConfig->GetOutputPath();
-        std::cout << std::endl;
-    }
+		ResourceTask.Execute();
+		ResourceTask.WaitForCompletion();
+
+		if( ResourceTask.GetOk() )
+		{
+			ResourceTask.GetGeneratedResourceFiles(GeneratedResourceFiles);
+		}
+	}
+
+	ArgList additionalArgs;
+	// If we're creating a shared object then we need to build source files with -fpic option.
+	if( activeConfig->GetTargetType() == TARGET_SHARED_OBJECT )
+	{
+		additionalArgs.AddArg("-fpic"); // Enable position independent code
+	}
+
+	// Load the include graph from the last build so only files that have changed need to be scanned.
+	const std::string DependencyCacheFile = activeConfig->GetOutputPath() + "dependencies.cache";
+	if( !mRebuild && mDependencies.LoadCache(DependencyCacheFile) && verbose )
+	{
+		std::cout << "Loaded dependency cache " << DependencyCacheFile << '\n';
+	}
 
-	bool CompileOk = true;
+	// How long each file took last time, so the slow ones can be started first. Kept when rebuilding, that's when it helps the most.
+	mBuildLog.Load(activeConfig->GetOutputPath() + "build.log");
 
+	// The dependency checks are still running when this returns, files are compiled by UpdateCompile as they are found to be out of date.
+	if( !activeConfig->GetBuildTasks(mSourceFiles,GeneratedResourceFiles,mRebuild,mNumThreads,additionalArgs,VERSION_TO_STRING(mProjectVersion),mIncludeSearchPaths,mSystemIncludeSearchPaths,*mBuildTasks,mDependencies,mBuildLog,mOutputFiles) )
+	{
+		std::cerr << "Unable to create build tasks for the configuration \'" << activeConfig->GetName() << "\' in project \'" << mProjectName << "\'\n";
+		mBuildStage = STAGE_FAILED;
+		return false;
+	}
+
+	mBuildStage = STAGE_COMPILING;
+	mCompileOk = true;
+	return true;
+}
 
-	RunningBuildTasks RunningTasks;
-	while( pBuildTasks.size() > 0 || RunningTasks.size() > 0 )
+bool Project::UpdateBuild(size_t& rNumRunning,size_t pMaxRunning)
+{
+	switch( mBuildStage )
 	{
-		// Make sure at least N tasks are running.
-		if( pBuildTasks.size() > 0 && RunningTasks.size() < ThreadCount )
+	case STAGE_COMPILING:
+		return UpdateCompile(rNumRunning,pMaxRunning);
+
+	case STAGE_WAITING_TO_LINK:
+		for( auto& dep : mDependantProjects )
 		{
-			BuildTask* task = pBuildTasks.top();
-			pBuildTasks.pop();
-			RunningTasks.push_back(task);
-			task->Execute();
+			if( dep.mProject->mBuildStage == STAGE_FAILED )
+			{
+				mBuildStage = STAGE_FAILED;
+				return true;
+			}
+
+			if( dep.mProject->mBuildStage != STAGE_DONE )
+				return false;
 		}
-		else
+		StartLink();
+		return true;
+
+	case STAGE_LINKING:
+		{
+			std::lock_guard<std::mutex> lock(mLinkLock);
+			if( !mLinkFinished )
+				return false;
+		}
+		mBuildStage = mLinkOk ? STAGE_DONE : STAGE_FAILED;
+		return true;
+
+	default:
+		break;
+	}
+	return false;
+}
+
+void Project::CancelBuild(bool pKillRunning)
+{
+	if( mBuildStage == STAGE_COMPILING )
+	{
+		mCompileOk = false;
+		mBuildTasks->Cancel();
+		if( pKillRunning )
+		{// They still complete, they are waited for and deleted by UpdateCompile as normal.
+			for( BuildTask* task : mRunningTasks )
+				task->Kill();
+		}
+	}
+	else if( mBuildStage == STAGE_WAITING_TO_LINK )
+	{
+		mBuildStage = STAGE_FAILED;
+	}
+}
+
+bool Project::UpdateCompile(size_t& rNumRunning,size_t pMaxRunning)
+{
+	ConfigurationPtr pConfig = mActiveConfig;
+	BuildTaskStack& pBuildTasks = *mBuildTasks;
+	bool SomethingHappened = false;
+
+	// Make sure at least N tasks are running, over all the projects being built.
+	BuildTask* newTask = nullptr;
+	while( rNumRunning < pMaxRunning && (newTask = pBuildTasks.pop()) != nullptr )
+	{
+		SomethingHappened = true;
+		if( !mCompileStarted )
 		{
-			// For when GetNumThreads are running or waiting for the last tasks to complete.
-			// Back the main thread off a little so we don't thrash the cpu just waiting.
-			std::this_thread::yield();
+			mCompileStarted = true;
+
+			if( mLoggingMode >= LOG_INFO )
+			{
+				// If the checks are still going we don't know how many there will be yet.
+				if( pBuildTasks.GetIsProducing() )
+					std::cout << "Building: files as they are found to be out of date.";
+				else
+					std::cout << "Building: " << pBuildTasks.size()+1 << " file" << (pBuildTasks.size()>0?"s.":".");
+
+				if( pMaxRunning > 1 )
+					std::cout << " Num threads " << pMaxRunning;
+
+				std::cout << " Output path " << pConfig->GetOutputPath();
+				std::cout << std::endl;
+			}
 		}
 
-		// See if any running task has finished.
-		RunningBuildTasks::iterator task = RunningTasks.begin();
-		while( task != RunningTasks.end() )
+		mRunningTasks.push_back(newTask);
+		rNumRunning++;
+		newTask->Execute(mBuildEvent);
+	}
+
+	// See if any running task has finished.
+	RunningBuildTasks::iterator task = mRunningTasks.begin();
+	while( task != mRunningTasks.end() )
+	{
+		if( (*task)->GetIsCompleted() )
 		{
-			if( (*task)->GetIsCompleted() )
+			SomethingHappened = true;
+
+			// Print the results. A killed task has none, it was stopped because of an error in another.
+			const std::string& res = (*task)->GetResults();
+			if( res.size() > 1 )
 			{
-				// Print the results.
-				const std::string& res = (*task)->GetResults();
-				if( res.size() > 1 )
+				std::cerr << std::endl << "Unexpected output from task: " << (*task)->GetTaskName() << std::endl;
+				if( mTruncateOutput > 0 )
 				{
-					std::cerr << std::endl << "Unexpected output from task: " << (*task)->GetTaskName() << std::endl;
-					if( mTruncateOutput > 0 )
-					{
-						StringVec chopped = SplitString(res,"\n");
-						for( size_t n = 0 ; n < chopped.size() && n < mTruncateOutput ; n++ )
-							std::cout << chopped[n] << std::endl;
-					}
-					else
-					{
-						std::cout << res << std::endl;
-					}
-					// Leave a gap.
-					std::cout << std::endl;
+					StringVec chopped = SplitString(res,"\n");
+					for( size_t n = 0 ; n < chopped.size() && n < mTruncateOutput ; n++ )
+						std::cout << chopped[n] << std::endl;
 				}
-
-				// See if it worked ok.
-				if( (*task)->GetOk() == false )
+				else
 				{
-					CompileOk = false;
-					// If the compile failed, clean up the tasks that are waiting to start and then just wait for the ones in progress to finish.
-					while( !pBuildTasks.empty() )
-					{
-						delete pBuildTasks.top();
-						pBuildTasks.pop();
-					}
+					std::cout << res << std::endl;
 				}
+				// Leave a gap.
+				std::cout << std::endl;
+			}
 
-				delete (*task);
-				task = RunningTasks.erase(task);// This removes the one just deleted and advances our linked list pointer.
+			// How long a killed task took says nothing about how long it takes.
+			if( !(*task)->GetWasKilled() )
+				mBuildLog.Record((*task)->GetOutputFilename(),(*task)->GetMilliseconds(),(*task)->GetOk());
 
+			// See if it worked ok.
+			if( (*task)->GetOk() == false )
+			{
+				mCompileOk = false;
+				// If the compile failed, clean up the tasks that are waiting to start and then just wait for the ones in progress to finish.
+				// This also stops the dependency checks that are still running. Build then cancels the other projects.
+				pBuildTasks.Cancel();
 			}
-			else
-			{// Go to the next running task.
-				++task;
-			}
-		};
+
+			delete (*task);
+			task = mRunningTasks.erase(task);// This removes the one just deleted and advances our linked list pointer.
+			rNumRunning--;
+		}
+		else
+		{// Go to the next running task.
+			++task;
+		}
 	};
 
-    if( mLoggingMode >= LOG_INFO )
-	    std::cout << "Build finished\n";
+	// Tasks can still be arriving from the dependency checks, so we're not done till they have finished too.
+	if( pBuildTasks.GetIsFinished() && mRunningTasks.size() == 0 )
+	{
+		FinishCompile();
+		SomethingHappened = true;
+	}
+
+	return SomethingHappened;
+}
+
+void Project::FinishCompile()
+{
+	const bool verbose = mLoggingMode >= appbuild::LOG_VERBOSE;
+	ConfigurationPtr activeConfig = mActiveConfig;
+
+	// After this the dependency cache is complete.
+	mBuildTasks->JoinProducers();
+
+    if( mCompileStarted && mLoggingMode >= LOG_INFO )
+	    std::cout << "Build finished for \'" << mProjectName << "\'\n";
+
+	if( mCompileOk )
+	{// Everything has now been built with the current toolchain and packages.
+		mDependencies.AcceptSystemStamp();
+	}
+	else if( mCompileStarted )
+	{// I always delete the target if the source has failed to build so there is no exec to run that is out of date.
+	 // It's not deleted when the compile starts, if the objects come out the same the link stamp keeps the target we have.
+		remove(mActiveConfig->GetPathedTargetName().c_str());
+	}
+
+	if( verbose )
+	{
+		std::cout << mDependencies.GetNumCacheHits() << " files did not need scanning for includes as they were in the dependency cache\n";
+		std::cout << mDependencies.GetNumDepfileHits() << " object files were checked using the compiler's depfile from the last build\n";
+		if( mContentHash )
+		{
+			std::cout << mDependencies.GetNumUnchangedContents() << " files were newer than their object file but had the same contents\n";
+		}
+		if( mDependencies.GetNumDefinesNotUsed() > 0 )
+		{
+			std::cout << mDependencies.GetNumDefinesNotUsed() << " object files were not rebuilt as they don't use the defines that changed\n";
+		}
+		std::cout << mDependencies.GetNumFiles() << " files known to the dependency checks, " << mDependencies.GetPathMemory() / 1024 << "KB used for their names\n";
+		std::cout << mBuildLog.GetNumWithHistory() << " files built were ordered by how long they took last time\n";
+
+		const DirectoryIndex& index = DirectoryIndex::Get();
+		std::cout << WorkerPool::Get().GetNumWorkDone() << " jobs run by " << WorkerPool::Get().GetNumThreads() << " worker threads\n";
+
+		std::cout << "Directory index answered " << index.GetNumStatsAvoided() << " of " << index.GetNumLookups() << " file lookups without a stat, "
+			<< index.GetNumDirectoriesRead() << " folders read, about " << index.GetNumSyscallsSaved() << " system calls saved\n";
+	}
+
+	const std::string DependencyCacheFile = activeConfig->GetOutputPath() + "dependencies.cache";
+	if( !mDependencies.SaveCache(DependencyCacheFile) )
+	{
+		std::cerr << "Failed to write the dependency cache " << DependencyCacheFile << '\n';
+	}
+
+	const std::string BuildLogFile = activeConfig->GetOutputPath() + "build.log";
+	if( !mBuildLog.Save(BuildLogFile) )
+	{
+		std::cerr << "Failed to write the build log " << BuildLogFile << '\n';
+	}
+
+	mBuildStage = mCompileOk ? STAGE_WAITING_TO_LINK : STAGE_FAILED;
+}
+
+void Project::StartLink()
+{
+	// The linker is a child process like the compiles, run it on the pool so the other projects keep compiling while it goes.
+	mBuildStage = STAGE_LINKING;
+	WorkerPool::Get().Submit([this]()
+	{
+		const bool ok = LinkOutput();
+
+		// Same as BuildTask::Completed, once we let go of the lock Build may return and the project be gone.
+		std::lock_guard<std::mutex> lock(mLinkLock);
+		mLinkOk = ok;
+		mLinkFinished = true;
+		mBuildEvent->Signal();
+	});
+}
+
+bool Project::LinkOutput()
+{
+	switch(mActiveConfig->GetTargetType())
+	{
+	case TARGET_EXEC:
+		// Link. May just do a link if none of the source files needed to be build.
+		return LinkTarget(mActiveConfig,mOutputFiles);
+
+	case TARGET_LIBRARY:
+		return ArchiveLibrary(mActiveConfig,mOutputFiles);
+
+	case TARGET_SHARED_OBJECT:
+		return LinkSharedObject(mActiveConfig,mOutputFiles);
+
+	case TARGET_NOT_SET:
+		std::cerr << "Target type not set, unable to compile configuration \'" << mActiveConfig->GetName() << "\' in project \'" << mProjectName << "\'\n";
+		break;
+	}
+	return false;
+}
+
+bool Project::GetIsTargetUpToDate(ConfigurationPtr pConfig,LinkStamp& rStamp)const
+{
+	const std::string Target = pConfig->GetPathedTargetName();
+	if( rStamp.GetIsUpToDate() )
+	{
+		if( mLoggingMode >= LOG_INFO )
+			std::cout << "Up to date: " << Target << std::endl;
+
+		if( rStamp.GetNumUnchanged() > 0 && mLoggingMode >= LOG_VERBOSE )
+			std::cout << rStamp.GetNumUnchanged() << " inputs of " << Target << " were made again but their contents are the same\n";
+		return true;
+	}
 
-	return CompileOk;
+	// We're going to make it again. Archiving adds to what's there so it has to go, else files no longer in the project would stay in it.
+	remove(Target.c_str());
+	return false;
+}
+
+StringVec Project::GetLinkInputs(const StringVec& pOutputFiles)const
+{
+	// The libraries of the projects we depend on are found by the linker in the search paths, so are not in the object files.
+	StringVec inputs = pOutputFiles;
+	inputs.insert(inputs.end(),mDependencyLibraryTargets.begin(),mDependencyLibraryTargets.end());
+	return inputs;
 }
 
 bool Project::LinkTarget(ConfigurationPtr pConfig,const StringVec& pOutputFiles)
@@ -599,6 +900,10 @@ bool Project::LinkTarget(ConfigurationPtr pConfig,const StringVec& pOutputFiles)
 	Arguments.AddArg("-o");
 	Arguments.AddArg(pConfig->GetPathedTargetName());
 
+	LinkStamp Stamp(pConfig->GetPathedTargetName(),pConfig->GetLinker(),Arguments,GetLinkInputs(pOutputFiles));
+	if( GetIsTargetUpToDate(pConfig,Stamp) )
+		return true;
+
     if( mLoggingMode >= LOG_INFO )
 	    std::cout << "Linking: " << pConfig->GetPathedTargetName() << std::endl;
 
@@ -614,6 +919,10 @@ bool Project::LinkTarget(ConfigurationPtr pConfig,const StringVec& pOutputFiles)
 
 	std::string Results;
 	bool ok = ExecuteShellCommand(pConfig->GetLinker(),Arguments,Results);
+	if( ok )
+		Stamp.Save();
+	else
+		Stamp.Remove();
     if( Results.size() < 1 )
     {
         if( mLoggingMode >= LOG_INFO )
@@ -645,6 +954,10 @@ bool Project::ArchiveLibrary(ConfigurationPtr pConfig,const StringVec& pOutputFi
 	// Add the object files.
 	Arguments.AddArg(pOutputFiles);
 
+	LinkStamp Stamp(pConfig->GetPathedTargetName(),pConfig->GetArchiver(),Arguments,GetLinkInputs(pOutputFiles));
+	if( GetIsTargetUpToDate(pConfig,Stamp) )
+		return true;
+
     if( mLoggingMode >= LOG_INFO )
 	    std::cout << "Archiving: " << pConfig->GetPathedTargetName() << std::endl;
 	
@@ -658,8 +971,25 @@ bool Project::ArchiveLibrary(ConfigurationPtr pConfig,const StringVec& pOutputFi
 		std::cout << std::endl;
 	}
 
+	// Another build, on this machine or one sharing a remote cache, may have archived the same objects.
+	const uint64_t ContentKey = Stamp.GetContentKey();
+	if( ObjectCache::Get().FetchArchive(ContentKey,pConfig->GetPathedTargetName()) )
+	{
+		if( mLoggingMode >= LOG_INFO )
+			std::cout << "Archive taken from the object cache\n";
+		Stamp.Save();
+		return true;
+	}
+
 	std::string Results;
 	bool ok = ExecuteShellCommand(pConfig->GetArchiver(),Arguments,Results);
+	if( ok )
+	{
+		Stamp.Save();
+		ObjectCache::Get().StoreArchive(ContentKey,pConfig->GetPathedTargetName());
+	}
+	else
+		Stamp.Remove();
 
     if( Results.size() < 1 )
     {
@@ -698,6 +1028,10 @@ bool Project::LinkSharedObject(ConfigurationPtr pConfig,const StringVec& pOutput
 	Arguments.AddArg("-o");
 	Arguments.AddArg(pConfig->GetPathedTargetName());
 
+	LinkStamp Stamp(pConfig->GetPathedTargetName(),pConfig->GetLinker(),Arguments,GetLinkInputs(pOutputFiles));
+	if( GetIsTargetUpToDate(pConfig,Stamp) )
+		return true;
+
     if( mLoggingMode >= LOG_INFO )
 	    std::cout << "Linking: " << pConfig->GetPathedTargetName() << std::endl;
 
@@ -713,6 +1047,10 @@ bool Project::LinkSharedObject(ConfigurationPtr pConfig,const StringVec& pOutput
 
 	std::string Results;
 	bool ok = ExecuteShellCommand(pConfig->GetLinker(),Arguments,Results);
+	if( ok )
+		Stamp.Save();
+	else
+		Stamp.Remove();
     if( Results.size() < 1 )
     {
         if( mLoggingMode >= LOG_INFO )
@@ -18,11 +18,16 @@
 #define _PROJECT_H_
 
 #include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
 
 #include "json.h"
 
 #include "build_task.h"
 #include "dependencies.h"
+#include "build_log.h"
+#include "link_stamp.h"
 #include "configuration.h"
 #include "source_files.h"
 #include "search_paths.h"
@@ -50,8 +55,10 @@ public:
 	 * @param pLoggingMode Sets the logging mode for when passing the json file.
 	 * @param pRebuild If true then the build process will be a full rebuild.
 	 * @param pTruncateOutput Sometimes the errors from the compiler can be too long, this will cause these errors to be truncated.
+	 * @param pContentHash If true a source file is only rebuilt when the contents of the files it was built from have changed, not just their modification times.
+	 * @param pFailFast If true when a compile fails the others that are running are killed, else they are left to finish.
 	 */
-	Project(const tinyjson::JsonValue& pProjectJson,const std::string& pProjectName,const std::string& pProjectPath,size_t pNumThreads,int pLoggingMode,bool pRebuild,size_t pTruncateOutput);
+	Project(const tinyjson::JsonValue& pProjectJson,const std::string& pProjectName,const std::string& pProjectPath,size_t pNumThreads,int pLoggingMode,bool pRebuild,size_t pTruncateOutput,bool pContentHash,bool pFailFast);
 
 	/**
 	 * @brief Destroy the Project object
@@ -61,6 +68,11 @@ public:
 
 	operator bool ()const{return mOk;}
 
+	/**
+	 * @brief Builds the configuration and every project it depends on.
+	 * All the projects are loaded first and then built at once, their compiles sharing the same threads.
+	 * A project only waits for the ones it depends on when it is ready to link, as that is the only thing that needs their output.
+	 */
 	bool Build(const std::string& pConfigName);
 	bool RunOutputFile(const std::string& pConfigName)const;
 	void Write(tinyjson::JsonValue& pDocument)const;
@@ -95,7 +107,7 @@ public:
 
 	/**
 	 * @brief Adds a generic file to the list of file dates to be tested against.
-	 * This is used for the project file, if there is one, and maybe some embedded resource files.
+	 * For files that change what is built without the compiler reading them, maybe some embedded resource files. Not the project file, the command each object is built with is checked instead.
 	 * 
 	 * @param pPathedFileName Full path to the file, the file is NOT parsed in anyway. If it's date is younger than the object file being tested a rebuild will be triggered.
 	 */
@@ -107,7 +119,70 @@ private:
 
 	bool ReadConfigurations(const tinyjson::JsonValue& pConfigs);
 
-	bool CompileSource(ConfigurationPtr pConfig,BuildTaskStack& pBuildTasks);
+	/**
+	 * @brief Where a project is in the build. Each project in the graph moves through these on its own.
+	 */
+	enum eBuildStage
+	{
+		STAGE_NOT_STARTED,
+		STAGE_COMPILING,		//!< Running the dependency checks and compiling.
+		STAGE_WAITING_TO_LINK,	//!< Compiled, waiting for the projects it depends on to be done.
+		STAGE_LINKING,			//!< The link or archive is running on the WorkerPool.
+		STAGE_DONE,
+		STAGE_FAILED
+	};
+
+	struct DependantProject
+	{
+		std::shared_ptr<Project> mProject;	//!< Shared, another project may depend on it too.
+		std::string mConfigName;
+	};
+
+	/**
+	 * @brief The projects loaded so far in this build, keyed on the real path of the project file and the configuration.
+	 */
+	typedef std::map<std::string,std::shared_ptr<Project>> ProjectMap;
+
+	/**
+	 * @brief Loads the projects the configuration depends on, and the ones they depend on, and adds their output to our libs.
+	 * @param rLoadedProjects A project already in here is used again and not loaded a second time, so in a diamond the shared project is only checked and built once.
+	 */
+	bool LoadDependantProjects(ConfigurationPtr pConfig,ProjectMap& rLoadedProjects);
+
+	/**
+	 * @brief Adds the projects we depend on and then this one, so every project comes after the ones it needs.
+	 */
+	void GetBuildOrder(std::vector<Project*>& rBuildOrder);
+
+	/**
+	 * @brief Makes the resource files and starts the dependency checks. After this UpdateBuild is called till the stage is done or failed.
+	 * @param rEvent Signalled when there may be something for UpdateBuild to do.
+	 */
+	bool BeginBuild(BuildEvent& rEvent);
+
+	/**
+	 * @brief Moves the build on, starting tasks while rNumRunning is less than pMaxRunning.
+	 * @param rNumRunning How many tasks all the projects have running, shared so the compiles of all of them are limited to the number of threads.
+	 * @return true if something happened, if none of the projects did anything the build can wait on the event.
+	 */
+	bool UpdateBuild(size_t& rNumRunning,size_t pMaxRunning);
+
+	/**
+	 * @brief Stops starting new work, the tasks already running are waited for by UpdateBuild.
+	 * @param pKillRunning If true the compiles that are running are killed, else they are left to finish.
+	 */
+	void CancelBuild(bool pKillRunning);
+
+	bool UpdateCompile(size_t& rNumRunning,size_t pMaxRunning);
+	void FinishCompile();
+	void StartLink();
+	bool LinkOutput();
+	/**
+	 * @brief Checks the link stamp of the target, if it's out of date the target is deleted ready to be made again.
+	 */
+	bool GetIsTargetUpToDate(ConfigurationPtr pConfig,LinkStamp& rStamp)const;
+	StringVec GetLinkInputs(const StringVec& pOutputFiles)const;
+
 	bool LinkTarget(ConfigurationPtr pConfig,const StringVec& pOutputFiles);
 	bool ArchiveLibrary(ConfigurationPtr pConfig,const StringVec& pOutputFiles);
 	bool LinkSharedObject(ConfigurationPtr pConfig,const StringVec& pOutputFiles);
@@ -124,6 +199,8 @@ private:
 	const int mLoggingMode;
 	const bool mRebuild;
 	const size_t mTruncateOutput;
+	const bool mContentHash;
+	const bool mFailFast;
 	
 	// This project file, fully pathed.
 	const std::string mProjectName; //!< The name of the project that will uniquely identify it within a group of loaded projects.
@@ -135,13 +212,33 @@ private:
 	BuildConfigurations mBuildConfigurations;
 
 	StringVec mDependencyLibrarySearchPaths;
+	StringVec mDependencyLibraryTargets;	//!< The pathed output of the dependant projects that are libraries, if they change we have to link again.
 	StringVec mDependencyLibraryFiles;
 	std::string mSharedObjectPaths;		//!< Used to set the search paths to the putput of any shared object files that dependant projects create.
 
 	SearchPaths mIncludeSearchPaths; //!< Global include search paths for the project, used in all configurations.
+	SearchPaths mSystemIncludeSearchPaths; //!< Include paths that hold system headers, these are not checked file by file as they only change when the toolchain or a package is updated. They only mark paths, they are not passed to the compiler, that is mIncludeSearchPaths.
 	SearchPaths mLibrarySearchPaths; //!< Global lib search paths for the project, used in all configurations.
 	SearchPaths mLibraryFiles;
 
+	std::vector<DependantProject> mDependantProjects;
+
+	// The state of the build, only used while Build is running.
+	ConfigurationPtr mActiveConfig;
+	BuildLog mBuildLog;	//!< Before mBuildTasks, the threads making the tasks write to it and are only joined when that is destroyed.
+	std::unique_ptr<BuildTaskStack> mBuildTasks;
+	RunningBuildTasks mRunningTasks;
+	StringVec mOutputFiles;
+	BuildEvent* mBuildEvent;
+	eBuildStage mBuildStage;
+	bool mCompileStarted;
+	bool mCompileOk;
+
+	// Set by the WorkerPool thread running the link.
+	std::mutex mLinkLock;
+	bool mLinkFinished;
+	bool mLinkOk;
+
 	/**
 	 * @brief This is the version of the project, this is required for generation of the correct .so file contents. 
 	 * See https://docs.oracle.com/cd/E19683-01/817-3677/chapter4-2-rason/index.html
@@ -157,6 +254,7 @@ private:
 	/**
 	 * @brief This is used to prevent recursive project references.
 	 * For example ProjectA is dependant on ProjectB which is dependant on ProjectC which is dependant on ProjectA
+	 * A project is in here while the projects it depends on are being loaded, so it holds the path from the root to the project being loaded.
 	 * This is a rare case where a static is useful. I have made sure it still remains behind the closed doors for the class.
 	 * Not a fan of statics, but this is a good use case.
 	 */
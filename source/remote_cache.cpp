@@ -0,0 +1,745 @@
+/*
+   Copyright (C) 2017, Richard e Collins.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "misc.h"
+#include "logging.h"
+#include "remote_cache.h"
+
+namespace appbuild{
+//////////////////////////////////////////////////////////////////////////
+
+static const int CONNECT_TIMEOUT_MS = 5000;
+static const int IO_TIMEOUT_SECONDS = 30;
+static const size_t MAX_HEADER_SIZE = 16*1024;
+static const char* BLOB_CHECK_FORMAT = "appbuild-blob %016llx %016llx\n";
+static const size_t BLOB_CHECK_SIZE = 48;
+
+static void SetTimeouts(int pSocket)
+{
+	const timeval timeout = {IO_TIMEOUT_SECONDS,0};
+	setsockopt(pSocket,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+	setsockopt(pSocket,SOL_SOCKET,SO_SNDTIMEO,&timeout,sizeof(timeout));
+}
+
+// MSG_NOSIGNAL, if the other end has gone we want an error and not a SIGPIPE.
+static bool SendAll(int pSocket,const char* pData,size_t pSize)
+{
+	while( pSize > 0 )
+	{
+		const ssize_t sent = send(pSocket,pData,pSize,MSG_NOSIGNAL);
+		if( sent < 0 && errno == EINTR )
+			continue;
+		if( sent <= 0 )
+			return false;
+		pData += sent;
+		pSize -= sent;
+	}
+	return true;
+}
+
+static bool SendFile(int pSocket,int pFile)
+{
+	char buffer[64*1024];
+	ssize_t bytesRead;
+	while( (bytesRead = read(pFile,buffer,sizeof(buffer))) > 0 )
+	{
+		if( !SendAll(pSocket,buffer,bytesRead) )
+			return false;
+	}
+	return bytesRead == 0;
+}
+
+/**
+ * @brief Reads up to the blank line after the headers, what was read after that is the start of the body.
+ */
+static bool ReadHeader(int pSocket,std::string& rHeader,std::string& rBody)
+{
+	char buffer[4096];
+	for(;;)
+	{
+		const ssize_t got = recv(pSocket,buffer,sizeof(buffer),0);
+		if( got < 0 && errno == EINTR )
+			continue;
+		if( got <= 0 )
+			return false;
+
+		rHeader.append(buffer,got);
+		const size_t end = rHeader.find("\r\n\r\n");
+		if( end != std::string::npos )
+		{
+			rBody = rHeader.substr(end + 4);
+			rHeader.resize(end + 2);
+			return true;
+		}
+
+		if( rHeader.size() > MAX_HEADER_SIZE )
+			return false;
+	}
+}
+
+/**
+ * @return The Content-Length header or -1 if there is not one.
+ */
+static int64_t GetContentLength(const std::string& pHeader)
+{
+	for( size_t line = 0 ; line < pHeader.size() ; line = pHeader.find("\r\n",line) + 2 )
+	{
+		if( CompareNoCase(pHeader.c_str() + line,"content-length:",15) )
+			return strtoll(pHeader.c_str() + line + 15,nullptr,10);
+		if( pHeader.find("\r\n",line) == std::string::npos )
+			break;
+	}
+	return -1;
+}
+
+/**
+ * @brief Writes the body to the file, the part of it already read and then the rest from the socket.
+ * @param pLength The size of the body, if -1 it's read till the other end closes.
+ */
+static bool ReceiveFile(int pSocket,const std::string& pBodyStart,int64_t pLength,const std::string& pFilename)
+{
+	const std::string temp = GetTemporaryFilename(pFilename);
+	const int file = open(temp.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+	if( file < 0 )
+		return false;
+
+	bool ok = write(file,pBodyStart.data(),pBodyStart.size()) == (ssize_t)pBodyStart.size();
+	int64_t received = (int64_t)pBodyStart.size();
+	char buffer[64*1024];
+	while( ok && (pLength < 0 || received < pLength) )
+	{
+		const ssize_t got = recv(pSocket,buffer,sizeof(buffer),0);
+		if( got < 0 && errno == EINTR )
+			continue;
+		if( got <= 0 )
+		{
+			ok = pLength < 0 && got == 0;
+			break;
+		}
+		ok = write(file,buffer,got) == got;
+		received += got;
+	}
+	ok = ok && (pLength < 0 || received == pLength);
+
+	if( close(file) == 0 && ok && rename(temp.c_str(),pFilename.c_str()) == 0 )
+		return true;
+
+	remove(temp.c_str());
+	return false;
+}
+
+static int GetStatusCode(const std::string& pHeader)
+{
+	// HTTP/1.1 200 OK
+	const size_t space = pHeader.find(' ');
+	return space != std::string::npos ? atoi(pHeader.c_str() + space + 1) : 0;
+}
+
+/**
+ * @brief Copies the file and adds a line to the end with its size and hash. It's what is sent, so a blob that was cut short or
+ * damaged, on the way or on the disk of the server, is seen by RemoveCheck when it is got and not used.
+ */
+static bool AddCheck(const std::string& pFilename,const std::string& pCheckedFilename)
+{
+	// The copy is hashed, not the file, the cache may replace it while we're at it.
+	struct stat Stats;
+	uint64_t hash;
+	if( !CopyFile(pFilename,pCheckedFilename) || stat(pCheckedFilename.c_str(),&Stats) != 0 || !HashFile(pCheckedFilename,hash) )
+		return false;
+
+	char check[BLOB_CHECK_SIZE + 1];
+	snprintf(check,sizeof(check),BLOB_CHECK_FORMAT,(unsigned long long)Stats.st_size,(unsigned long long)hash);
+	const int file = open(pCheckedFilename.c_str(),O_WRONLY|O_APPEND);
+	if( file < 0 )
+		return false;
+
+	const bool ok = write(file,check,BLOB_CHECK_SIZE) == (ssize_t)BLOB_CHECK_SIZE;
+	return close(file) == 0 && ok;
+}
+
+/**
+ * @brief Checks the size and hash on the end of a blob that was got and takes them off.
+ * @return false if the blob is not the one that was sent.
+ */
+static bool RemoveCheck(const std::string& pFilename)
+{
+	const int file = open(pFilename.c_str(),O_RDWR);
+	if( file < 0 )
+		return false;
+
+	struct stat Stats;
+	char check[BLOB_CHECK_SIZE + 1] = {};
+	unsigned long long size = 0,hash = 0;
+	bool ok = fstat(file,&Stats) == 0 && (size_t)Stats.st_size >= BLOB_CHECK_SIZE &&
+		pread(file,check,BLOB_CHECK_SIZE,Stats.st_size - BLOB_CHECK_SIZE) == (ssize_t)BLOB_CHECK_SIZE &&
+		sscanf(check,"appbuild-blob %16llx %16llx\n",&size,&hash) == 2 && size == (unsigned long long)Stats.st_size - BLOB_CHECK_SIZE;
+
+	uint64_t got = HashData(nullptr,0);
+	char buffer[64*1024];
+	for( unsigned long long done = 0 ; ok && done < size ; )
+	{
+		const ssize_t bytesRead = read(file,buffer,(size_t)std::min<unsigned long long>(sizeof(buffer),size - done));
+		ok = bytesRead > 0;
+		if( ok )
+		{
+			got = HashData(buffer,bytesRead,got);
+			done += bytesRead;
+		}
+	}
+
+	ok = ok && got == hash && ftruncate(file,(off_t)size) == 0;
+	return close(file) == 0 && ok;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Talks to a server with plain http, GET and PUT of the path of the location with the key on the end. A new connection for each.
+ */
+class HttpCacheBackend : public CacheBackend
+{
+public:
+	HttpCacheBackend(const std::string& pLocation,const std::string& pHost,const std::string& pPort,const std::string& pPath):
+		mLocation(pLocation),mHost(pHost),mPort(pPort),mPath(pPath)
+	{
+	}
+
+	virtual eCacheResult Get(const std::string& pKey,const std::string& pFilename)
+	{
+		const int connection = Connect();
+		if( connection < 0 )
+			return CACHE_ERROR;
+
+		const std::string request = "GET " + mPath + pKey + " HTTP/1.1\r\nHost: " + mHost + "\r\nConnection: close\r\n\r\n";
+		std::string header,body;
+		eCacheResult result = CACHE_ERROR;
+		if( SendAll(connection,request.data(),request.size()) && ReadHeader(connection,header,body) )
+		{
+			const int status = GetStatusCode(header);
+			if( status == 200 )
+				result = ReceiveFile(connection,body,GetContentLength(header),pFilename) ? CACHE_OK : CACHE_ERROR;
+			else if( status == 404 )
+				result = CACHE_NOT_FOUND;
+		}
+		close(connection);
+		return result;
+	}
+
+	virtual eCacheResult Put(const std::string& pKey,const std::string& pFilename)
+	{
+		const int file = open(pFilename.c_str(),O_RDONLY);
+		if( file < 0 )
+			return CACHE_NOT_FOUND;
+
+		struct stat Stats;
+		const int connection = fstat(file,&Stats) == 0 ? Connect() : -1;
+		if( connection < 0 )
+		{
+			close(file);
+			return CACHE_ERROR;
+		}
+
+		const std::string request = "PUT " + mPath + pKey + " HTTP/1.1\r\nHost: " + mHost + "\r\nContent-Length: " + std::to_string((int64_t)Stats.st_size) + "\r\nConnection: close\r\n\r\n";
+		std::string header,body;
+		const bool ok = SendAll(connection,request.data(),request.size()) && SendFile(connection,file) && ReadHeader(connection,header,body) && GetStatusCode(header) / 100 == 2;
+		close(connection);
+		close(file);
+		return ok ? CACHE_OK : CACHE_ERROR;
+	}
+
+	virtual const std::string& GetLocation()const{return mLocation;}
+
+private:
+	int Connect()const
+	{
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo* addresses = nullptr;
+		if( getaddrinfo(mHost.c_str(),mPort.c_str(),&hints,&addresses) != 0 )
+			return -1;
+
+		// Not blocking while connecting, so a server that is not there costs seconds and not minutes.
+		int connection = -1;
+		for( addrinfo* address = addresses ; address != nullptr && connection < 0 ; address = address->ai_next )
+		{
+			connection = socket(address->ai_family,address->ai_socktype|SOCK_CLOEXEC|SOCK_NONBLOCK,address->ai_protocol);
+			if( connection < 0 )
+				continue;
+
+			bool connected = connect(connection,address->ai_addr,address->ai_addrlen) == 0;
+			if( !connected && errno == EINPROGRESS )
+			{
+				pollfd wait = {connection,POLLOUT,0};
+				int error = 0;
+				socklen_t size = sizeof(error);
+				connected = poll(&wait,1,CONNECT_TIMEOUT_MS) == 1 && getsockopt(connection,SOL_SOCKET,SO_ERROR,&error,&size) == 0 && error == 0;
+			}
+
+			if( connected )
+			{
+				fcntl(connection,F_SETFL,fcntl(connection,F_GETFL) & ~O_NONBLOCK);
+				SetTimeouts(connection);
+			}
+			else
+			{
+				close(connection);
+				connection = -1;
+			}
+		}
+		freeaddrinfo(addresses);
+		return connection;
+	}
+
+	const std::string mLocation;
+	const std::string mHost;
+	const std::string mPort;
+	const std::string mPath;	//!< Starts and ends with a '/'.
+};
+
+/**
+ * @brief A folder, a network share that all the machines can see say.
+ */
+class FolderCacheBackend : public CacheBackend
+{
+public:
+	FolderCacheBackend(const std::string& pFolder):mFolder(pFolder)
+	{
+		if( mFolder.back() != '/' )
+			mFolder += '/';
+	}
+
+	virtual eCacheResult Get(const std::string& pKey,const std::string& pFilename)
+	{
+		if( !FileExists(mFolder + pKey) )
+			return CACHE_NOT_FOUND;
+		return CopyFile(mFolder + pKey,pFilename) ? CACHE_OK : CACHE_ERROR;
+	}
+
+	virtual eCacheResult Put(const std::string& pKey,const std::string& pFilename)
+	{
+		if( !FileExists(pFilename) )
+			return CACHE_NOT_FOUND;
+		return CopyFile(pFilename,mFolder + pKey) ? CACHE_OK : CACHE_ERROR;
+	}
+
+	virtual const std::string& GetLocation()const{return mFolder;}
+
+private:
+	std::string mFolder;
+};
+
+std::unique_ptr<CacheBackend> CacheBackend::Create(const std::string& pLocation)
+{
+	if( pLocation.compare(0,7,"http://") == 0 )
+	{
+		// http://host[:port][/path]
+		const size_t hostStart = 7;
+		const size_t pathStart = std::min(pLocation.find('/',hostStart),pLocation.size());
+		std::string host = pLocation.substr(hostStart,pathStart - hostStart);
+		std::string port = "80";
+		const size_t colon = host.rfind(':');
+		if( colon != std::string::npos && host.find(']') == std::string::npos )
+		{
+			port = host.substr(colon + 1);
+			host.resize(colon);
+		}
+
+		std::string path = pathStart < pLocation.size() ? pLocation.substr(pathStart) : "/";
+		if( path.back() != '/' )
+			path += '/';
+
+		if( host.size() == 0 || port.size() == 0 )
+			return nullptr;
+		return std::unique_ptr<CacheBackend>(new HttpCacheBackend(pLocation,host,port,path));
+	}
+
+	if( pLocation.find("://") != std::string::npos || !DirectoryExists(pLocation) )
+		return nullptr;
+
+	return std::unique_ptr<CacheBackend>(new FolderCacheBackend(pLocation));
+}
+
+//////////////////////////////////////////////////////////////////////////
+RemoteCache::RemoteCache(std::unique_ptr<CacheBackend> pBackend):
+	mBackend(std::move(pBackend)),
+	mFailed(false),
+	mNumDownloaded(0),
+	mNumUploaded(0),
+	mUploading(false),
+	mQuit(false)
+{
+	mThread = std::thread([this](){UploadThread();});
+}
+
+RemoteCache::~RemoteCache()
+{
+	Flush();
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		mQuit = true;
+	}
+	mWork.notify_all();
+	mThread.join();
+}
+
+bool RemoteCache::Download(const std::string& pKey,const std::string& pFilename)
+{
+	if( mFailed )
+		return false;
+
+	const eCacheResult result = GetChecked(pKey,pFilename);
+	if( result == CACHE_ERROR )
+		Failed(pKey);
+	else if( result == CACHE_OK )
+		mNumDownloaded++;
+
+	return result == CACHE_OK;
+}
+
+void RemoteCache::Upload(const std::string& pKey,const std::string& pFilename,MergeFunction pMerge)
+{
+	if( mFailed )
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		mUploads.push_back({pKey,pFilename,std::move(pMerge)});
+	}
+	mWork.notify_one();
+}
+
+void RemoteCache::Flush()
+{
+	std::unique_lock<std::mutex> lock(mLock);
+	mIdle.wait(lock,[this](){return mUploads.empty() && !mUploading;});
+}
+
+void RemoteCache::UploadThread()
+{
+	std::unique_lock<std::mutex> lock(mLock);
+	for(;;)
+	{
+		mWork.wait(lock,[this](){return mQuit || mUploads.size() > 0;});
+		if( mQuit )
+			return;
+
+		// In the order they were queued, an object goes before the manifest that points to it.
+		const PendingUpload upload = mUploads.front();
+		mUploads.pop_front();
+		mUploading = true;
+		lock.unlock();
+
+		if( !mFailed )
+		{
+			const eCacheResult result = upload.mMerge ? PutMerged(upload) : PutChecked(upload.mKey,upload.mFilename);
+			if( result == CACHE_ERROR )
+				Failed(upload.mKey);
+			else if( result == CACHE_OK )
+				mNumUploaded++;
+		}
+
+		lock.lock();
+		mUploading = false;
+		if( mUploads.empty() )
+			mIdle.notify_all();
+	}
+}
+
+eCacheResult RemoteCache::PutMerged(const PendingUpload& pUpload)
+{
+	// Got as late as we can, the closer it is to the put the less chance another machine has sent one in between.
+	const std::string remoteFile = GetTemporaryFilename(pUpload.mFilename + ".remote");
+	const std::string mergedFile = GetTemporaryFilename(pUpload.mFilename + ".merged");
+	eCacheResult result = GetChecked(pUpload.mKey,remoteFile);
+	if( result != CACHE_ERROR )
+	{
+		if( pUpload.mMerge(result == CACHE_OK ? remoteFile : std::string(),mergedFile) )
+			result = PutChecked(pUpload.mKey,mergedFile);
+		else
+			result = CACHE_NOT_FOUND;
+	}
+	remove(remoteFile.c_str());
+	remove(mergedFile.c_str());
+	return result;
+}
+
+eCacheResult RemoteCache::GetChecked(const std::string& pKey,const std::string& pFilename)
+{
+	// Only renamed to the file once it has been checked, another build may be looking for it.
+	const std::string temp = GetTemporaryFilename(pFilename);
+	eCacheResult result = mBackend->Get(pKey,temp);
+	if( result == CACHE_OK && !RemoveCheck(temp) )
+	{
+		std::cerr << "The remote cache " << mBackend->GetLocation() << " sent " << pKey << " damaged, it is not used\n";
+		result = CACHE_NOT_FOUND;
+	}
+
+	if( result == CACHE_OK && rename(temp.c_str(),pFilename.c_str()) != 0 )
+		result = CACHE_ERROR;
+	if( result != CACHE_OK )
+		remove(temp.c_str());
+	return result;
+}
+
+eCacheResult RemoteCache::PutChecked(const std::string& pKey,const std::string& pFilename)
+{
+	const std::string checked = GetTemporaryFilename(pFilename + ".check");
+	const eCacheResult result = AddCheck(pFilename,checked) ? mBackend->Put(pKey,checked) : CACHE_NOT_FOUND;
+	remove(checked.c_str());
+	return result;
+}
+
+void RemoteCache::Failed(const std::string& pKey)
+{
+	if( !mFailed.exchange(true) )
+	{
+		std::cerr << "The remote cache " << mBackend->GetLocation() << " failed with " << pKey << ", it will not be used for the rest of the build\n";
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+static void SendStatus(int pSocket,const char* pStatus)
+{
+	const std::string response = std::string("HTTP/1.1 ") + pStatus + "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	SendAll(pSocket,response.data(),response.size());
+}
+
+static void ServeConnection(int pConnection,const std::string& pFolder,int pLoggingMode)
+{
+	SetTimeouts(pConnection);
+
+	std::string header,body;
+	if( !ReadHeader(pConnection,header,body) )
+	{
+		close(pConnection);
+		return;
+	}
+
+	// GET /any/path/KEY HTTP/1.1, only the last part of the path is used. The key can't have a '/' so nothing outside the folder can be asked for.
+	const StringVec request = SplitString(header.substr(0,header.find("\r\n"))," ");
+	const std::string method = request.size() == 3 ? request[0] : "";
+	const std::string path = request.size() == 3 ? request[1] : "";
+	const std::string key = path.substr(path.rfind('/') + 1);
+	bool validKey = key.size() > 0 && key[0] != '.';
+	for( char c : key )
+	{
+		validKey = validKey && (isalnum((unsigned char)c) || c == '.' || c == '-' || c == '_');
+	}
+
+	const char* status = "400 Bad Request";
+	if( validKey && method == "GET" )
+	{
+		const int file = open((pFolder + key).c_str(),O_RDONLY);
+		struct stat Stats;
+		if( file >= 0 && fstat(file,&Stats) == 0 )
+		{
+			status = "200 OK";
+			const std::string response = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string((int64_t)Stats.st_size) + "\r\nConnection: close\r\n\r\n";
+			if( SendAll(pConnection,response.data(),response.size()) )
+				SendFile(pConnection,file);
+		}
+		else
+		{
+			status = "404 Not Found";
+			SendStatus(pConnection,status);
+		}
+
+		if( file >= 0 )
+			close(file);
+	}
+	else if( validKey && method == "PUT" )
+	{
+		const int64_t length = GetContentLength(header);
+		status = length >= 0 && ReceiveFile(pConnection,body,length,pFolder + key) ? "201 Created" : "500 Internal Server Error";
+		SendStatus(pConnection,status);
+	}
+	else
+	{
+		if( validKey )
+			status = "405 Method Not Allowed";
+		SendStatus(pConnection,status);
+	}
+
+	if( pLoggingMode >= LOG_VERBOSE )
+	{
+		std::cout << method + " " + path + " " + status + "\n";
+	}
+	close(pConnection);
+}
+
+int RunCacheServer(int pPort,const std::string& pFolder,int pLoggingMode)
+{
+	std::string folder = pFolder;
+	if( folder.size() == 0 || folder.back() != '/' )
+		folder += '/';
+
+	if( !MakeDir(folder) )
+	{
+		std::cout << "Could not make the cache server folder " << folder << '\n';
+		return EXIT_FAILURE;
+	}
+
+	const int server = socket(AF_INET6,SOCK_STREAM|SOCK_CLOEXEC,0);
+	const int on = 1,off = 0;
+	setsockopt(server,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+	setsockopt(server,IPPROTO_IPV6,IPV6_V6ONLY,&off,sizeof(off));// So IPv4 clients can connect too.
+
+	sockaddr_in6 address = {};
+	address.sin6_family = AF_INET6;
+	address.sin6_addr = in6addr_any;
+	address.sin6_port = htons((uint16_t)pPort);
+	if( server < 0 || bind(server,(sockaddr*)&address,sizeof(address)) != 0 || listen(server,64) != 0 )
+	{
+		std::cout << "The cache server could not listen on port " << pPort << ": " << strerror(errno) << '\n';
+		if( server >= 0 )
+			close(server);
+		return EXIT_FAILURE;
+	}
+
+	if( pLoggingMode >= LOG_INFO )
+		std::cout << "Cache server on port " << pPort << " keeping the blobs in " << folder << ", use --remote-cache=http://thishost:" << pPort << "/\n";
+
+	for(;;)
+	{
+		const int connection = accept4(server,nullptr,nullptr,SOCK_CLOEXEC);
+		if( connection < 0 )
+		{
+			if( errno != EINTR && errno != ECONNABORTED )
+			{
+				perror("accept");
+				close(server);
+				return EXIT_FAILURE;
+			}
+			continue;
+		}
+
+		// A thread each, there are only ever as many connections as the builds have threads.
+		std::thread([connection,folder,pLoggingMode](){ServeConnection(connection,folder,pLoggingMode);}).detach();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+#ifdef DEBUG_BUILD
+// Only built into the debug build, it's the only one that runs them.
+bool DoRemoteCacheUnitTests()
+{
+	const std::string folder = GetTemporaryFilename("/tmp/appbuild_unit_test_remote_cache") + "/";
+	const std::string cacheFolder = folder + "cache/";
+	const std::string serverFolder = folder + "server/";
+	assert( MakeDir(cacheFolder) && MakeDir(serverFolder) );
+	auto ReadFile = [](const std::string& pFilename)
+	{
+		std::ifstream file(pFilename);
+		return std::string((std::istreambuf_iterator<char>(file)),std::istreambuf_iterator<char>());
+	};
+
+	// A blob sent to a folder is got back as it was, one that is not there is a miss and not a failure.
+	{
+		RemoteCache remote(CacheBackend::Create(cacheFolder));
+		std::ofstream(folder + "a.o") << "an object";
+		remote.Upload("a.o",folder + "a.o");
+		remote.Flush();
+		assert( remote.GetNumUploaded() == 1 );
+		assert( remote.Download("a.o",folder + "got.o") && ReadFile(folder + "got.o") == "an object" );
+		assert( remote.Download("b.o",folder + "missing.o") == false && FileExists(folder + "missing.o") == false );
+
+		// Damaged on the server, it's not used.
+		std::fstream(cacheFolder + "a.o",std::fstream::in|std::fstream::out) << "AN";
+		assert( remote.Download("a.o",folder + "damaged.o") == false && FileExists(folder + "damaged.o") == false );
+
+		// Merged with what another machine sent, and when there is nothing there the remote file is empty.
+		std::ofstream(folder + "theirs") << "theirs\n";
+		std::ofstream(folder + "ours") << "ours\n";
+		remote.Upload("m",folder + "theirs");
+		remote.Upload("m",folder + "ours",[&folder,&ReadFile](const std::string& pRemoteFile,const std::string& pMergedFile)
+		{
+			std::ofstream(pMergedFile) << ReadFile(folder + "ours") << ReadFile(pRemoteFile);
+			return true;
+		});
+		std::string remoteFile = "not called";
+		remote.Upload("n",folder + "ours",[&folder,&remoteFile](const std::string& pRemoteFile,const std::string& pMergedFile)
+		{
+			remoteFile = pRemoteFile;
+			return CopyFile(folder + "ours",pMergedFile);
+		});
+		remote.Flush();
+		assert( remote.Download("m",folder + "merged") && ReadFile(folder + "merged") == "ours\ntheirs\n" );
+		assert( remoteFile.size() == 0 && remote.Download("n",folder + "n") && ReadFile(folder + "n") == "ours\n" );
+		assert( remote.GetHasFailed() == false );
+	}
+
+	// The server, given a request as a client would send it.
+	auto Serve = [&serverFolder](const std::string& pRequest,std::string& rBody)
+	{
+		int sockets[2];
+		if( socketpair(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0,sockets) != 0 )
+			return -1;
+
+		std::string header;
+		rBody.clear();
+		SendAll(sockets[0],pRequest.data(),pRequest.size());
+		ServeConnection(sockets[1],serverFolder,LOG_ERROR);
+		ReadHeader(sockets[0],header,rBody);
+		close(sockets[0]);
+		return GetStatusCode(header);
+	};
+
+	std::string body;
+	assert( Serve("PUT /cache/abc.o HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello",body) == 201 );
+	assert( Serve("GET /cache/abc.o HTTP/1.1\r\n\r\n",body) == 200 && body == "hello" );
+	assert( Serve("GET /cache/def.o HTTP/1.1\r\n\r\n",body) == 404 );
+	assert( Serve("DELETE /cache/abc.o HTTP/1.1\r\n\r\n",body) == 405 );
+
+	// Nothing outside the folder, and no hidden files, can be got or written.
+	assert( Serve("GET /cache/ HTTP/1.1\r\n\r\n",body) == 400 );
+	assert( Serve("GET /.. HTTP/1.1\r\n\r\n",body) == 400 );
+	assert( Serve("GET /.hidden HTTP/1.1\r\n\r\n",body) == 400 );
+	assert( Serve("GET /..%2f..%2fetc%2fpasswd HTTP/1.1\r\n\r\n",body) == 400 );
+	assert( Serve("PUT /..%2fescaped HTTP/1.1\r\nContent-Length: 1\r\n\r\nx",body) == 400 );
+	assert( Serve("PUT /a\\b HTTP/1.1\r\nContent-Length: 1\r\n\r\nx",body) == 400 );
+	assert( Serve("GET /a b HTTP/1.1\r\n\r\n",body) == 400 );
+	assert( FileExists(folder + "escaped") == false );
+
+	for( const char* file : {"cache/a.o","cache/m","cache/n","server/abc.o","a.o","got.o","theirs","ours","merged","n","cache","server",""} )
+	{
+		remove((folder + file).c_str());
+	}
+
+	std::cout << "Unit tests for remote cache source file passed.\n";
+	return true;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+};//namespace appbuild
@@ -0,0 +1,152 @@
+/*
+   Copyright (C) 2017, Richard e Collins.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef __REMOTE_CACHE_H__
+#define __REMOTE_CACHE_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "string_types.h"
+
+namespace appbuild{
+//////////////////////////////////////////////////////////////////////////
+
+enum eCacheResult
+{
+	CACHE_OK,
+	CACHE_NOT_FOUND,
+	CACHE_ERROR		//!< Could not talk to the cache, it's not asked again this build.
+};
+
+/**
+ * @brief Where the remote cache keeps its blobs. A blob is a whole file named by a key, Put replaces all of it.
+ * Objects and archives are named by what made them so once written they don't change, but a manifest is written again by every
+ * machine that adds to it, see RemoteCache::Upload. Add a new kind by deriving from this and adding it to Create.
+ * Get and Put are called from more than one thread at once.
+ */
+class CacheBackend
+{
+public:
+	virtual ~CacheBackend(){}
+
+	/**
+	 * @brief Makes the backend for the location, http://host[:port][/path] for a server, like the one RunCacheServer runs, else a folder, a network share say.
+	 * @return nullptr if the location is not understood.
+	 */
+	static std::unique_ptr<CacheBackend> Create(const std::string& pLocation);
+
+	/**
+	 * @brief Writes the blob to the file, all of it or nothing.
+	 */
+	virtual eCacheResult Get(const std::string& pKey,const std::string& pFilename) = 0;
+	virtual eCacheResult Put(const std::string& pKey,const std::string& pFilename) = 0;
+	virtual const std::string& GetLocation()const = 0;
+};
+
+/**
+ * @brief The cache shared by many machines, behind the ObjectCache. What is not in the local cache is looked for here and what is built is sent here.
+ * Downloads are done straight away, the build is waiting for them. Uploads are queued and sent by a thread of their own so the compiles carry on.
+ * Each blob is sent with its size and a hash of its contents on the end, what is got is checked against them.
+ * If the backend fails once it's not used again this build, a server that is down should not make every compile wait for a time out.
+ */
+class RemoteCache
+{
+public:
+	RemoteCache(std::unique_ptr<CacheBackend> pBackend);
+	~RemoteCache();
+
+	bool Download(const std::string& pKey,const std::string& pFilename);
+
+	/**
+	 * @brief Makes the file to send from ours and the copy the remote cache has now, the name of which is empty if it does not have one yet.
+	 * Called on the upload thread, returns false if there is nothing to send.
+	 */
+	typedef std::function<bool(const std::string& pRemoteFile,const std::string& pMergedFile)> MergeFunction;
+
+	/**
+	 * @brief Queues the file to be sent. It's read when it's sent, so it must not be deleted till Flush has been called.
+	 * @param pMerge For a blob that more than one machine writes, so what the others sent is not lost. Just before it's sent the
+	 * remote copy is got and pMerge makes what is sent. Two machines sending at the very same time can still lose one's changes.
+	 */
+	void Upload(const std::string& pKey,const std::string& pFilename,MergeFunction pMerge = nullptr);
+
+	/**
+	 * @brief Waits for all of the uploads to be sent.
+	 */
+	void Flush();
+
+	const std::string& GetLocation()const{return mBackend->GetLocation();}
+	bool GetHasFailed()const{return mFailed;}
+	size_t GetNumDownloaded()const{return mNumDownloaded;}
+	size_t GetNumUploaded()const{return mNumUploaded;}
+
+private:
+	struct PendingUpload
+	{
+		std::string mKey;
+		std::string mFilename;
+		MergeFunction mMerge;
+	};
+
+	void UploadThread();
+	eCacheResult PutMerged(const PendingUpload& pUpload);
+
+	/**
+	 * @brief Get and Put of the backend with the size and hash of the blob on the end, a blob that does not match is not found.
+	 */
+	eCacheResult GetChecked(const std::string& pKey,const std::string& pFilename);
+	eCacheResult PutChecked(const std::string& pKey,const std::string& pFilename);
+	void Failed(const std::string& pKey);
+
+	std::unique_ptr<CacheBackend> mBackend;
+	std::atomic<bool> mFailed;
+	std::atomic<size_t> mNumDownloaded;
+	std::atomic<size_t> mNumUploaded;
+
+	std::mutex mLock;
+	std::condition_variable mWork;
+	std::condition_variable mIdle;
+	std::deque<PendingUpload> mUploads;
+	bool mUploading;
+	bool mQuit;
+	std::thread mThread;
+};
+
+/**
+ * @brief A small http server for the remote cache, GET and PUT of blobs kept as files in a folder. Not something to put on the internet,
+ * there are no passwords and nothing is ever deleted, it's so the remote cache can be tried out and used on a trusted network.
+ * Runs till the process is killed.
+ *
+ * @param pPort The port to listen on.
+ * @param pFolder Where the blobs are kept, made if it's not there.
+ * @return int EXIT_FAILURE if the server could not be started.
+ */
+int RunCacheServer(int pPort,const std::string& pFolder,int pLoggingMode);
+
+//////////////////////////////////////////////////////////////////////////
+bool DoRemoteCacheUnitTests();
+
+//////////////////////////////////////////////////////////////////////////
+};//namespace appbuild
+
+#endif //#ifndef __REMOTE_CACHE_H__
@@ -18,194 +18,441 @@
 #include <sstream>
 #include <unistd.h>
 #include <sys/wait.h>
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <string.h>
+#include <spawn.h>
+#include <signal.h>
+#include <condition_variable>
 
 #include "shell.h"
 #include "misc.h"
 
 namespace appbuild{
 //////////////////////////////////////////////////////////////////////////
-static char* CopyArg(const std::string& pString)
+/**
+ * @brief The argv and envp for a new process, all made before it's started so the child has nothing to do but exec.
+ * The strings are owned by this, nothing is leaked and nothing is allocated or changed in the child.
+ */
+class ProcessArgs
 {
-    char *newString = nullptr;
-    const size_t len = pString.length();
-    if( len > 0 )
+public:
+    ProcessArgs(const std::string& pCommand,const std::vector<std::string>& pArgs,const std::map<std::string,std::string>& pEnv)
     {
-        newString = new char[len + 1];
-        for( size_t n = 0 ; n < len ; n++ )
-            newString[n] = pString.at(n);
-        newString[len] = 0;
-    }
+        // The file name first as per convention, see https://linux.die.net/man/3/execlp.
+        mArgs.push_back(pCommand);
+        for (const std::string& Arg : pArgs)
+        {
+            //Trim leading white space, an argument that is all white space is left out.
+            const size_t start = Arg.find_first_not_of(" \t\n\r\f\v");
+            if( start != std::string::npos )
+                mArgs.push_back(Arg.substr(start));
+        }
 
-    return newString;
-}
+        // Pointers are only taken once all the strings are in, else they would move as the vector grows.
+        for( std::string& arg : mArgs )
+            mArgv.push_back(&arg[0]);
+        mArgv.push_back(nullptr);
 
-static void BuildArgArray(char** pTheArgs, const std::vector<std::string>& pArgs)
-{    
-    for (const std::string& Arg : pArgs)
-    {
-        char* str = CopyArg(Arg);
-        if(str)
+        // Extra environment variables are added to a copy of ours, replacing any with the same name. If there are none the child just gets ours.
+        if( pEnv.size() > 0 )
         {
-            //Trim leading white space.
-            while(isspace(str[0]) && str[0])
-                str++;
-
-            if(str[0])
+            for( char** var = environ ; *var != nullptr ; var++ )
             {
-                *pTheArgs = str;
-                pTheArgs++;
+                const char* equals = strchr(*var,'=');
+                const std::string name(*var,equals ? equals - *var : strlen(*var));
+                if( pEnv.find(name) == pEnv.end() )
+                    mEnv.push_back(*var);
             }
+
+            for( const auto& var : pEnv )
+                mEnv.push_back(var.first + "=" + var.second);
+
+            for( std::string& var : mEnv )
+                mEnvp.push_back(&var[0]);
+            mEnvp.push_back(nullptr);
         }
     }
-    *pTheArgs = nullptr;
+
+    const char* GetFile()const{return mArgv[0];}
+    char* const* GetArgv()const{return mArgv.data();}
+    char* const* GetEnvp()const{return mEnvp.size() > 0 ? mEnvp.data() : environ;}
+
+private:
+    std::vector<std::string> mArgs;
+    std::vector<std::string> mEnv;
+    std::vector<char*> mArgv;
+    std::vector<char*> mEnvp;
+};
+
+// Set by the signal handler, the reactor thread does the work. Only what is safe in a signal handler is done there.
+static volatile sig_atomic_t sInterruptSignal = 0;
+static int sWakeUpFd = -1;
+
+static void InterruptHandler(int pSignal)
+{
+    sInterruptSignal = pSignal;
+    const uint64_t one = 1;
+    if( write(sWakeUpFd,&one,sizeof(one)) < 0 ){}
 }
 
-bool ExecuteShellCommand(const std::string& pCommand,const std::vector<std::string>& pArgs,const std::map<std::string,std::string>& pEnv, std::string& rOutput)
+ChildProcessReactor& ChildProcessReactor::Get()
 {
-    const bool VERBOSE = false;
-    if (pCommand.size() == 0 )
+    static ChildProcessReactor reactor;
+    return reactor;
+}
+
+ChildProcessReactor::ChildProcessReactor():
+    mEpoll(epoll_create1(EPOLL_CLOEXEC)),
+    mWakeUp(eventfd(0,EFD_CLOEXEC|EFD_NONBLOCK)),
+    mStopping(false),
+    mNextID(1)
+{
+    if( mEpoll < 0 || mWakeUp < 0 )
     {
-        std::cerr << "ExecuteShellCommand Command name for was zero length! No command given!\n";
-        return false;
+        perror("ChildProcessReactor");
+        exit(-1);
     }
 
-    int pipeSTDOUT[2];
-    int result = pipe(pipeSTDOUT);
-    if (result < 0)
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = 0;
+    epoll_ctl(mEpoll,EPOLL_CTL_ADD,mWakeUp,&event);
+
+    mThread = std::thread(&ChildProcessReactor::EventLoop,this);
+
+    // Each child is in its own process group so it can be killed with the processes it starts, but then a ctrl-c at the terminal no longer gets to them.
+    // So we catch it, pass it on to every child and then go down with it ourselves.
+    sWakeUpFd = mWakeUp;
+    struct sigaction action = {};
+    action.sa_handler = InterruptHandler;
+    sigemptyset(&action.sa_mask);
+    for( int sig : {SIGINT,SIGTERM,SIGHUP} )
+        sigaction(sig,&action,nullptr);
+}
+
+ChildProcessReactor::~ChildProcessReactor()
+{
     {
-        perror("pipe");
-        exit(-1);
+        std::lock_guard<std::mutex> lock(mLock);
+        mStopping = true;
     }
+    const uint64_t one = 1;
+    if( write(mWakeUp,&one,sizeof(one)) < 0 )
+        perror("ChildProcessReactor");
 
-    int pipeSTDERR[2];
-    result = pipe(pipeSTDERR);
-    if (result < 0)
+    if( mThread.joinable() )
+        mThread.join();
+
+    close(mWakeUp);
+    close(mEpoll);
+}
+
+bool ChildProcessReactor::Start(const std::string& pCommand,const std::vector<std::string>& pArgs,const std::map<std::string,std::string>& pEnv,CompletedCallback pCompleted,std::atomic<uint64_t>* rChildID)
+{
+    if (pCommand.size() == 0 )
     {
-        perror("pipe");
-        exit(-1);
+        std::cerr << "ExecuteShellCommand Command name for was zero length! No command given!\n";
+        return false;
     }
 
-    /* print error message if fork() fails */
-    pid_t pid = fork();
-    if (pid < 0)
+    // Close on exec, else every child gets the pipes of every other child running at the time and they don't close till all of them have exited.
+    // dup2 clears the flag on the copy, so the child still has its own as stdout and stderr.
+    int pipeSTDOUT[2];
+    int pipeSTDERR[2];
+    if( pipe2(pipeSTDOUT,O_CLOEXEC) < 0 )
     {
-        std::cout << "ExecuteShellCommand Fork failed\n";
+        perror("pipe");
         return false;
     }
 
-    /* fork() == 0 for child process */
-    if (pid == 0)
+    if( pipe2(pipeSTDERR,O_CLOEXEC) < 0 )
     {
-        dup2(pipeSTDOUT[1], STDOUT_FILENO ); /* Duplicate writing end to stdout */
+        perror("pipe");
         close(pipeSTDOUT[0]);
         close(pipeSTDOUT[1]);
+        return false;
+    }
 
-        dup2(pipeSTDERR[1], STDERR_FILENO ); /* Duplicate writing end to stdout */
-        close(pipeSTDERR[0]);
-        close(pipeSTDERR[1]);
+    // posix_spawn does not copy our page tables like fork does, that gets slow when we are holding a big dependency graph.
+    // Everything the child needs is made here, it only has to do the dup2s and exec.
+    const ProcessArgs args(pCommand,pArgs,pEnv);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions,pipeSTDOUT[1],STDOUT_FILENO); /* Duplicate writing end to stdout */
+    posix_spawn_file_actions_adddup2(&actions,pipeSTDERR[1],STDERR_FILENO); /* Duplicate writing end to stderr */
 
-        ExecuteCommand(pCommand,pArgs,pEnv);
-    }
+    // In a process group of its own, so that Kill gets the compiler's own children too, cc1plus and as, and not just the driver.
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setflags(&attributes,POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attributes,0);
 
-    /*
-     * parent process
-     */
+    pid_t pid;
+    const int error = posix_spawnp(&pid,args.GetFile(),&actions,&attributes,args.GetArgv(),args.GetEnvp());
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    if( error != 0 )
+    {
+        std::cerr << "ExecuteShellCommand failed to start " << pCommand << " Error: " << strerror(error) << "\n";
+        for( int fd : {pipeSTDOUT[0],pipeSTDOUT[1],pipeSTDERR[0],pipeSTDERR[1]} )
+            close(fd);
+        return false;
+    }
 
     /* Parent process */
     close(pipeSTDOUT[1]); /* Close writing end of pipes, don't need them */
     close(pipeSTDERR[1]); /* Close writing end of pipes, don't need them */
+    fcntl(pipeSTDOUT[0],F_SETFL,O_NONBLOCK);
+    fcntl(pipeSTDERR[0],F_SETFL,O_NONBLOCK);
 
-    size_t BufSize = 1000;
-    char buf[BufSize+1];
-    buf[BufSize] = 0;
+    std::unique_ptr<Child> child(new Child);
+    child->mPid = pid;
+#ifdef SYS_pidfd_open
+    child->mPidfd = (int)syscall(SYS_pidfd_open,pid,0);
+#else
+    child->mPidfd = -1;
+#endif
+    child->mPipes[CHILD_STDOUT] = pipeSTDOUT[0];
+    child->mPipes[CHILD_STDERR] = pipeSTDERR[0];
+    child->mExited = false;
+    child->mWorked = false;
+    child->mCompleted = pCompleted;
+
+    // Added to the map before the fds go in the epoll set, the loop can't look it up till we let go of the lock.
+    std::lock_guard<std::mutex> lock(mLock);
+    const uint64_t id = mNextID++;
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    for( int which : {CHILD_STDOUT,CHILD_STDERR} )
+    {
+        event.data.u64 = (id << KIND_BITS) | which;
+        epoll_ctl(mEpoll,EPOLL_CTL_ADD,child->mPipes[which],&event);
+    }
 
-    struct pollfd Pipes[] =
+    if( child->mPidfd >= 0 )
     {
-        {pipeSTDOUT[0],POLLIN,0},
-        {pipeSTDERR[0],POLLIN,0},
-    };
+        event.data.u64 = (id << KIND_BITS) | CHILD_EXIT;
+        epoll_ctl(mEpoll,EPOLL_CTL_ADD,child->mPidfd,&event);
+    }
+    mChildren[id] = std::move(child);
+    if( rChildID )
+        *rChildID = id;
+    return true;
+}
 
-    int NumPipesOk = 2;
-    std::stringstream outputStream;
-    do
+void ChildProcessReactor::Kill(uint64_t pChildID)
+{
+    // With the lock held the child can't be reaped under us, so its pid, which is also its process group, can't have been reused.
+    std::lock_guard<std::mutex> lock(mLock);
+    auto found = mChildren.find(pChildID);
+    if( found != mChildren.end() && !found->second->mExited )
+        kill(-found->second->mPid,SIGTERM);
+}
+
+void ChildProcessReactor::EventLoop()
+{
+    const int MAX_EVENTS = 64;
+    epoll_event events[MAX_EVENTS];
+    for(;;)
     {
-        int ret = poll(Pipes,2,1000);
-        if( ret < 0 )
+        // Children with no pidfd have to be looked at every so often till they exit, normally that is straight after their pipes close.
+        const int timeout = mWaitingForExit.size() > 0 ? 10 : -1;
+        const int numEvents = epoll_wait(mEpoll,events,MAX_EVENTS,timeout);
+        if( numEvents < 0 && errno != EINTR )
         {
-            rOutput = "Error, pipes failed. Can't capture process output";
-            NumPipesOk = 0;
+            perror("epoll_wait");
+            return;
         }
-        else if(ret  > 0 )
+
+        for( int n = 0 ; n < numEvents ; n++ )
         {
-            for(int n = 0 ; n < 2 ; n++ )
+            const uint64_t id = events[n].data.u64 >> KIND_BITS;
+            const int kind = (int)(events[n].data.u64 & ((1 << KIND_BITS) - 1));
+            if( id == 0 )
             {
-                if( (Pipes[n].revents&POLLIN) != 0 )
-                {
-                    ssize_t num = read(Pipes[n].fd,buf,BufSize);
-                    if( num > 0 )
+                std::lock_guard<std::mutex> lock(mLock);
+                if( mStopping )
+                    return;
+
+                const int sig = sInterruptSignal;
+                if( sig != 0 )
+                {// Pass it on to the children then do what would have happened if we had not caught it.
+                    for( const auto& child : mChildren )
                     {
-                        buf[num] = 0;
-                        outputStream << buf;
+                        if( !child.second->mExited )
+                            kill(-child.second->mPid,sig);
                     }
+                    signal(sig,SIG_DFL);
+                    kill(getpid(),sig);
                 }
-                else if( (Pipes[n].revents&(POLLERR|POLLHUP|POLLNVAL)) != 0 && Pipes[n].events != 0 )
-                {
-                    Pipes[n].fd = -1;
-                    NumPipesOk--;
-                }
+                continue;
+            }
+
+            Child* child = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mLock);
+                auto found = mChildren.find(id);
+                if( found != mChildren.end() )
+                    child = found->second.get();
             }
+
+            if( child == nullptr )
+                continue;// Already finished, an event for an fd that has since been closed.
+
+            if( kind == CHILD_EXIT )
+                Reap(*child,true);
+            else
+                ReadOutput(*child,kind);
+
+            if( FinishIfDone(id,*child) == false && child->mPidfd < 0 && child->mPipes[CHILD_STDOUT] < 0 && child->mPipes[CHILD_STDERR] < 0 )
+                mWaitingForExit.push_back(id);
         }
-    }while(NumPipesOk>0);
-    rOutput = outputStream.str();
 
-    int status;
-    bool Worked = false;
-    if( wait(&status) == -1 )
-    {
-        std::cout << "Failed to wait for child process.\n";
+        for( size_t n = 0 ; n < mWaitingForExit.size() ; )
+        {
+            Child* child;
+            {
+                std::lock_guard<std::mutex> lock(mLock);
+                child = mChildren[mWaitingForExit[n]].get();
+            }
+            Reap(*child,false);
+            if( FinishIfDone(mWaitingForExit[n],*child) )
+                mWaitingForExit.erase(mWaitingForExit.begin() + n);
+            else
+                n++;
+        }
     }
-    else
+}
+
+void ChildProcessReactor::ReadOutput(Child& rChild,int pWhich)
+{
+    const size_t BufSize = 64 * 1024;
+    static char buf[BufSize];// Only the reactor thread reads.
+
+    const int fd = rChild.mPipes[pWhich];
+    if( fd < 0 )
+        return;
+
+    for(;;)
     {
-        if(WIFEXITED(status) && WEXITSTATUS(status) != 0)//did the child terminate normally?
+        const ssize_t num = read(fd,buf,BufSize);
+        if( num > 0 )
         {
-            if( VERBOSE )
-                std::cout << (long)pid << " exited with return code " << WEXITSTATUS(status) << std::endl;
+            rChild.mOutput.append(buf,num);
         }
-        else if (WIFSIGNALED(status))// was the child terminated by a signal?
+        else if( num < 0 && errno == EINTR )
         {
-            if( VERBOSE )
-                std::cout << (long)pid << " terminated because it didn't catch signal number " << WTERMSIG(status) << std::endl;
+            continue;
         }
         else
-        {// Get here, then all is ok.
-            Worked = true;
+        {
+            // Nothing more for now, or the child has closed its end.
+            if( num == 0 || errno != EAGAIN )
+            {
+                epoll_ctl(mEpoll,EPOLL_CTL_DEL,fd,nullptr);
+                close(fd);
+                rChild.mPipes[pWhich] = -1;
+            }
+            return;
         }
     }
+}
 
-    return Worked;
+void ChildProcessReactor::Reap(Child& rChild,bool pBlock)
+{
+    if( rChild.mExited )
+        return;
+
+    // Wait for our pid only, never any child, else we could take the exit status of a compile being run for some other task.
+    // Done with the lock held so Kill never sends a signal to a pid that has been reaped, blocking is only asked for once the pidfd says it has exited.
+    int status;
+    std::unique_lock<std::mutex> lock(mLock);
+    const pid_t result = waitpid(rChild.mPid,&status,pBlock ? 0 : WNOHANG);
+    if( result == 0 )
+        return;// Still running.
+
+    rChild.mExited = true;
+    lock.unlock();
+    if( result < 0 )
+    {
+        std::cout << "Failed to wait for child process.\n";
+        rChild.mWorked = false;
+    }
+    else if(WIFEXITED(status) && WEXITSTATUS(status) != 0)//did the child terminate normally?
+    {
+        rChild.mWorked = false;
+    }
+    else if (WIFSIGNALED(status))// was the child terminated by a signal?
+    {
+        rChild.mWorked = false;
+    }
+    else
+    {// Get here, then all is ok.
+        rChild.mWorked = true;
+    }
+
+    if( rChild.mPidfd >= 0 )
+    {
+        epoll_ctl(mEpoll,EPOLL_CTL_DEL,rChild.mPidfd,nullptr);
+        close(rChild.mPidfd);
+        rChild.mPidfd = -1;
+    }
 }
 
-void ExecuteCommand(const std::string& pCommand,const std::vector<std::string>& pArgs,const std::map<std::string,std::string>& pEnv)
+bool ChildProcessReactor::FinishIfDone(uint64_t pID,Child& rChild)
 {
-    // +1 for the NULL and +1 for the file name as per convention, see https://linux.die.net/man/3/execlp.
-    char** TheArgs = new char*[pArgs.size() + 2];
-    TheArgs[0] = CopyArg(pCommand);
-    BuildArgArray(TheArgs+1,pArgs);
+    // Done when it has gone and we have everything it wrote. The pipes can close before the exit is seen and the other way round.
+    if( !rChild.mExited || rChild.mPipes[CHILD_STDOUT] >= 0 || rChild.mPipes[CHILD_STDERR] >= 0 )
+        return false;
 
-    // Build the environment variables.
-    for( const auto& var : pEnv )
+    std::unique_ptr<Child> done;
     {
-        setenv(var.first.c_str(),var.second.c_str(),1);
+        std::lock_guard<std::mutex> lock(mLock);
+        done = std::move(mChildren[pID]);
+        mChildren.erase(pID);
     }
+    done->mCompleted(done->mWorked,done->mOutput);
+    return true;
+}
+
+bool ExecuteShellCommand(const std::string& pCommand,const std::vector<std::string>& pArgs,const std::map<std::string,std::string>& pEnv, std::string& rOutput)
+{
+    std::mutex lock;
+    std::condition_variable condition;
+    bool done = false;
+    bool Worked = false;
+
+    const bool started = ChildProcessReactor::Get().Start(pCommand,pArgs,pEnv,[&](bool pWorked,std::string& pOutput)
+    {// Notify with the lock held, once it's released we may have returned and these are gone.
+        std::lock_guard<std::mutex> guard(lock);
+        Worked = pWorked;
+        rOutput.swap(pOutput);
+        done = true;
+        condition.notify_all();
+    });
+
+    if( !started )
+        return false;
+
+    std::unique_lock<std::mutex> guard(lock);
+    condition.wait(guard,[&done](){return done;});
+    return Worked;
+}
+
+void ExecuteCommand(const std::string& pCommand,const std::vector<std::string>& pArgs,const std::map<std::string,std::string>& pEnv)
+{
+    const ProcessArgs args(pCommand,pArgs,pEnv);
 
-    // This replaces the current process so no need to clean up the memory leaks before here. ;)
-    execvp(TheArgs[0], TheArgs);
+    // This replaces the current process.
+    execvpe(args.GetFile(),args.GetArgv(),args.GetEnvp());
 
     const char* errorString = strerror(errno);
 
-    std::cerr << "ExecuteCommand execvp() failure!\n" << "    Error: " << errorString << "\n    This print is after execvp() and should not have been executed if execvp were successful!\n";
+    std::cerr << "ExecuteCommand execvpe() failure!\n" << "    Error: " << errorString << "\n    This print is after execvpe() and should not have been executed if execvpe were successful!\n";
 
     // Should never get here!
     THROW_APPBUILD_EXCEPTION("Command execution failed! Should not have returned! " + pCommand + " Error: " + errorString);
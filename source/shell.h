@@ -19,13 +19,93 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <sys/types.h>
 
 namespace appbuild{
 //////////////////////////////////////////////////////////////////////////
 
+/**
+ * @brief Runs child processes without needing a thread for each one.
+ * One thread watches the stdout and stderr pipes and a pidfd of every running child in a single epoll set.
+ * When a child has exited and all its output has been read its callback is called.
+ * Each child is reaped by its own pid, so when many are running at once we never get the exit status of another one.
+ * On kernels without pidfd_open, before 5.3, a child is checked for with waitpid once its pipes have closed.
+ * Safe to use from many threads.
+ */
+class ChildProcessReactor
+{
+public:
+    /**
+     * @brief Called on the reactor thread when the child is done. Keep it short, everything else is waiting, hand real work to the WorkerPool.
+     * @param pWorked True if the command ran and returned zero.
+     * @param rOutput Everything it wrote to stdout and stderr. Can be swapped out, it is not used after.
+     */
+    typedef std::function<void(bool pWorked,std::string& rOutput)> CompletedCallback;
+
+    static ChildProcessReactor& Get();
+
+    /**
+     * @brief Starts the command and returns without waiting for it.
+     * The child is in a process group of its own, a ctrl-c, or a SIGTERM or SIGHUP, sent to us is passed on to it.
+     * @param rChildID If not null set to an id that can be passed to Kill.
+     * @return true if it was started, pCompleted will be called when it's done.
+     * @return false Could not start it, pCompleted is not called.
+     */
+    bool Start(const std::string& pCommand,const std::vector<std::string>& pArgs,const std::map<std::string,std::string>& pEnv,CompletedCallback pCompleted,std::atomic<uint64_t>* rChildID = nullptr);
+
+    /**
+     * @brief Sends SIGTERM to the child and everything it has started. It is reaped as normal and its callback called with pWorked false.
+     * Does nothing if it has already finished.
+     */
+    void Kill(uint64_t pChildID);
+
+private:
+    enum
+    {
+        CHILD_STDOUT = 0,
+        CHILD_STDERR = 1,
+        CHILD_EXIT = 2,
+        KIND_BITS = 2   //!< The epoll data is the id of the child shifted up by this with the kind of fd in the bottom bits. An id of zero is mWakeUp.
+    };
+
+    struct Child
+    {
+        pid_t mPid;
+        int mPidfd;             //!< -1 if the kernel does not have pidfd_open.
+        int mPipes[2];          //!< stdout and stderr, -1 once it has been closed.
+        bool mExited;
+        bool mWorked;
+        std::string mOutput;
+        CompletedCallback mCompleted;
+    };
+
+    ChildProcessReactor();
+    ~ChildProcessReactor();
+
+    void EventLoop();
+    void ReadOutput(Child& rChild,int pWhich);
+    void Reap(Child& rChild,bool pBlock);
+    bool FinishIfDone(uint64_t pID,Child& rChild);
+
+    int mEpoll;
+    int mWakeUp;                //!< An eventfd, used to stop the loop.
+    bool mStopping;
+    uint64_t mNextID;
+    std::mutex mLock;           //!< Guards mChildren and mExited, only the reactor thread changes a child once it has been added.
+    std::unordered_map<uint64_t,std::unique_ptr<Child>> mChildren;
+    std::vector<uint64_t> mWaitingForExit;  //!< Children with no pidfd whose pipes have closed, only used by the reactor thread.
+    std::thread mThread;
+};
+
 /**
  * @brief Calls and waits for the command in pCommand with the arguments pArgs and addictions to environment variables in pEnv.
- * Uses the function ExecuteCommand below but first forks the process so that current execution can continue.
+ * Runs it with the ChildProcessReactor, which starts it with posix_spawn, and waits for it to finish.
  * https://linux.die.net/man/3/execvp
  * 
  * Blocking. If you need a non blocking then just call in a worker thread of your own. This makes it cleaner and more flexable.
@@ -41,7 +121,7 @@ extern bool ExecuteShellCommand(const std::string& pCommand,const std::vector<st
 
 /**
  * @brief Calls and waits for the command in pCommand with the arguments pArgs.
- * Uses the function ExecuteCommand below but first forks the process so that current execution can continue.
+ * Runs it with the ChildProcessReactor, which starts it with posix_spawn, and waits for it to finish.
  * https://linux.die.net/man/3/execvp
  * 
  * Blocking. If you need a non blocking then just call in a worker thread of your own. This makes it cleaner and more flexable.
@@ -60,7 +140,7 @@ inline bool ExecuteShellCommand(const std::string& pCommand,const std::vector<st
 
 /**
  * @brief Replaces the current process image with the command in pCommand with the arguments pArgs and addictions to environment variables in pEnv.
- * Uses the execvp command.
+ * Uses the execvpe command, the environment is passed to it and not set in this process.
  * https://linux.die.net/man/3/execvp
  * 
  * Replaces the current process, so not returning from this function!
@@ -20,6 +20,7 @@
 
 #include "source_files.h"
 #include "misc.h"
+#include "directory_index.h"
 #include "logging.h"
 
 namespace appbuild{
@@ -72,7 +73,7 @@ bool SourceFiles::AddFile(const std::string& pFileName)
 		// Make the string we're going to check a constant so we can be sure we don't accidentally change it.
 		const std::string InputFilename = (isAbsolute) ? (pFileName) : (mProjectDir + pFileName);
 		// If the source file exists then we'll continue, else show an error.
-		if( FileExists(InputFilename) )
+		if( DirectoryIndex::Get().FileExists(InputFilename) )
 		{
 			mFiles.insert(pFileName);
 			return true;
@@ -0,0 +1,112 @@
+/*
+   Copyright (C) 2017, Richard e Collins.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include <assert.h>
+#include <algorithm>
+
+#include "worker_pool.h"
+
+namespace appbuild{
+//////////////////////////////////////////////////////////////////////////
+WorkerPool& WorkerPool::Get()
+{
+	static WorkerPool pool;
+	return pool;
+}
+
+WorkerPool::WorkerPool():
+	mMaxThreads(1),
+	mNumIdle(0),
+	mNumWorkDone(0),
+	mStopping(false)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		mStopping = true;
+	}
+	mWorkWaiting.notify_all();
+
+	for( auto& thread : mThreads )
+	{
+		if( thread.joinable() )
+			thread.join();
+	}
+}
+
+void WorkerPool::Submit(std::function<void()> pWork)
+{
+	assert(pWork);
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		mWork.push_back(pWork);
+
+		// Only make a thread if the ones we have are all busy.
+		if( mWork.size() > mNumIdle && mThreads.size() < mMaxThreads )
+		{
+			mThreads.emplace_back(&WorkerPool::Worker,this);
+			return;// The new thread will find the work, no need to wake another.
+		}
+	}
+	mWorkWaiting.notify_one();
+}
+
+void WorkerPool::SetMaxThreads(size_t pMaxThreads)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	mMaxThreads = std::max(mMaxThreads,pMaxThreads);
+}
+
+size_t WorkerPool::GetNumThreads()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	return mThreads.size();
+}
+
+size_t WorkerPool::GetNumWorkDone()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	return mNumWorkDone;
+}
+
+void WorkerPool::Worker()
+{
+	std::unique_lock<std::mutex> lock(mLock);
+	for(;;)
+	{
+		mNumIdle++;
+		mWorkWaiting.wait(lock,[this](){return mStopping || mWork.size() > 0;});
+		mNumIdle--;
+
+		if( mWork.size() == 0 )
+			return;// Stopping and nothing left to do.
+
+		std::function<void()> work = mWork.front();
+		mWork.pop_front();
+		mNumWorkDone++;
+
+		lock.unlock();
+		work();
+		lock.lock();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+};//namespace appbuild
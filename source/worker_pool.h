@@ -0,0 +1,76 @@
+/*
+   Copyright (C) 2017, Richard e Collins.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#ifndef __WORKER_POOL_H__
+#define __WORKER_POOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace appbuild{
+//////////////////////////////////////////////////////////////////////////
+/**
+ * @brief The threads that do the work of a build, the compiles, resource generation and the dependency checks.
+ * Threads are only made when there is work waiting and none are idle, up to the maximum, and then kept for the life of the process.
+ * So a build of a thousand files makes a handful of threads and not a thousand.
+ * The work is taken in the order it was submitted. Each piece of work is big, a whole compile, so one queue is plenty, there is no need to steal work.
+ * Work must not wait on other work in the pool, if all the threads did that nothing would run.
+ * Safe to use from many threads.
+ */
+class WorkerPool
+{
+public:
+	static WorkerPool& Get();
+
+	/**
+	 * @brief Queues the work to be run on one of the threads.
+	 */
+	void Submit(std::function<void()> pWork);
+
+	/**
+	 * @brief Lets the pool have up to this many threads. Can only go up, the threads already made are kept.
+	 * Needs to be at least the number of things that can be running at once else some will be held up waiting for others to finish.
+	 */
+	void SetMaxThreads(size_t pMaxThreads);
+
+	size_t GetNumThreads();
+	size_t GetNumWorkDone();
+
+private:
+	WorkerPool();
+	~WorkerPool();
+
+	void Worker();
+
+	std::mutex mLock;
+	std::condition_variable mWorkWaiting;
+	std::deque<std::function<void()>> mWork;
+	std::vector<std::thread> mThreads;
+	size_t mMaxThreads;
+	size_t mNumIdle;		//!< Threads waiting for work, if there are none a new thread is made, if allowed.
+	size_t mNumWorkDone;
+	bool mStopping;
+};
+
+//////////////////////////////////////////////////////////////////////////
+};//namespace appbuild
+
+#endif //#ifndef __WORKER_POOL_H__
@@ -0,0 +1,152 @@
+/*
+   Copyright (C) 2017, Richard e Collins.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+// Times Dependencies::ScanFileForIncludeNames against the getline scanner appbuild used before it.
+// Not built with appbuild, it's opt in, cmake --build <build folder> --target include_scan_benchmark
+// include_scan_benchmark [passes] [folder ...] the default is 5 passes over /usr/include/, every file in the folders and the folders under them is scanned.
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#include "../source/dependencies.h"
+
+using namespace appbuild;
+
+namespace{
+/**
+ * @brief The scanner from the first version of Dependencies::GetIncludesFromFile, as it was but for the include being kept as a name and not looked for on the include paths.
+ */
+void GetIncludesFromFileByLine(const std::string& pFilename,StringVec& rIncludes)
+{
+	std::ifstream file(pFilename);
+	if( file.is_open() )
+	{
+		while( file.eof() == false )
+		{
+			std::string aLine;
+			std::getline(file,aLine);
+			if( aLine.size() >= 12 )// Has to be >= than 12 for #include <a> the shortest incarnation.
+			{
+				std::size_t found = aLine.find("#include");
+				if( found != std::string::npos )
+				{
+					found += 8;// Skip #include
+					// Now scan from here to find a " or a <.
+					// I can not use another find as the line maybe malformed.
+					while( found < aLine.size() )
+					{
+						char terminator = 0;
+						if( aLine[found] == '\"' )
+							terminator = '\"';
+						else if( aLine[found] == '<' )
+							terminator = '>';
+
+						found++;// Next char.
+
+						// If we have a terminator then scan to the end and treat that as the filename.
+						if( terminator != 0 )
+						{
+							std::size_t start = found;
+							for(; found < aLine.size() && aLine[found] != terminator ; found++);
+
+							// Did we find the end?
+							if( aLine[found] == terminator )
+							{
+								rIncludes.push_back(aLine.substr(start,found-start));
+							}
+							// And done. Next line please.
+							found = aLine.size();
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+void FindAllFiles(const std::string& pFolder,StringVec& rFiles)
+{
+	DIR* dir = opendir(pFolder.c_str());
+	if( !dir )
+		return;
+
+	for( struct dirent* ent = readdir(dir) ; ent != nullptr ; ent = readdir(dir) )
+	{
+		const std::string name = ent->d_name;
+		if( ent->d_type == DT_REG )
+			rFiles.push_back(pFolder + name);
+		else if( ent->d_type == DT_DIR && name != "." && name != ".." )
+			FindAllFiles(pFolder + name + "/",rFiles);
+	}
+	closedir(dir);
+}
+};
+
+int main(int argc, char *argv[])
+{
+	const int passes = argc > 1 ? std::max(1,atoi(argv[1])) : 5;
+	StringVec folders;
+	for( int n = 2 ; n < argc ; n++ )
+		folders.push_back(std::string(argv[n]) + (argv[n][strlen(argv[n])-1] == '/' ? "" : "/"));
+	if( folders.size() == 0 )
+		folders.push_back("/usr/include/");
+
+	StringVec files;
+	for( const std::string& folder : folders )
+		FindAllFiles(folder,files);
+
+	// Once before timing so both start with the files in the page cache.
+	size_t bytes = 0;
+	for( const std::string& file : files )
+	{
+		std::ifstream in(file,std::ifstream::ate|std::ifstream::binary);
+		bytes += in.is_open() ? (size_t)in.tellg() : 0;
+	}
+
+	auto Time = [&files,passes](void(*pScan)(const std::string&,StringVec&),size_t& rFound)
+	{
+		StringVec includes;
+		const auto start = std::chrono::steady_clock::now();
+		for( int pass = 0 ; pass < passes ; pass++ )
+		{
+			includes.clear();
+			for( const std::string& file : files )
+				pScan(file,includes);
+		}
+		rFound = includes.size();
+		return std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - start).count() / passes;
+	};
+
+	size_t foundByLine = 0,foundByName = 0;
+	const double byLine = Time(GetIncludesFromFileByLine,foundByLine);
+	const double byName = Time([](const std::string& pFile,StringVec& rIncludes)
+	{
+		StringVec names;
+		if( Dependencies::ScanFileForIncludeNames(pFile,names) )
+			rIncludes.insert(rIncludes.end(),names.begin(),names.end());
+	},foundByName);
+
+	std::cout << files.size() << " files, " << bytes / 1024 << "KB, " << passes << " passes, the time is for one pass.\n";
+	std::cout << "getline                 " << byLine << "ms " << foundByLine << " includes\n";
+	std::cout << "ScanFileForIncludeNames " << byName << "ms " << foundByName << " includes\n";
+	std::cout << "Speed up " << (byName > 0 ? byLine / byName : 0) << "x\n";
+	return EXIT_SUCCESS;
+}